@@ -56,10 +56,17 @@ load_as_dimbound(const char *name)
 {
     GT3_Dim *dim;
     GT3_DimBound *bnd;
-
-    if ((dim = GT3_loadDim(name)) == NULL) {
-        GT3_printErrorMessages(stderr);
-        return NULL;
+    double t0;
+
+    if ((dim = bundle_dim(name)) == NULL) {
+        t0 = stats_clock();
+        dim = GT3_loadDim(name);
+        io_account(IO_AXIS, IO_READ, name,
+                   dim ? sizeof(double) * dim->len : 0, t0);
+        if (dim == NULL) {
+            GT3_printErrorMessages(stderr);
+            return NULL;
+        }
     }
 
     bnd = get_dimbound_from_gt3dim(dim);
@@ -157,17 +164,24 @@ get_axis_of_chars(const char *name, const char *aitm,
     int newid = -1;
     char *values = NULL;
     char path[PATH_MAX + 1];
+    double t0 = stats_clock();
+    long nread;
 
-    if ((gf = GT3_openAxisFile(aitm)) == NULL) {
-        GT3_printErrorMessages(stderr);
-        return -1;
-    }
-    snprintf(path, PATH_MAX, "%s.txt", gf->path);
-    GT3_close(gf);
+    path[0] = '\0';
+    if ((fp = bundle_labels(aitm)) == NULL) {
+        if ((gf = GT3_openAxisFile(aitm)) == NULL) {
+            GT3_printErrorMessages(stderr);
+            return -1;
+        }
+        snprintf(path, PATH_MAX, "%s.txt", gf->path);
+        GT3_close(gf);
 
-    if ((fp = fopen(path, "r")) == NULL) {
-        logging(LOG_SYSERR, path);
-        goto finish;
+        fp = fopen(path, "r");
+        io_account(IO_AXIS, IO_OPEN, path, 0, t0);
+        if (fp == NULL) {
+            logging(LOG_SYSERR, path);
+            goto finish;
+        }
     }
 
     if ((values = malloc(len * MAXLEN_CAXIS)) == NULL) {
@@ -175,7 +189,10 @@ get_axis_of_chars(const char *name, const char *aitm,
         goto finish;
     }
 
+    t0 = stats_clock();
     get_char_values(values, MAXLEN_CAXIS, len, idx, fp);
+    if (path[0] != '\0' && (nread = ftell(fp)) >= 0)
+        io_account(IO_AXIS, IO_READ, path, nread, t0);
     if (cmor_axis(&newid, (char *)name, "1", len,
                   values, 'c',
                   NULL, MAXLEN_CAXIS, NULL) != 0) {
@@ -255,12 +272,27 @@ GT3_DimBound *
 get_dimbound(const char *name)
 {
     GT3_DimBound *bnd;
+    GT3_Dim *dim;
     char newname[17];
+    double t0;
 
-    if ((bnd = GT3_getDimBound(name)) == NULL) {
-        snprintf(newname, sizeof newname, "%s.M", name);
-        bnd = load_as_dimbound(newname);
+    snprintf(newname, sizeof newname, "%s.M", name);
+
+    /* the axis bundle first. */
+    if ((bnd = bundle_dimbound(name)) != NULL)
+        return bnd;
+    if ((dim = bundle_dim(newname)) != NULL) {
+        bnd = get_dimbound_from_gt3dim(dim);
+        GT3_freeDim(dim);
+        return bnd;
     }
+
+    t0 = stats_clock();
+    bnd = GT3_getDimBound(name);
+    io_account(IO_AXIS, IO_READ, name,
+               bnd ? sizeof(double) * bnd->len : 0, t0);
+    if (bnd == NULL)
+        bnd = load_as_dimbound(newname);
     return bnd;
 }
 
@@ -274,11 +306,25 @@ get_axisid(const GT3_Dim *dim,
     double *values = NULL;
     double *bounds = NULL;
     int dimlen = 0;
-    GT3_DimBound *bnd = NULL;
+    const GT3_DimBound *bnd = NULL;
     int axisid = -1;
+    char key[512];
+    int keylen;
+
+    /*
+     * reuse the axis already defined in this session.
+     */
+    keylen = snprintf(key, sizeof key, "axis %s %s %d:%d %s %s",
+                      adef->id, dim->name, astr, aend,
+                      zslice ? zslice->spec : "-",
+                      dim->unit ? dim->unit : "-");
+    if (keylen >= sizeof key)
+        key[0] = '\0';
+    else if ((axisid = idreg_lookup(key)) >= 0)
+        return axisid;
 
     if (adef->must_have_bounds) {
-        if ((bnd = get_dimbound(dim->name)) == NULL)
+        if ((bnd = get_cached_dimbound(dim->name)) == NULL)
             goto finish;
 
         bounds = bnd->bnd + astr - 1;
@@ -321,8 +367,11 @@ get_axisid(const GT3_Dim *dim,
                                  bounds,
                                  dimlen);
 
+    if (axisid >= 0 && key[0] != '\0')
+        idreg_register(key, axisid);
+
 finish:
-    GT3_freeDimBound(bnd);
+    release_dimbound(bnd);
     if (zslice)
         free(values);
 
@@ -347,14 +396,15 @@ get_axis_ids(int *ids, int *nids,
              const cmor_var_def_t *vdef,
              const GT3_HEADER *head)
 {
-    GT3_Dim *dim;
+    const GT3_Dim *dim;
+    GT3_Dim view;
     cmor_axis_def_t *adef = NULL;
     int rval = -1;
     int axisid;
 
     *nids = 0;
     if (aend - astr <= 0 && dummy_dimname(aitm)) {
-        logging(LOG_INFO, "skip empty dim (%s).", aitm);
+        LOGGING(LOG_INFO, "skip empty dim (%s).", aitm);
         return 0;
     }
 
@@ -412,16 +462,17 @@ get_axis_ids(int *ids, int *nids,
         return 0;
     }
 
-    if ((dim = GT3_getDim(aitm)) == NULL) {
+    if ((dim = get_dim(aitm)) == NULL) {
         GT3_printErrorMessages(stderr);
         return -1;
     }
+    view = *dim;
 
     if (dim->title) {
         adef = lookup_axisdef_in_vardef(dim->title, vdef);
     }
     if (adef)
-        logging(LOG_INFO, "found '%s' in %s(%s)", adef->id, aitm, dim->title);
+        LOGGING(LOG_INFO, "found '%s' in %s(%s)", adef->id, aitm, dim->title);
 
     if (!adef && has_modellevel_dim(vdef)) {
         /*
@@ -450,11 +501,9 @@ get_axis_ids(int *ids, int *nids,
                     logging(LOG_WARN, "%s: No such aixs in MIP table.",
                             tab[n].value);
 
-                if (tab[n].unit) {
-                    /* overwrite unit in GTAXLOC file. */
-                    free(dim->unit);
-                    dim->unit = strdup(tab[n].unit);
-                }
+                if (tab[n].unit)
+                    /* overwrite unit in GTAXLOC file (dim is shared). */
+                    view.unit = (char *)tab[n].unit;
                 break;
             }
     }
@@ -464,7 +513,7 @@ get_axis_ids(int *ids, int *nids,
                 " check TITLE field in GTAXLOC.%s.", aitm);
         goto finish;
     }
-    if ((axisid = get_axisid(dim, astr, aend, adef, slice)) < 0)
+    if ((axisid = get_axisid(&view, astr, aend, adef, slice)) < 0)
         goto finish;
 
     ids[0] = axisid;
@@ -472,7 +521,7 @@ get_axis_ids(int *ids, int *nids,
     rval = 0;
 
 finish:
-    GT3_freeDim(dim);
+    release_dim(dim);
     return rval;
 }
 
@@ -495,10 +544,10 @@ test_sigma(const char *sigma_name)
     assert(axisid >= 0);
     axis = cmor_axes + axisid;
 
-    logging(LOG_INFO, "axisdef id: %s", adef->id);
-    logging(LOG_INFO, "axis    id: %s", axis->id);
-    logging(LOG_INFO, "hybrid_in : %d", axis->hybrid_in);
-    logging(LOG_INFO, "hybrid_out: %d", axis->hybrid_out);
+    LOGGING(LOG_INFO, "axisdef id: %s", adef->id);
+    LOGGING(LOG_INFO, "axis    id: %s", axis->id);
+    LOGGING(LOG_INFO, "hybrid_in : %d", axis->hybrid_in);
+    LOGGING(LOG_INFO, "hybrid_out: %d", axis->hybrid_out);
     assert(axis->axis == 'Z');
 
     /*
@@ -506,7 +555,7 @@ test_sigma(const char *sigma_name)
      * No "convert_to" attribute results in hybrid_in == hybrid_out.
      */
     if (axis->hybrid_in != axis->hybrid_out) {
-        logging(LOG_INFO, "convert_to: %s", adef->convert_to);
+        LOGGING(LOG_INFO, "convert_to: %s", adef->convert_to);
         assert(adef->convert_to[0] != '\0');
     }
     GT3_freeDim(dim);
@@ -0,0 +1,404 @@
+/*
+ * axisbundle.c -- reader of an axis bundle (made by mkaxisbundle).
+ *
+ * On a cold parallel filesystem, each axis lookup in the GTOOL3 search
+ * path costs several metadata operations. An axis bundle holds all
+ * the axes of a GTAXLOC directory in one file, which is mapped once
+ * and consulted before the search path.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gtool3.h"
+#include "logging.h"
+#include "internal.h"
+#include "axisbundle.h"
+
+static void *map = NULL;
+static size_t mapsize = 0;
+static const struct bundle_header *header = NULL;
+static const struct bundle_entry *entries = NULL;
+static const int32_t *buckets = NULL;
+
+
+/*
+ * FNV-1a (32-bit) of the name and the kind.
+ */
+uint32_t
+bundle_hash(const char *name, int kind)
+{
+    uint32_t hash = 2166136261U;
+    const unsigned char *p;
+
+    for (p = (const unsigned char *)name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619U;
+    }
+    hash ^= (unsigned char)kind;
+    hash *= 16777619U;
+    return hash;
+}
+
+
+static int
+valid_bundle(const struct bundle_header *head, size_t size)
+{
+    size_t esize, bsize;
+
+    if (size < sizeof(struct bundle_header)
+        || memcmp(head->magic, AXIS_BUNDLE_MAGIC, 8) != 0
+        || head->version != AXIS_BUNDLE_VERSION
+        || head->size != size
+        || head->nentries < 0
+        || head->nbuckets <= 0
+        || (head->nbuckets & (head->nbuckets - 1)) != 0)
+        return 0;
+
+    esize = sizeof(struct bundle_entry) * head->nentries;
+    bsize = sizeof(int32_t) * head->nbuckets;
+    return head->entries_off > 0 && head->entries_off + esize <= size
+        && head->buckets_off > 0 && head->buckets_off + bsize <= size;
+}
+
+
+/*
+ * Use an axis bundle before the GTOOL3 search path.
+ */
+int
+set_axis_bundle(const char *path)
+{
+    struct stat sb;
+    void *ptr;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &sb) < 0) {
+        logging(LOG_SYSERR, path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    ptr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        logging(LOG_SYSERR, path);
+        return -1;
+    }
+    if (!valid_bundle(ptr, sb.st_size)) {
+        logging(LOG_ERR, "%s: not an axis bundle.", path);
+        munmap(ptr, sb.st_size);
+        return -1;
+    }
+
+    unset_axis_bundle();
+    map = ptr;
+    mapsize = sb.st_size;
+    header = map;
+    entries = (const struct bundle_entry *)((char *)map + header->entries_off);
+    buckets = (const int32_t *)((char *)map + header->buckets_off);
+    logging(LOG_INFO, "axis bundle: %s (%d entries)", path, header->nentries);
+    return 0;
+}
+
+
+void
+unset_axis_bundle(void)
+{
+    if (map)
+        munmap(map, mapsize);
+    map = NULL;
+    mapsize = 0;
+    header = NULL;
+    entries = NULL;
+    buckets = NULL;
+}
+
+
+static const struct bundle_entry *
+lookup_entry(const char *name, int kind)
+{
+    uint32_t mask, i;
+    int32_t n;
+
+    if (!map)
+        return NULL;
+
+    mask = header->nbuckets - 1;
+    for (i = bundle_hash(name, kind) & mask;
+         (n = buckets[i]) >= 0;
+         i = (i + 1) & mask)
+        if (n < header->nentries
+            && entries[n].kind == kind
+            && strcmp(entries[n].name, name) == 0)
+            return entries + n;
+    return NULL;
+}
+
+
+/*
+ * Return a pointer to 'size' bytes at 'off', or NULL if out of range.
+ */
+static const void *
+data_at(int64_t off, size_t size)
+{
+    return off > 0 && off < mapsize && size <= mapsize - off
+        ? (const char *)map + off : NULL;
+}
+
+
+static char *
+dup_string(int64_t off)
+{
+    const char *s = data_at(off, 1);
+
+    return s && memchr(s, '\0', mapsize - off) ? strdup(s) : NULL;
+}
+
+
+/*
+ * Return a copy of axis 'name' in the bundle (to be freed by
+ * GT3_freeDim()), or NULL if not in the bundle.
+ */
+GT3_Dim *
+bundle_dim(const char *name)
+{
+    const struct bundle_entry *ent;
+    const double *values;
+    GT3_Dim *dim;
+
+    if ((ent = lookup_entry(name, BUNDLE_DIM)) == NULL
+        || ent->len <= 0
+        || (values = data_at(ent->data_off, sizeof(double) * ent->len))
+           == NULL)
+        return NULL;
+
+    if ((dim = calloc(1, sizeof(GT3_Dim))) == NULL
+        || (dim->name = strdup(ent->name)) == NULL
+        || (dim->values = malloc(sizeof(double) * ent->len)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        GT3_freeDim(dim);
+        return NULL;
+    }
+    memcpy(dim->values, values, sizeof(double) * ent->len);
+    dim->len = ent->len;
+    dim->cyclic = ent->aux;
+    dim->title = dup_string(ent->title_off);
+    dim->unit = dup_string(ent->unit_off);
+    dim->range[0] = ent->range[0];
+    dim->range[1] = ent->range[1];
+    return dim;
+}
+
+
+/*
+ * Return a copy of the bounds of axis 'name' in the bundle
+ * (to be freed by GT3_freeDimBound()), or NULL if not in the bundle.
+ */
+GT3_DimBound *
+bundle_dimbound(const char *name)
+{
+    const struct bundle_entry *ent;
+    const double *values;
+    GT3_DimBound *bnd;
+
+    if ((ent = lookup_entry(name, BUNDLE_DIMBOUND)) == NULL
+        || ent->len <= 0
+        || (values = data_at(ent->data_off, sizeof(double) * ent->len))
+           == NULL)
+        return NULL;
+
+    if ((bnd = calloc(1, sizeof(GT3_DimBound))) == NULL
+        || (bnd->name = strdup(ent->name)) == NULL
+        || (bnd->bnd = malloc(sizeof(double) * ent->len)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        GT3_freeDimBound(bnd);
+        return NULL;
+    }
+    memcpy(bnd->bnd, values, sizeof(double) * ent->len);
+    bnd->len = ent->len;
+    bnd->len_orig = ent->aux;
+    return bnd;
+}
+
+
+/*
+ * Open the labels of a character axis (GTAXLOC.*.txt) in the bundle
+ * as a read-only stream, or NULL if not in the bundle.
+ */
+FILE *
+bundle_labels(const char *name)
+{
+    const struct bundle_entry *ent;
+    const void *labels;
+    FILE *fp;
+
+    if ((ent = lookup_entry(name, BUNDLE_LABELS)) == NULL
+        || ent->len <= 0
+        || (labels = data_at(ent->data_off, ent->len)) == NULL)
+        return NULL;
+
+    if ((fp = fmemopen((void *)labels, ent->len, "r")) == NULL)
+        logging(LOG_SYSERR, name);
+    return fp;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+
+/*
+ * Make a bundle of axis "TAXIS" (a dim and its bounds) and labels
+ * "TLABEL" in the layout of mkaxisbundle.
+ */
+static size_t
+make_bundle(char *buf, size_t size,
+            const double *values, const double *bnds, const char *labels)
+{
+    struct bundle_header *head = (struct bundle_header *)buf;
+    struct bundle_entry ents[3];
+    int32_t buckets[16];
+    size_t pos = sizeof(struct bundle_header);
+    uint32_t k;
+    int i;
+
+    memset(buf, 0, size);
+    memset(ents, 0, sizeof ents);
+
+    strcpy(ents[0].name, "TAXIS");
+    ents[0].kind = BUNDLE_DIM;
+    ents[0].len = 3;
+    ents[0].aux = 1;
+    ents[0].range[0] = 0.;
+    ents[0].range[1] = 360.;
+    ents[0].data_off = pos;
+    memcpy(buf + pos, values, sizeof(double) * 3);
+    pos += sizeof(double) * 3;
+
+    strcpy(ents[1].name, "TAXIS");
+    ents[1].kind = BUNDLE_DIMBOUND;
+    ents[1].len = 4;
+    ents[1].aux = 3;
+    ents[1].data_off = pos;
+    memcpy(buf + pos, bnds, sizeof(double) * 4);
+    pos += sizeof(double) * 4;
+
+    ents[0].title_off = pos;
+    strcpy(buf + pos, "test axis");
+    pos += strlen("test axis") + 1;
+    ents[0].unit_off = pos;
+    strcpy(buf + pos, "degrees");
+    pos += strlen("degrees") + 1;
+
+    strcpy(ents[2].name, "TLABEL");
+    ents[2].kind = BUNDLE_LABELS;
+    ents[2].len = strlen(labels);
+    ents[2].data_off = pos;
+    memcpy(buf + pos, labels, strlen(labels));
+    pos += strlen(labels);
+    pos = (pos + 7) / 8 * 8;
+
+    for (i = 0; i < 16; i++)
+        buckets[i] = -1;
+    for (i = 0; i < 3; i++) {
+        for (k = bundle_hash(ents[i].name, ents[i].kind) & 15;
+             buckets[k] >= 0;
+             k = (k + 1) & 15)
+            ;
+        buckets[k] = i;
+    }
+
+    memcpy(head->magic, AXIS_BUNDLE_MAGIC, 8);
+    head->version = AXIS_BUNDLE_VERSION;
+    head->nentries = 3;
+    head->nbuckets = 16;
+    head->entries_off = pos;
+    head->buckets_off = pos + sizeof ents;
+    head->size = head->buckets_off + sizeof buckets;
+    assert(head->size <= size);
+    memcpy(buf + head->entries_off, ents, sizeof ents);
+    memcpy(buf + head->buckets_off, buckets, sizeof buckets);
+    return head->size;
+}
+
+
+static void
+write_file(const char *path, const char *buf, size_t size)
+{
+    FILE *fp;
+
+    assert((fp = fopen(path, "wb")) != NULL);
+    assert(fwrite(buf, 1, size, fp) == size);
+    assert(fclose(fp) == 0);
+}
+
+
+int
+test_axisbundle(void)
+{
+    char path[] = "/tmp/axisbundleXXXXXX";
+    double values[] = { 90., 180., 270. };
+    double bnds[] = { 45., 135., 225., 315. };
+    const char labels[] = "first\nsecond\nthird\n";
+    double space[256];          /* aligned as in a mapped file */
+    char *buf = (char *)space, line[32];
+    GT3_Dim *dim;
+    GT3_DimBound *bnd;
+    FILE *fp;
+    size_t size;
+    int fd;
+
+    size = make_bundle(buf, sizeof space, values, bnds, labels);
+    assert(valid_bundle((struct bundle_header *)buf, size));
+
+    assert((fd = mkstemp(path)) >= 0);
+    close(fd);
+    write_file(path, buf, size);
+    assert(set_axis_bundle(path) == 0);
+
+    assert((dim = bundle_dim("TAXIS")) != NULL);
+    assert(strcmp(dim->name, "TAXIS") == 0 && dim->len == 3);
+    assert(memcmp(dim->values, values, sizeof values) == 0);
+    assert(dim->cyclic == 1 && dim->range[0] == 0. && dim->range[1] == 360.);
+    assert(strcmp(dim->title, "test axis") == 0);
+    assert(strcmp(dim->unit, "degrees") == 0);
+    GT3_freeDim(dim);
+
+    assert((bnd = bundle_dimbound("TAXIS")) != NULL);
+    assert(bnd->len == 4 && bnd->len_orig == 3);
+    assert(memcmp(bnd->bnd, bnds, sizeof bnds) == 0);
+    GT3_freeDimBound(bnd);
+
+    assert((fp = bundle_labels("TLABEL")) != NULL);
+    assert(fgets(line, sizeof line, fp) && strcmp(line, "first\n") == 0);
+    assert(fgets(line, sizeof line, fp) && strcmp(line, "second\n") == 0);
+    assert(fgets(line, sizeof line, fp) && strcmp(line, "third\n") == 0);
+    assert(fgets(line, sizeof line, fp) == NULL);
+    fclose(fp);
+
+    /* looked up by name and kind. */
+    assert(bundle_dim("TLABEL") == NULL);
+    assert(bundle_labels("TAXIS") == NULL);
+    assert(bundle_dim("NOSUCH") == NULL);
+
+    /* a truncated file is rejected (the previous one is kept). */
+    assert(!valid_bundle((struct bundle_header *)buf, size - 4));
+    assert(!valid_bundle((struct bundle_header *)buf,
+                         sizeof(struct bundle_header) - 1));
+    write_file(path, buf, size - 4);
+    assert(set_axis_bundle(path) < 0);
+    assert((dim = bundle_dim("TAXIS")) != NULL);
+    GT3_freeDim(dim);
+
+    unset_axis_bundle();
+    assert(bundle_dim("TAXIS") == NULL);
+    unlink(path);
+    printf("test_axisbundle(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
@@ -0,0 +1,53 @@
+/*
+ * axisbundle.h -- a single file of axes in a GTAXLOC directory.
+ *
+ * File format (native byte order):
+ *   struct bundle_header;
+ *   data (doubles aligned on 8 bytes, NUL-terminated strings),
+ *     padded to 8 bytes;
+ *   struct bundle_entry entries[nentries];   (at entries_off)
+ *   int32_t buckets[nbuckets];       (at buckets_off; index of entries,
+ *                                     -1 if empty)
+ *
+ * An offset of 0 means no data (the header lives at 0).
+ */
+#ifndef AXISBUNDLE_H
+#define AXISBUNDLE_H
+
+#include <stdint.h>
+
+#define AXIS_BUNDLE_MAGIC "MIPCAXBN"
+#define AXIS_BUNDLE_VERSION 1
+
+enum {
+    BUNDLE_DIM,                 /* GT3_getDim() */
+    BUNDLE_DIMBOUND,            /* GT3_getDimBound() */
+    BUNDLE_LABELS               /* contents of GTAXLOC.*.txt */
+};
+
+struct bundle_header {
+    char magic[8];
+    int32_t version;
+    int32_t nentries;
+    int32_t nbuckets;           /* power of 2 */
+    int32_t reserved;
+    int64_t entries_off;
+    int64_t buckets_off;
+    int64_t size;               /* file size */
+};
+
+struct bundle_entry {
+    char name[24];
+    int32_t kind;
+    int32_t len;                /* # of values, or # of bytes of labels */
+    int32_t aux;                /* cyclic (dim) or len_orig (bound) */
+    int32_t reserved;
+    int64_t data_off;
+    int64_t title_off;
+    int64_t unit_off;
+    double range[2];
+};
+
+uint32_t bundle_hash(const char *name, int kind);
+
+#endif /* !AXISBUNDLE_H */
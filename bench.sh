@@ -0,0 +1,132 @@
+#!/bin/sh
+#
+# bench.sh -- end-to-end benchmarks of mipconv on synthetic data.
+#
+# Usage: ./bench.sh [-o baseline.json] [-r repeat] [-w workdir]
+#
+# The dataset is made by gt3gen (the same on every run), and each
+# scenario is run 'repeat' times. The best wall time, the throughput
+# of input data, and the peak RSS (by "mipconv --report") are written
+# into a JSON file, a scenario per line, to be diffed between builds.
+# The exit status is non-zero if any scenario fails.
+#
+# Environment:
+#   MIPCONV_TABLES  directory of CMIP6_*.json (default: ../Tables)
+#   MIPCONV_INPUT   user input file of CMOR (default: user_input.json)
+#
+set -e
+
+output=bench.json
+repeat=3
+work=bench.d
+
+while getopts "o:r:w:h" opt; do
+    case $opt in
+        o) output=$OPTARG ;;
+        r) repeat=$OPTARG ;;
+        w) work=$OPTARG ;;
+        *) sed -n '4p' "$0" >&2; exit 1 ;;
+    esac
+done
+
+tables=${MIPCONV_TABLES:-../Tables}
+input=${MIPCONV_INPUT:-user_input.json}
+top=$(pwd)
+
+for f in "$input" "$tables/CMIP6_Amon.json" "$tables/CMIP6_grids.json"; do
+    if [ ! -f "$f" ]; then
+        echo "bench.sh: $f: not found (set MIPCONV_INPUT/MIPCONV_TABLES)." >&2
+        exit 1
+    fi
+done
+
+mkdir -p "$work/data" "$work/axes" "$work/out"
+export GTAXDIR=$top/$work/axes
+
+gen() {
+    "$top/gt3gen" -A "$work/axes" "$@"
+}
+
+#
+# dataset
+#
+data=$work/data
+[ -f "$data/ps" ] || gen -i PS -u Pa -v 1e5,1000 -x 256 -y 128 -n 120 \
+    "$data/ps"
+[ -f "$data/cl" ] || gen -i CLDFRC -u % -v 50,40 -x 256 -y 128 -z 40 -n 24 \
+    "$data/cl"
+[ -f "$data/ps24" ] || gen -i PS -u Pa -v 1e5,1000 -x 256 -y 128 -n 24 \
+    "$data/ps24"
+[ -f "$data/pr" ] || gen -i PRCP -u mm/day -v 3,3 -f URY16 -c noleap \
+    -x 256 -y 128 -n 120 "$data/pr"
+[ -f "$data/tos" ] || gen -i SST -u degC -v 15,12 -f MR4 -m .3 -g tripolar \
+    -x 360 -y 256 -n 120 "$data/tos"
+[ -f "$data/ps_site" ] || gen -i PS -u Pa -v 1e5,1000 -x 256 -y 128 \
+    -s 30min -p -n 480 "$data/ps_site"
+if [ ! -f "$data/sites.txt" ]; then
+    awk 'BEGIN { for (i = 1; i <= 120; i++)
+                     printf "%d, %.2f, %.2f\n", i, (i * 37) % 360,
+                            ((i * 53) % 170) - 85 }' > "$data/sites.txt"
+fi
+
+#
+# run a scenario: name, input files (for the throughput), mipconv args.
+#
+runs=$work/runs.txt
+: > "$runs"
+nfailed=0
+
+run() {
+    name=$1; inputs=$2; shift 2
+    bytes=$(cat $inputs | wc -c)
+    best=
+    status=ok
+    i=0
+    while [ $i -lt "$repeat" ]; do
+        rm -f "$work/out/"*
+        t0=$(date +%s.%N)
+        if ! "$top/mipconv" -d "$work/out" --report "$work/$name.json" \
+             -M "$tables" "$input" "$@" 2> "$work/$name.log"; then
+            status=failed
+            nfailed=$((nfailed + 1))
+            break
+        fi
+        t1=$(date +%s.%N)
+        best=$(awk -v a="$t0" -v b="$t1" -v best="$best" \
+                   'BEGIN { t = b - a; print (best == "" || t < best) ? t : best }')
+        i=$((i + 1))
+    done
+    rss=$(grep -o '"peak_rss": [0-9]*' "$work/$name.json" 2>/dev/null \
+          | awk '$2 > max { max = $2 } END { print max + 0 }')
+    awk -v name="$name" -v status="$status" -v t="${best:-0}" \
+        -v bytes="$bytes" -v rss="$rss" \
+        'BEGIN { printf("    {\"name\": \"%s\", \"status\": \"%s\", " \
+                        "\"wall_seconds\": %.3f, \"input_bytes\": %d, " \
+                        "\"mb_per_second\": %.1f, \"peak_rss\": %d}\n", \
+                        name, status, t, bytes, \
+                        t > 0 ? bytes / 1048576 / t : 0, rss) }' >> "$runs"
+    echo "bench.sh: $name: $status, ${best:-0} s" >&2
+}
+
+run amon_2d "$data/ps" \
+    CMIP6_Amon.json :ps "$data/ps"
+run amon_3d_ps "$data/cl $data/ps24" \
+    CMIP6_Amon.json :cl "$data/cl" :ps "$data/ps24"
+run omon_tripolar "$data/tos" \
+    -g tripolar CMIP6_Omon.json CMIP6_grids.json :tos "$data/tos"
+run site "$data/ps_site" \
+    -l "$data/sites.txt" CMIP6_CFsubhr.json :ps "$data/ps_site"
+run expr "$data/pr" \
+    CMIP6_Amon.json :pr "=e86400 /" "$data/pr"
+
+{
+    printf '{\n  "repeat": %d,\n  "scenarios": [\n' "$repeat"
+    sed '$!s/$/,/' "$runs"
+    printf '  ]\n}\n'
+} > "$output"
+echo "bench.sh: $output" >&2
+
+if [ "$nfailed" -gt 0 ]; then
+    echo "bench.sh: $nfailed scenario(s) failed (see $work/*.log)." >&2
+    exit 1
+fi
@@ -0,0 +1,766 @@
+/*
+ * bench_kernels.c -- microbenchmarks of hot kernels of mipconv.
+ *
+ * Each kernel is called repeatedly until a call loop takes at least
+ * the minimum trial time (which also warms up caches and buffer
+ * pools), and then timed over a number of such trials. The time per
+ * call is reported by the median and the 10th/90th percentiles, and
+ * per element of the kernel (grid point, site, date, ...).
+ *
+ * Grid transforms run with OpenMP threads (see OMP_NUM_THREADS).
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gtool3.h"
+#include "logging.h"
+
+#include "internal.h"
+#include "var.h"
+#include "seq.h"
+#include "site.h"
+
+#define PROGNAME "bench_kernels"
+
+#define MAX_TRIALS 1001
+#define MISS -999.
+#define NSITES 1000
+
+static int ntrials = 21;
+static double min_trial = 0.01; /* in seconds */
+static const char *filter = NULL;
+
+static volatile double sink;    /* not to be optimized out */
+
+typedef int (*kernel_func)(void *arg);
+
+static const struct {
+    const char *label;
+    int nx, ny, nz;
+} sizes[] = {
+    { "128x64",      128,  64,  1 },
+    { "256x128",     256, 128,  1 },
+    { "256x128x40",  256, 128, 40 }
+};
+#define NSIZES (sizeof sizes / sizeof sizes[0])
+
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*
+ * 'p'-th percentile (nearest rank) of sorted values.
+ */
+static double
+percentile(const double *sorted, int num, double p)
+{
+    return sorted[(int)(p / 100. * (num - 1) + .5)];
+}
+
+
+/*
+ * Run a kernel and report the time per call and per element.
+ */
+static int
+run_kernel(const char *name, kernel_func func, void *arg, size_t nelems)
+{
+    double times[MAX_TRIALS], t0, t, median;
+    long calls, i;
+    int n;
+
+    if (filter && !strstr(name, filter))
+        return 0;
+
+    /* warm-up, and the number of calls in a trial */
+    for (calls = 1; ; calls *= 2) {
+        t0 = stats_clock();
+        for (i = 0; i < calls; i++)
+            if (func(arg) < 0)
+                goto error;
+        t = stats_clock() - t0;
+        if (t >= min_trial || calls >= (1L << 30))
+            break;
+    }
+
+    for (n = 0; n < ntrials; n++) {
+        t0 = stats_clock();
+        for (i = 0; i < calls; i++)
+            if (func(arg) < 0)
+                goto error;
+        times[n] = (stats_clock() - t0) / calls;
+    }
+    qsort(times, ntrials, sizeof(double), cmp_double);
+    median = percentile(times, ntrials, 50.);
+
+    printf("%-40s %10lu %8ld %12.0f %12.0f %12.0f %10.3f\n",
+           name, (unsigned long)nelems, calls,
+           1e9 * median,
+           1e9 * percentile(times, ntrials, 10.),
+           1e9 * percentile(times, ntrials, 90.),
+           nelems > 0 ? 1e9 * median / nelems : 0.);
+    fflush(stdout);
+    return 0;
+
+error:
+    logging(LOG_ERR, "%s: failed.", name);
+    return -1;
+}
+
+
+static void
+fill_values(float *data, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        data[i] = (i % 97 == 0)
+            ? (float)MISS
+            : (float)(250. + 50. * sin(1e-3 * i));
+}
+
+
+static void
+even_values(double *values, int len, double v0, double v1)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        values[i] = v0 + (v1 - v0) * (i + .5) / len;
+}
+
+
+/*
+ * calculator
+ */
+struct calc_arg {
+    const char *expr;
+    const float *src;
+    float *work;
+    size_t size;
+};
+
+
+/* eval_calc() works in place, so a call includes a copy of the input. */
+static int
+calc_kernel(void *arg)
+{
+    struct calc_arg *p = arg;
+
+    memcpy(p->work, p->src, sizeof(float) * p->size);
+    return p->expr ? eval_calc(p->expr, p->work, MISS, p->size) : 0;
+}
+
+
+static int
+bench_calc(void)
+{
+    const char *exprs[] = {
+        NULL,                   /* the copy only */
+        "86400 /",
+        "273.15 - 0 max",
+        "dup * 1 + sqrt"
+    };
+    struct calc_arg arg;
+    size_t size = (size_t)sizes[NSIZES - 1].nx * sizes[NSIZES - 1].ny
+        * sizes[NSIZES - 1].nz;
+    float *src, *work;
+    char name[64];
+    int i, n, rval = -1;
+
+    src = malloc(sizeof(float) * size);
+    work = malloc(sizeof(float) * size);
+    if (src == NULL || work == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+    fill_values(src, size);
+
+    for (i = 0; i < sizeof exprs / sizeof exprs[0]; i++)
+        for (n = 0; n < NSIZES; n++) {
+            arg.expr = exprs[i];
+            arg.src = src;
+            arg.work = work;
+            arg.size = (size_t)sizes[n].nx * sizes[n].ny * sizes[n].nz;
+            snprintf(name, sizeof name, "calc[%s] %s",
+                     exprs[i] ? exprs[i] : "copy", sizes[n].label);
+            if (run_kernel(name, calc_kernel, &arg, arg.size) < 0)
+                goto finish;
+        }
+    rval = 0;
+
+finish:
+    free(work);
+    free(src);
+    return rval;
+}
+
+
+/*
+ * decode of a record (from the page cache)
+ */
+struct read_arg {
+    myvar_t *var;
+    GT3_Varbuf *vbuf;
+};
+
+
+static int
+read_kernel(void *arg)
+{
+    struct read_arg *p = arg;
+
+    return read_var(p->var, p->vbuf, NULL);
+}
+
+
+static int
+write_gt3_file(char *path, const char *fmt, int nx, int ny, int nz)
+{
+    GT3_HEADER head;
+    float *data;
+    FILE *fp;
+    int fd, rval = -1;
+
+    if ((data = malloc(sizeof(float) * nx * ny * nz)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    fill_values(data, (size_t)nx * ny * nz);
+
+    if ((fd = mkstemp(path)) < 0 || (fp = fdopen(fd, "wb")) == NULL) {
+        logging(LOG_SYSERR, path);
+        free(data);
+        return -1;
+    }
+    GT3_initHeader(&head);
+    GT3_setHeaderString(&head, "ITEM", "BENCH");
+    GT3_setHeaderDouble(&head, "MISS", MISS);
+    if (GT3_write(data, GT3_TFLOAT, nx, ny, nz, &head, fmt, fp) < 0)
+        GT3_printErrorMessages(stderr);
+    else
+        rval = 0;
+    if (fclose(fp) != 0) {
+        logging(LOG_SYSERR, path);
+        rval = -1;
+    }
+    if (rval < 0)
+        unlink(path);
+    free(data);
+    return rval;
+}
+
+
+static int
+bench_read(void)
+{
+    const char *formats[] = { "UR4", "UR8", "URY16", "MR4" };
+    char path[] = "/tmp/bench_kernelsXXXXXX";
+    char name[64];
+    struct read_arg arg;
+    GT3_File *fp = NULL;
+    myvar_t *var = NULL;
+    int shape[3];
+    int i, rval = -1;
+
+    shape[0] = sizes[NSIZES - 1].nx;
+    shape[1] = sizes[NSIZES - 1].ny;
+    shape[2] = sizes[NSIZES - 1].nz;
+    if ((var = new_var()) == NULL || resize_var(var, shape, 3) < 0)
+        goto finish;
+
+    for (i = 0; i < sizeof formats / sizeof formats[0]; i++) {
+        strcpy(path, "/tmp/bench_kernelsXXXXXX");
+        if (write_gt3_file(path, formats[i],
+                           shape[0], shape[1], shape[2]) < 0)
+            goto finish;
+
+        if ((fp = GT3_open(path)) == NULL
+            || (arg.vbuf = GT3_getVarbuf(fp)) == NULL) {
+            GT3_printErrorMessages(stderr);
+            if (!fp)
+                unlink(path);
+            goto finish;
+        }
+        arg.var = var;
+        snprintf(name, sizeof name, "read_var[%s] %s",
+                 formats[i], sizes[NSIZES - 1].label);
+        rval = run_kernel(name, read_kernel, &arg, var->nelems);
+
+        GT3_freeVarbuf(arg.vbuf);
+        GT3_close(fp);
+        fp = NULL;
+        unlink(path);
+        if (rval < 0)
+            goto finish;
+    }
+    rval = 0;
+
+finish:
+    if (fp) {
+        GT3_close(fp);
+        unlink(path);
+    }
+    if (var) {
+        free_var(var);
+        free(var);
+    }
+    return rval;
+}
+
+
+/*
+ * sites: gather and nearest grid points
+ */
+static site_locations *
+new_sites(int num)
+{
+    site_locations *p;
+    int i;
+
+    if ((p = calloc(1, sizeof(site_locations))) == NULL
+        || (p->ids = malloc(sizeof(int) * num)) == NULL
+        || (p->lons = malloc(sizeof(double) * num)) == NULL
+        || (p->lats = malloc(sizeof(double) * num)) == NULL
+        || (p->grid_lons = malloc(sizeof(double) * num)) == NULL
+        || (p->grid_lats = malloc(sizeof(double) * num)) == NULL
+        || (p->indexes = malloc(sizeof(int) * num)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        free_site_locations(p);
+        return NULL;
+    }
+    p->nlocs = num;
+    for (i = 0; i < num; i++) {
+        p->ids[i] = i + 1;
+        p->lons[i] = fmod(37.3 * i, 360.);
+        p->lats[i] = fmod(53.7 * i, 170.) - 85.;
+    }
+    return p;
+}
+
+
+struct gather_arg {
+    float *dest;
+    const float *src;
+    const site_locations *sites;
+    int nxy, nz;
+};
+
+
+static int
+gather_kernel(void *arg)
+{
+    struct gather_arg *p = arg;
+
+    gather_sites(p->dest, p->src, p->sites, p->nxy, p->nz);
+    return 0;
+}
+
+
+struct site_arg {
+    site_locations *sites;
+    const GT3_HEADER *head;
+    const double *lon, *lat;
+    int nx, ny;
+};
+
+
+static int
+site_index_kernel(void *arg)
+{
+    struct site_arg *p = arg;
+
+    return update_site_indexes(p->sites, p->head);
+}
+
+
+static int
+site_index_2d_kernel(void *arg)
+{
+    struct site_arg *p = arg;
+
+    return update_site_indexes_2d(p->sites, p->lon, p->lat, p->nx, p->ny);
+}
+
+
+/*
+ * Write GTAXLOC.<name> (for get_dim()).
+ */
+static int
+write_axis_file(const char *dir, const char *name,
+                const double *values, int len)
+{
+    GT3_HEADER head;
+    char path[1024];
+    FILE *fp;
+    int rval = 0;
+
+    snprintf(path, sizeof path, "%s/GTAXLOC.%s", dir, name);
+    if ((fp = fopen(path, "wb")) == NULL) {
+        logging(LOG_SYSERR, path);
+        return -1;
+    }
+    GT3_initHeader(&head);
+    GT3_setHeaderString(&head, "DSET", "AXLOC");
+    GT3_setHeaderString(&head, "ITEM", name);
+    if (GT3_write(values, GT3_TDOUBLE, len, 1, 1, &head, "UR8", fp) < 0) {
+        GT3_printErrorMessages(stderr);
+        rval = -1;
+    }
+    if (fclose(fp) != 0) {
+        logging(LOG_SYSERR, path);
+        rval = -1;
+    }
+    return rval;
+}
+
+
+static int
+bench_sites(void)
+{
+    char dir[] = "/tmp/bench_kernelsXXXXXX";
+    char path[1024], name[64];
+    int nx = sizes[NSIZES - 1].nx, ny = sizes[NSIZES - 1].ny;
+    int nz = sizes[NSIZES - 1].nz;
+    site_locations *sites = NULL;
+    struct gather_arg garg;
+    struct site_arg sarg;
+    GT3_HEADER head;
+    float *src = NULL, *dest = NULL;
+    double *x = NULL, *y = NULL, *lon = NULL, *lat = NULL;
+    int i, rval = -1;
+
+    if ((sites = new_sites(NSITES)) == NULL)
+        return -1;
+
+    src = malloc(sizeof(float) * nx * ny * nz);
+    dest = malloc(sizeof(float) * NSITES * nz);
+    x = malloc(sizeof(double) * nx);
+    y = malloc(sizeof(double) * ny);
+    lon = malloc(sizeof(double) * nx * ny);
+    lat = malloc(sizeof(double) * nx * ny);
+    if (!src || !dest || !x || !y || !lon || !lat) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+    fill_values(src, (size_t)nx * ny * nz);
+    for (i = 0; i < NSITES; i++)
+        sites->indexes[i] = (int)((7919L * i) % (nx * ny));
+
+    garg.dest = dest;
+    garg.src = src;
+    garg.sites = sites;
+    garg.nxy = nx * ny;
+    garg.nz = nz;
+    snprintf(name, sizeof name, "gather_sites %s", sizes[NSIZES - 1].label);
+    if (run_kernel(name, gather_kernel, &garg, (size_t)NSITES * nz) < 0)
+        goto finish;
+
+    /* 1-D axes in GTAXLOC files */
+    if (mkdtemp(dir) == NULL) {
+        logging(LOG_SYSERR, dir);
+        goto finish;
+    }
+    for (i = 0; i < nx; i++)
+        x[i] = 360. * i / nx;
+    even_values(y, ny, -90., 90.);
+    if (write_axis_file(dir, "BENCHLON", x, nx) < 0
+        || write_axis_file(dir, "BENCHLAT", y, ny) < 0
+        || setenv("GTAXDIR", dir, 1) < 0)
+        goto cleanup;
+
+    GT3_initHeader(&head);
+    GT3_setHeaderString(&head, "AITM1", "BENCHLON");
+    GT3_setHeaderInt(&head, "ASTR1", 1);
+    GT3_setHeaderInt(&head, "AEND1", nx);
+    GT3_setHeaderString(&head, "AITM2", "BENCHLAT");
+    GT3_setHeaderInt(&head, "ASTR2", 1);
+    GT3_setHeaderInt(&head, "AEND2", ny);
+
+    sarg.sites = sites;
+    sarg.head = &head;
+    snprintf(name, sizeof name, "update_site_indexes %dx%d", nx, ny);
+    if (run_kernel(name, site_index_kernel, &sarg, NSITES) < 0)
+        goto cleanup;
+
+    /* 2-D lat/lon of a tripolar grid */
+    even_values(y, ny, -78., 153.);
+    if (get_tripolar_lonlat(lon, lat, x, nx, y, ny, 63.) < 0)
+        goto cleanup;
+    sarg.lon = lon;
+    sarg.lat = lat;
+    sarg.nx = nx;
+    sarg.ny = ny;
+    snprintf(name, sizeof name, "update_site_indexes_2d %dx%d", nx, ny);
+    if (run_kernel(name, site_index_2d_kernel, &sarg, NSITES) < 0)
+        goto cleanup;
+    rval = 0;
+
+cleanup:
+    snprintf(path, sizeof path, "%s/GTAXLOC.BENCHLON", dir);
+    unlink(path);
+    snprintf(path, sizeof path, "%s/GTAXLOC.BENCHLAT", dir);
+    unlink(path);
+    rmdir(dir);
+
+finish:
+    free(lat);
+    free(lon);
+    free(y);
+    free(x);
+    free(dest);
+    free(src);
+    free_site_locations(sites);
+    return rval;
+}
+
+
+/*
+ * grid transforms
+ */
+enum {
+    MAP_ROTATED,
+    MAP_BIPOLAR,
+    MAP_TRIPOLAR
+};
+
+struct grid_arg {
+    int mapping;
+    double *lon, *lat;
+    const double *x, *y;
+    int nx, ny;
+};
+
+
+static int
+grid_kernel(void *arg)
+{
+    struct grid_arg *p = arg;
+
+    switch (p->mapping) {
+    case MAP_ROTATED:
+        return rotate_lonlat(p->lon, p->lat, p->x, p->y, p->nx, p->ny,
+                             10., 40., -20.);
+    case MAP_BIPOLAR:
+        return get_bipolar_lonlat(p->lon, p->lat, p->x, p->nx, p->y, p->ny);
+    default:
+        return get_tripolar_lonlat(p->lon, p->lat,
+                                   p->x, p->nx, p->y, p->ny, 63.);
+    }
+}
+
+
+static int
+bench_grid(void)
+{
+    const struct {
+        const char *name;
+        int mapping;
+        double y0, y1;
+    } tab[] = {
+        { "rotate_lonlat", MAP_ROTATED, -90., 90. },
+        { "bipolar", MAP_BIPOLAR, -90., 90. },
+        { "tripolar", MAP_TRIPOLAR, -78., 153. }
+    };
+    struct grid_arg arg;
+    char name[64];
+    int nx = 360, ny = 256;
+    double *x, *y, *lon, *lat;
+    int i, rval = -1;
+
+    x = malloc(sizeof(double) * nx);
+    y = malloc(sizeof(double) * ny);
+    lon = malloc(sizeof(double) * nx * ny);
+    lat = malloc(sizeof(double) * nx * ny);
+    if (!x || !y || !lon || !lat) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+    even_values(x, nx, 0., 360.);
+
+    for (i = 0; i < sizeof tab / sizeof tab[0]; i++) {
+        even_values(y, ny, tab[i].y0, tab[i].y1);
+        arg.mapping = tab[i].mapping;
+        arg.lon = lon;
+        arg.lat = lat;
+        arg.x = x;
+        arg.y = y;
+        arg.nx = nx;
+        arg.ny = ny;
+        snprintf(name, sizeof name, "%s %dx%d", tab[i].name, nx, ny);
+        if (run_kernel(name, grid_kernel, &arg, (size_t)nx * ny) < 0)
+            goto finish;
+    }
+    rval = 0;
+
+finish:
+    free(lat);
+    free(lon);
+    free(y);
+    free(x);
+    return rval;
+}
+
+
+/*
+ * sequences (=t, =z)
+ */
+static int
+seq_kernel(void *arg)
+{
+    struct sequence *seq = arg;
+    long sum = 0;
+
+    rewindSeq(seq);
+    sum = countSeq(seq);
+    while (nextSeq(seq) == 1)
+        sum += seq->curr;
+    sink = sum;
+    return 0;
+}
+
+
+static int
+bench_seq(void)
+{
+    const char *specs[] = { "1:40", "1:1000:3,2000:3000,3500" };
+    struct sequence *seq;
+    char name[64];
+    int i, n, rval = 0;
+
+    for (i = 0; i < sizeof specs / sizeof specs[0]; i++) {
+        if ((seq = initSeq(specs[i], 1, 4000)) == NULL) {
+            logging(LOG_ERR, "%s: invalid sequence.", specs[i]);
+            return -1;
+        }
+        n = countSeq(seq);
+        snprintf(name, sizeof name, "nextSeq[%s]", specs[i]);
+        rval = run_kernel(name, seq_kernel, seq, n);
+        freeSeq(seq);
+        free(seq);
+        if (rval < 0)
+            break;
+    }
+    return rval;
+}
+
+
+/*
+ * time axis
+ */
+#define NDATES 1000
+
+static int
+time_kernel(void *arg)
+{
+    const GT3_Date *dates = arg;
+    double sum = 0.;
+    int i;
+
+    for (i = 0; i < NDATES; i++)
+        sum += get_time(dates + i);
+    sink = sum;
+    return 0;
+}
+
+
+static int
+bench_time(void)
+{
+    const char *calendars[] = { "gregorian", "noleap", "360_day" };
+    GT3_Date dates[NDATES];
+    GT3_Duration hour = { 1, GT3_UNIT_HOUR };
+    char name[64];
+    int i;
+
+    GT3_setDate(dates, 2000, 1, 1, 0, 0, 0);
+    for (i = 1; i < NDATES; i++) {
+        dates[i] = dates[i - 1];
+        GT3_addDuration(dates + i, &hour, GT3_CAL_GREGORIAN);
+    }
+
+    set_origin_year(1850);
+    for (i = 0; i < sizeof calendars / sizeof calendars[0]; i++) {
+        set_calendar_by_name(calendars[i]);
+        snprintf(name, sizeof name, "get_time[%s]", calendars[i]);
+        if (run_kernel(name, time_kernel, dates, NDATES) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: " PROGNAME " [options]\n"
+            "\n"
+            "Run microbenchmarks of kernels.\n"
+            "\n"
+            "Options:\n"
+            "    -k pattern   run kernels whose name contains pattern.\n"
+            "    -n trials    number of trials (default: 21).\n"
+            "    -t msec      minimum time of a trial (default: 10).\n"
+            "    -h           print this message.\n");
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int ch, nerr = 0;
+
+    open_logging(stderr, PROGNAME);
+    GT3_setProgname(PROGNAME);
+
+    while ((ch = getopt(argc, argv, "k:n:t:h")) != -1)
+        switch (ch) {
+        case 'k':
+            filter = optarg;
+            break;
+        case 'n':
+            ntrials = atoi(optarg);
+            if (ntrials < 1 || ntrials > MAX_TRIALS) {
+                logging(LOG_ERR, "%s: invalid number of trials.", optarg);
+                exit(1);
+            }
+            break;
+        case 't':
+            min_trial = 1e-3 * atof(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+
+    printf("%-40s %10s %8s %12s %12s %12s %10s\n",
+           "kernel", "elements", "calls",
+           "median(ns)", "p10(ns)", "p90(ns)", "ns/elem");
+
+    if (bench_calc() < 0)
+        nerr++;
+    if (bench_read() < 0)
+        nerr++;
+    if (bench_sites() < 0)
+        nerr++;
+    if (bench_grid() < 0)
+        nerr++;
+    if (bench_seq() < 0)
+        nerr++;
+    if (bench_time() < 0)
+        nerr++;
+
+    return nerr > 0 ? 1 : 0;
+}
@@ -0,0 +1,327 @@
+/*
+ * bufpool.c -- a pool of work buffers reused through a run.
+ *
+ * Large work buffers (variable data, site data, operands of the
+ * calculator) are allocated for every variable or every time step.
+ * The pool keeps released buffers, and hands out the smallest one
+ * which is large enough.
+ *
+ * With --mem-limit, a new buffer is refused if the resident set size
+ * of the process would exceed the limit (after freeing idle buffers).
+ */
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "internal.h"
+
+#define MAX_BUFFERS 64
+
+struct buffer {
+    void *ptr;
+    size_t capacity;
+    int in_use;
+};
+
+static struct buffer pool[MAX_BUFFERS];
+static int nbuffers = 0;
+
+/*
+ * statistics.
+ */
+static size_t total_bytes = 0;          /* bytes held by the pool */
+static size_t highwater = 0;
+static unsigned num_alloc = 0;
+static unsigned num_reuse = 0;
+
+static size_t mem_limit = 0;            /* 0: unlimited */
+static int statm_fd = -2;               /* /proc/self/statm */
+
+
+int
+set_mem_limit(int mbytes)
+{
+    if (mbytes < 0)
+        return -1;
+
+    mem_limit = (size_t)mbytes << 20;
+    return 0;
+}
+
+
+size_t
+get_mem_limit(void)
+{
+    return mem_limit;
+}
+
+
+/*
+ * Bytes held by the pool (in use or idle).
+ */
+size_t
+bufpool_bytes(void)
+{
+    return total_bytes;
+}
+
+
+/*
+ * Resident set size of the process in bytes (0 if unknown).
+ */
+size_t
+mem_rss(void)
+{
+    char buf[64];
+    unsigned long size, resident;
+    ssize_t n;
+
+    if (statm_fd == -2)
+        statm_fd = open("/proc/self/statm", O_RDONLY);
+    if (statm_fd < 0 || (n = pread(statm_fd, buf, sizeof buf - 1, 0)) <= 0)
+        return 0;
+
+    buf[n] = '\0';
+    if (sscanf(buf, "%lu %lu", &size, &resident) != 2)
+        return 0;
+    return (size_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+
+/*
+ * Free idle buffers to make room under the limit.
+ */
+static void
+release_idle(void)
+{
+    int i;
+
+    for (i = 0; i < nbuffers; i++)
+        if (!pool[i].in_use && pool[i].ptr) {
+            free(pool[i].ptr);
+            total_bytes -= pool[i].capacity;
+            pool[i].ptr = NULL;
+            pool[i].capacity = 0;
+        }
+}
+
+
+/*
+ * Return -1 if 'size' bytes more would exceed the memory limit.
+ */
+static int
+check_mem_limit(size_t size)
+{
+    size_t rss;
+
+    if (mem_limit == 0 || (rss = mem_rss()) + size <= mem_limit)
+        return 0;
+
+    release_idle();
+    if ((rss = mem_rss()) + size <= mem_limit)
+        return 0;
+
+    logging(LOG_ERR, "memory limit exceeded: %.1f MB requested, "
+            "RSS %.1f MB, limit %.1f MB.",
+            size / 1048576., rss / 1048576., mem_limit / 1048576.);
+    return -1;
+}
+
+
+static struct buffer *
+find_buffer(const void *ptr)
+{
+    int i;
+
+    for (i = 0; i < nbuffers; i++)
+        if (pool[i].ptr == ptr)
+            return pool + i;
+    return NULL;
+}
+
+
+/*
+ * Return a buffer of at least 'size' bytes, or NULL on error.
+ */
+void *
+bufpool_get(size_t size)
+{
+    struct buffer *fit = NULL, *spare = NULL;
+    void *ptr;
+    int i;
+
+    if (size == 0)
+        size = 1;
+
+    for (i = 0; i < nbuffers; i++) {
+        if (pool[i].in_use)
+            continue;
+
+        if (pool[i].capacity >= size) {
+            if (fit == NULL || pool[i].capacity < fit->capacity)
+                fit = pool + i;
+        } else {
+            if (spare == NULL || pool[i].capacity > spare->capacity)
+                spare = pool + i;
+        }
+    }
+
+    if (fit) {
+        fit->in_use = 1;
+        num_reuse++;
+        return fit->ptr;
+    }
+
+    /*
+     * No buffer is large enough. Replace a smaller one
+     * (or add a new one) instead of growing the pool.
+     */
+    if (spare) {
+        free(spare->ptr);
+        total_bytes -= spare->capacity;
+        spare->ptr = NULL;
+        spare->capacity = 0;
+    } else if (nbuffers < MAX_BUFFERS)
+        spare = pool + nbuffers++;
+
+    if (check_mem_limit(size) < 0) {
+        /* an empty slot, which is reused later. */
+        if (spare) {
+            spare->ptr = NULL;
+            spare->capacity = 0;
+            spare->in_use = 0;
+        }
+        return NULL;
+    }
+    if ((ptr = malloc(size)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return NULL;
+    }
+    num_alloc++;
+
+    /* pool is full: not managed. */
+    if (spare == NULL)
+        return ptr;
+
+    spare->ptr = ptr;
+    spare->capacity = size;
+    spare->in_use = 1;
+    total_bytes += size;
+    if (total_bytes > highwater)
+        highwater = total_bytes;
+    return ptr;
+}
+
+
+/*
+ * Return a buffer to the pool.
+ */
+void
+bufpool_put(void *ptr)
+{
+    struct buffer *buf;
+
+    if (ptr == NULL)
+        return;
+
+    if ((buf = find_buffer(ptr)) == NULL) {
+        free(ptr);
+        return;
+    }
+    buf->in_use = 0;
+}
+
+
+/*
+ * Free a buffer and drop it from the pool (not kept as an idle one),
+ * e.g., the whole array of a variable which is no longer needed.
+ */
+void
+bufpool_release(void *ptr)
+{
+    struct buffer *buf;
+
+    if (ptr == NULL)
+        return;
+
+    if ((buf = find_buffer(ptr))) {
+        total_bytes -= buf->capacity;
+        buf->ptr = NULL;
+        buf->capacity = 0;
+        buf->in_use = 0;
+    }
+    free(ptr);
+}
+
+
+void
+bufpool_report(void)
+{
+    logging(LOG_INFO,
+            "buffer pool: high-water %.1f MB, %u allocation(s), %u reuse(s)",
+            highwater / 1048576., num_alloc, num_reuse);
+    if (mem_limit > 0)
+        logging(LOG_INFO, "memory limit: %.1f MB", mem_limit / 1048576.);
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+
+int
+test_bufpool(void)
+{
+    void *p1, *p2, *p3;
+
+    p1 = bufpool_get(1000);
+    p2 = bufpool_get(2000);
+    assert(p1 && p2 && p1 != p2);
+
+    /* reuse the smallest one which is large enough. */
+    bufpool_put(p1);
+    bufpool_put(p2);
+    p3 = bufpool_get(500);
+    assert(p3 == p1);
+    p3 = bufpool_get(1500);
+    assert(p3 == p2);
+
+    /* replace a smaller one. */
+    bufpool_put(p1);
+    p3 = bufpool_get(4000);
+    assert(find_buffer(p1) == NULL || p3 == p1);
+    assert(find_buffer(p3)->capacity == 4000);
+
+    bufpool_put(p2);
+    bufpool_put(p3);
+
+    /* release: not kept as an idle buffer. */
+    {
+        size_t held;
+
+        p1 = bufpool_get(1 << 20);
+        held = bufpool_bytes();
+        bufpool_release(p1);
+        assert(bufpool_bytes() == held - (1 << 20));
+        assert(find_buffer(p1) == NULL);
+        p2 = bufpool_get(1 << 10);
+        assert(find_buffer(p2)->capacity < 1 << 20);
+        bufpool_put(p2);
+    }
+
+    /* memory limit */
+    assert(mem_rss() > 0);
+    assert(set_mem_limit(-1) < 0);
+    assert(set_mem_limit(1) == 0 && get_mem_limit() == 1048576);
+    assert(bufpool_get(4096) == NULL);
+    assert(set_mem_limit(0) == 0);
+    p1 = bufpool_get(4096);
+    assert(p1);
+    bufpool_put(p1);
+    printf("test_bufpool(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
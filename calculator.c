@@ -46,10 +46,8 @@ set_operand(operand_t *x, size_t size, const float *values, double miss)
     int i;
 
     if (size > 0) {
-        if ((p = malloc(sizeof(double) * size)) == NULL) {
-            logging(LOG_SYSERR, NULL);
+        if ((p = bufpool_get(sizeof(double) * size)) == NULL)
             return -1;
-        }
         for (i = 0; i < size; i++)
             p[i] = values[i];
 
@@ -72,10 +70,8 @@ set_operandd(operand_t *x, size_t size, const double *values, double miss)
     int i;
 
     if (size > 0) {
-        if ((p = malloc(sizeof(double) * size)) == NULL) {
-            logging(LOG_SYSERR, NULL);
+        if ((p = bufpool_get(sizeof(double) * size)) == NULL)
             return -1;
-        }
         for (i = 0; i < size; i++)
             p[i] = values[i];
 
@@ -95,7 +91,7 @@ static void
 free_operand(operand_t *x)
 {
     if (x->size > 0)
-        free(x->values);
+        bufpool_put(x->values);
     x->size = 0;
     x->values = NULL;
 }
@@ -6,6 +6,8 @@
  * Code in this file might not work in the future release of CMOR.
  */
 #include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -16,12 +18,279 @@
 #include "cmor_supp.h"
 
 
+/*
+ * Hash index of a MIP table, built the first time it is used.
+ */
+struct hash_index {
+    int32_t *slots;             /* index of entries, -1 if empty */
+    uint32_t mask;
+};
+
+/*
+ * Sorted index of long_name and standard_name of axes (in upper case)
+ * for prefix lookups.
+ */
+struct name_entry {
+    char *key;
+    int axis;
+};
+
+struct table_index {
+    int built;
+    const void *vars, *formula, *axes;  /* to detect reloading */
+    int nvars, nformula, naxes;
+
+    struct hash_index var_index;
+    struct hash_index formula_index;
+    struct hash_index axis_index;
+
+    struct name_entry *names;
+    int nnames;
+};
+
+static struct table_index table_indexes[CMOR_MAX_TABLES];
+
+
 static cmor_table_t *
 get_default_table(void)
 {
     return (CMOR_TABLE < 0) ? NULL : &cmor_tables[CMOR_TABLE];
 }
 
+
+/*
+ * FNV-1a (32-bit).
+ */
+static uint32_t
+hash_string(const char *str)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *str; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+
+/*
+ * Build a hash index of 'num' ids, each of which is at
+ * (base + n * stride). The first one wins among the same ids,
+ * as a linear scan does.
+ */
+static int
+build_hash_index(struct hash_index *hidx,
+                 const char *base, size_t stride, int num)
+{
+    uint32_t size, k;
+    int n, m;
+
+    for (size = 16; size < 2 * num; size *= 2)
+        ;
+    if ((hidx->slots = malloc(sizeof(int32_t) * size)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    hidx->mask = size - 1;
+    for (k = 0; k < size; k++)
+        hidx->slots[k] = -1;
+
+    for (n = 0; n < num; n++) {
+        const char *id = base + n * stride;
+
+        for (k = hash_string(id) & hidx->mask;
+             (m = hidx->slots[k]) >= 0;
+             k = (k + 1) & hidx->mask)
+            if (strcmp(base + m * stride, id) == 0)
+                break;
+        if (m < 0)
+            hidx->slots[k] = n;
+    }
+    return 0;
+}
+
+
+static int
+search_hash_index(const struct hash_index *hidx,
+                  const char *base, size_t stride, const char *name)
+{
+    uint32_t k;
+    int m;
+
+    for (k = hash_string(name) & hidx->mask;
+         (m = hidx->slots[k]) >= 0;
+         k = (k + 1) & hidx->mask)
+        if (strcmp(base + m * stride, name) == 0)
+            return m;
+    return -1;
+}
+
+
+static char *
+upper_dup(const char *str)
+{
+    char *p, *s;
+
+    if ((s = strdup(str)) == NULL)
+        return NULL;
+    for (p = s; *p; p++)
+        *p = toupper((unsigned char)*p);
+    return s;
+}
+
+
+static int
+cmp_name_entry(const void *a, const void *b)
+{
+    const struct name_entry *e1 = a, *e2 = b;
+    int rval = strcmp(e1->key, e2->key);
+
+    return rval != 0 ? rval : e1->axis - e2->axis;
+}
+
+
+static int
+build_name_index(struct table_index *tidx, const cmor_table_t *table)
+{
+    int n, naxes = table->naxes + 1;
+
+    if ((tidx->names = malloc(sizeof(struct name_entry) * 2 * naxes))
+        == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    tidx->nnames = 0;
+    for (n = 0; n < naxes; n++) {
+        const char *keys[2];
+        int i;
+
+        keys[0] = table->axes[n].long_name;
+        keys[1] = table->axes[n].standard_name;
+        for (i = 0; i < 2; i++) {
+            struct name_entry *ent = tidx->names + tidx->nnames;
+
+            if ((ent->key = upper_dup(keys[i])) == NULL) {
+                logging(LOG_SYSERR, NULL);
+                return -1;
+            }
+            ent->axis = n;
+            tidx->nnames++;
+        }
+    }
+    qsort(tidx->names, tidx->nnames, sizeof(struct name_entry),
+          cmp_name_entry);
+    return 0;
+}
+
+
+static void
+free_table_index(struct table_index *tidx)
+{
+    int i;
+
+    free(tidx->var_index.slots);
+    free(tidx->formula_index.slots);
+    free(tidx->axis_index.slots);
+    if (tidx->names)
+        for (i = 0; i < tidx->nnames; i++)
+            free(tidx->names[i].key);
+    free(tidx->names);
+    memset(tidx, 0, sizeof(struct table_index));
+}
+
+
+/*
+ * Drop the index of a table (to be called after cmor_load_table()).
+ */
+void
+invalidate_table_index(int table_id)
+{
+    if (table_id >= 0 && table_id < CMOR_MAX_TABLES)
+        free_table_index(&table_indexes[table_id]);
+}
+
+
+/*
+ * Return the index of a table, which is built if not yet.
+ * NULL if failed (then lookups fall back to linear scans).
+ */
+static struct table_index *
+get_table_index(int table_id)
+{
+    cmor_table_t *table;
+    struct table_index *tidx;
+
+    if (table_id < 0 || table_id >= CMOR_MAX_TABLES)
+        return NULL;
+
+    table = &cmor_tables[table_id];
+    tidx = &table_indexes[table_id];
+    if (tidx->built
+        && tidx->vars == table->vars
+        && tidx->formula == table->formula
+        && tidx->axes == table->axes
+        && tidx->nvars == table->nvars
+        && tidx->nformula == table->nformula
+        && tidx->naxes == table->naxes)
+        return tidx;
+
+    free_table_index(tidx);
+
+    /*
+     * XXX (in CMOR2 2010-05-10)
+     * The number of entries in a table equals to "n + 1".
+     */
+    if (build_hash_index(&tidx->var_index,
+                         table->vars[0].id, sizeof(cmor_var_def_t),
+                         table->nvars + 1) < 0
+        || build_hash_index(&tidx->formula_index,
+                            table->formula[0].id, sizeof(cmor_var_def_t),
+                            table->nformula + 1) < 0
+        || build_hash_index(&tidx->axis_index,
+                            table->axes[0].id, sizeof(cmor_axis_def_t),
+                            table->naxes + 1) < 0
+        || build_name_index(tidx, table) < 0) {
+        free_table_index(tidx);
+        return NULL;
+    }
+    tidx->vars = table->vars;
+    tidx->formula = table->formula;
+    tidx->axes = table->axes;
+    tidx->nvars = table->nvars;
+    tidx->nformula = table->nformula;
+    tidx->naxes = table->naxes;
+    tidx->built = 1;
+    return tidx;
+}
+
+
+/*
+ * Find the range [*lo, *hi) of names starting with 'prefix'
+ * (in upper case).
+ */
+static void
+prefix_range(int *lo, int *hi, const struct table_index *tidx,
+             const char *prefix)
+{
+    size_t len = strlen(prefix);
+    int l = 0, h = tidx->nnames, m;
+
+    while (l < h) {
+        m = l + (h - l) / 2;
+        if (strcmp(tidx->names[m].key, prefix) < 0)
+            l = m + 1;
+        else
+            h = m;
+    }
+    *lo = l;
+    for (h = l;
+         h < tidx->nnames && strncmp(tidx->names[h].key, prefix, len) == 0;
+         h++)
+        ;
+    *hi = h;
+}
+
 /*
  * lookup vardef from MIP table
  */
@@ -30,6 +299,7 @@ lookup_vardef(const char *name)
 {
     cmor_table_t *table;
     cmor_var_def_t *ptr;
+    struct table_index *tidx;
     int n;
 
     if ((table = get_default_table()) == NULL) {
@@ -37,14 +307,20 @@ lookup_vardef(const char *name)
         return NULL;
     }
 
-    /*
-     * XXX (in CMOR2 2010-05-10)
-     * The number of variables in a table equals to "nvars + 1",
-     * not "nvars".
-     */
-    for (n = 0, ptr = table->vars; n < table->nvars + 1; n++, ptr++)
-        if (strcmp(ptr->id, name) == 0)
-            return ptr;
+    if ((tidx = get_table_index(CMOR_TABLE)) != NULL) {
+        n = search_hash_index(&tidx->var_index, table->vars[0].id,
+                              sizeof(cmor_var_def_t), name);
+        if (n >= 0)
+            return table->vars + n;
+    } else
+        /*
+         * XXX (in CMOR2 2010-05-10)
+         * The number of variables in a table equals to "nvars + 1",
+         * not "nvars".
+         */
+        for (n = 0, ptr = table->vars; n < table->nvars + 1; n++, ptr++)
+            if (strcmp(ptr->id, name) == 0)
+                return ptr;
 
     logging(LOG_WARN, "%s: No such variable.", name);
     return NULL; /* not found */
@@ -59,6 +335,7 @@ lookup_formula_vardef(const char *name)
 {
     cmor_table_t *table;
     cmor_var_def_t *ptr;
+    struct table_index *tidx;
     int n;
 
     if ((table = get_default_table()) == NULL) {
@@ -66,9 +343,16 @@ lookup_formula_vardef(const char *name)
         return NULL;
     }
 
-    for (n = 0, ptr = table->formula; n < table->nformula + 1; n++, ptr++)
-        if (strcmp(ptr->id, name) == 0)
-            return ptr;
+    if ((tidx = get_table_index(CMOR_TABLE)) != NULL) {
+        n = search_hash_index(&tidx->formula_index, table->formula[0].id,
+                              sizeof(cmor_var_def_t), name);
+        if (n >= 0)
+            return table->formula + n;
+    } else
+        for (n = 0, ptr = table->formula; n < table->nformula + 1;
+             n++, ptr++)
+            if (strcmp(ptr->id, name) == 0)
+                return ptr;
 
     logging(LOG_WARN, "%s: No such variable.", name);
     return NULL; /* not found */
@@ -83,6 +367,7 @@ lookup_axisdef(const char *name)
 {
     cmor_table_t *table;
     cmor_axis_def_t *ptr;
+    struct table_index *tidx;
     int n;
 
     if ((table = get_default_table()) == NULL) {
@@ -90,13 +375,19 @@ lookup_axisdef(const char *name)
         return NULL;
     }
 
-    /*
-     * XXX (in CMOR2 2010-05-10)
-     * The number of axes in a table equals to "naxes + 1".
-     */
-    for (n = 0, ptr = table->axes; n < table->naxes + 1; n++, ptr++)
-        if (strcmp(ptr->id, name) == 0)
-            return ptr;
+    if ((tidx = get_table_index(CMOR_TABLE)) != NULL) {
+        n = search_hash_index(&tidx->axis_index, table->axes[0].id,
+                              sizeof(cmor_axis_def_t), name);
+        if (n >= 0)
+            return table->axes + n;
+    } else
+        /*
+         * XXX (in CMOR2 2010-05-10)
+         * The number of axes in a table equals to "naxes + 1".
+         */
+        for (n = 0, ptr = table->axes; n < table->naxes + 1; n++, ptr++)
+            if (strcmp(ptr->id, name) == 0)
+                return ptr;
 
     logging(LOG_ERR, "%s: No such axis.", name);
     return NULL;
@@ -136,18 +427,40 @@ cmor_axis_def_t *
 lookup_axisdef_in_vardef(const char *name, const cmor_var_def_t *vdef)
 {
     cmor_axis_def_t *adef;
-    int i;
+    struct table_index *tidx;
+    char *prefix;
+    int i, k, lo = 0, hi = 0, prefixed;
 
-    if (vdef)
-        for (i = 0; i < vdef->ndims; i++) {
-            adef = get_axisdef_in_vardef(vdef, i);
+    if (!vdef)
+        return NULL;
 
-            if (adef
-                && (strcasecmp(adef->id, name) == 0
-                    || startswith_nocase(adef->long_name, name)
-                    || startswith_nocase(adef->standard_name, name)))
-                return adef;
-        }
+    /*
+     * the range of long_name/standard_name starting with 'name'.
+     * If empty, only ids are compared.
+     */
+    if ((tidx = get_table_index(vdef->table_id)) != NULL
+        && (prefix = upper_dup(name)) != NULL) {
+        prefix_range(&lo, &hi, tidx, prefix);
+        free(prefix);
+    } else
+        tidx = NULL;
+
+    for (i = 0; i < vdef->ndims; i++) {
+        if ((adef = get_axisdef_in_vardef(vdef, i)) == NULL)
+            continue;
+        if (strcasecmp(adef->id, name) == 0)
+            return adef;
+
+        if (!tidx || hi - lo > 8)
+            prefixed = startswith_nocase(adef->long_name, name)
+                || startswith_nocase(adef->standard_name, name);
+        else
+            for (prefixed = 0, k = lo; k < hi && !prefixed; k++)
+                prefixed = tidx->names[k].axis == vdef->dimensions[i];
+
+        if (prefixed)
+            return adef;
+    }
     return NULL;
 }
 
@@ -19,6 +19,7 @@ int is_singleton(const cmor_axis_def_t *adef);
 const char *get_frequency(const cmor_var_def_t *vdef);
 int has_modellevel_dim(const cmor_var_def_t *vdef);
 int lookup_varid(const char *name);
+void invalidate_table_index(int table_id);
 
 #ifdef __cplusplus
 }
@@ -41,6 +41,14 @@ static site_locations *sites = NULL;
 static float *site_databuf = NULL; /* XXX: must be of float */
 static size_t site_databuf_capacity = 0;
 
+/*
+ * Streaming-memory mode: a time step is processed in slabs of
+ * z-levels whose size is limited by 'slab_budget' (in bytes).
+ */
+static size_t slab_budget = 0;  /* 0: disabled */
+static float *slab_buf = NULL;
+static size_t slab_buf_capacity = 0;
+
 /*
  * use GT3_open() instead of GT3_openHistFile() if safe_open_mode.
  */
@@ -101,6 +109,17 @@ set_shuffle(int s)
 }
 
 
+int
+set_slab_budget(int mbytes)
+{
+    if (mbytes < 0)
+        return -1;
+
+    slab_budget = (size_t)mbytes << 20;
+    return 0;
+}
+
+
 void
 set_safe_open(void)
 {
@@ -142,12 +161,30 @@ unset_positive(void)
 }
 
 
+/*
+ * Reset the options of a variable. In batch mode, =c and =H are
+ * given before the first variable, and kept for all the variables.
+ */
+void
+unset_var_options(int batch)
+{
+    unset_varunit();
+    unset_calcexpr();
+    unset_positive();
+    unset_axis_slice();
+    if (!batch) {
+        sdb_close();
+        unset_header_edit();
+    }
+}
+
+
 int
 set_positive(const char *str)
 {
     if (str[0] == 'u' || str[0] == 'd') {
         positive = str[0];
-        logging(LOG_INFO, "set positive: %c", str[0]);
+        LOGGING(LOG_INFO, "set positive: %c", str[0]);
         return 0;
     }
     logging(LOG_ERR, "%s: invalid parameter for positive.", str);
@@ -243,27 +280,50 @@ get_dim_prop(gtool3_dim_prop *dim,
 }
 
 
+/*
+ * joint latitude of tripolar grid.
+ */
+static double
+joint_latitude(const GT3_Dim *y, const GT3_DimBound *y_bnds)
+{
+    double plat;
+
+    plat = (strncmp(y->name, "OCLATTPV", 8) == 0)
+        ? y->values[y->len - 1] - 90.
+        : y_bnds->bnd[y_bnds->len_orig] - 90.;
+    LOGGING(LOG_INFO, "tripolar: joint latitude: %.16f", plat);
+    return plat;
+}
+
+
 /*
  * setup grids and mapping parameters.
  */
 static int
 setup_grid_mapping(int *grid_id, const gtool3_dim_prop *dims, int mapping)
 {
-    GT3_Dim *x = NULL, *y = NULL;
-    GT3_DimBound *x_bnds = NULL, *y_bnds = NULL;
+    const GT3_Dim *x = NULL, *y = NULL;
+    const GT3_DimBound *x_bnds = NULL, *y_bnds = NULL;
     int id;
     int rval = -1;
-    double *xx, *yy, *xx_bnds, *yy_bnds;
+    const double *xx, *yy, *xx_bnds, *yy_bnds;
     double plat;
     int xlen, ylen;
+    char key[128];
+
+    snprintf(key, sizeof key, "grid %d %s:%d:%d %s:%d:%d", mapping,
+             dims[0].aitm, dims[0].astr, dims[0].aend,
+             dims[1].aitm, dims[1].astr, dims[1].aend);
+    if ((*grid_id = idreg_lookup(key)) >= 0)
+        return 0;
 
     /*
      * get model native coordinates.
      */
-    if ((x = GT3_getDim(dims[0].aitm)) == NULL
-        || (y = GT3_getDim(dims[1].aitm)) == NULL
-        || (x_bnds = get_dimbound(dims[0].aitm)) == NULL
-        || (y_bnds = get_dimbound(dims[1].aitm)) == NULL) {
+    if ((x = get_dim(dims[0].aitm)) == NULL
+        || (y = get_dim(dims[1].aitm)) == NULL
+        || (x_bnds = get_cached_dimbound(dims[0].aitm)) == NULL
+        || (y_bnds = get_cached_dimbound(dims[1].aitm)) == NULL) {
         GT3_printErrorMessages(stderr);
         goto finish;
     }
@@ -280,18 +340,21 @@ setup_grid_mapping(int *grid_id, const gtool3_dim_prop *dims, int mapping)
      */
     switch (mapping) {
     case ROTATED_POLE:
+        set_grid_cache_key("rotated_pole", dims, 0.,
+                           xx, xx_bnds, xlen, yy, yy_bnds, ylen);
         if (setup_rotated_pole(&id, xx, xx_bnds, xlen, yy, yy_bnds, ylen) < 0)
             goto finish;
         break;
     case BIPOLAR:
+        set_grid_cache_key("bipolar", dims, 0.,
+                           xx, xx_bnds, xlen, yy, yy_bnds, ylen);
         if (setup_bipolar(&id, xx, xx_bnds, xlen, yy, yy_bnds, ylen) < 0)
             goto finish;
         break;
     case TRIPOLAR:
-        plat = (strncmp(y->name, "OCLATTPV", 8) == 0)
-            ? y->values[y->len - 1] - 90.
-            : y_bnds->bnd[y_bnds->len_orig] - 90.;
-        logging(LOG_INFO, "tripolar: joint latitude: %.16f", plat);
+        plat = joint_latitude(y, y_bnds);
+        set_grid_cache_key("tripolar", dims, plat,
+                           xx, xx_bnds, xlen, yy, yy_bnds, ylen);
         if (setup_tripolar(&id, xx, xx_bnds, xlen, yy, yy_bnds, ylen,
                            plat) < 0)
             goto finish;
@@ -302,12 +365,78 @@ setup_grid_mapping(int *grid_id, const gtool3_dim_prop *dims, int mapping)
     }
     rval = 0;
     *grid_id = id;
+    idreg_register(key, id);
+
+finish:
+    release_dimbound(y_bnds);
+    release_dimbound(x_bnds);
+    release_dim(y);
+    release_dim(x);
+    return rval;
+}
+
+
+/*
+ * find grid points nearest to the site locations, using true lat/lon
+ * given by the grid mapping.
+ */
+static int
+update_site_indexes_mapping(const GT3_HEADER *head, int mapping)
+{
+    gtool3_dim_prop dims[2];
+    const GT3_Dim *x = NULL, *y = NULL;
+    const GT3_DimBound *y_bnds = NULL;
+    const double *xx, *yy;
+    double *lon = NULL, *lat = NULL;
+    int xlen, ylen, rc;
+    int rval = -1;
+
+    get_dim_prop(&dims[0], head, 0);
+    get_dim_prop(&dims[1], head, 1);
+
+    if ((x = get_dim(dims[0].aitm)) == NULL
+        || (y = get_dim(dims[1].aitm)) == NULL
+        || (y_bnds = get_cached_dimbound(dims[1].aitm)) == NULL) {
+        GT3_printErrorMessages(stderr);
+        goto finish;
+    }
+
+    xx = x->values + dims[0].astr - 1;
+    yy = y->values + dims[1].astr - 1;
+    xlen = dims[0].aend - dims[0].astr + 1;
+    ylen = dims[1].aend - dims[1].astr + 1;
+
+    if ((lon = bufpool_get(sizeof(double) * xlen * ylen)) == NULL
+        || (lat = bufpool_get(sizeof(double) * xlen * ylen)) == NULL)
+        goto finish;
+
+    switch (mapping) {
+    case ROTATED_POLE:
+        rc = get_rotated_pole_lonlat(lon, lat, xx, xlen, yy, ylen);
+        break;
+    case BIPOLAR:
+        rc = get_bipolar_lonlat(lon, lat, xx, xlen, yy, ylen);
+        break;
+    case TRIPOLAR:
+        rc = get_tripolar_lonlat(lon, lat, xx, xlen, yy, ylen,
+                                 joint_latitude(y, y_bnds));
+        break;
+    default:
+        assert(!"NOTREACHED");
+        rc = -1;
+        break;
+    }
+    if (rc < 0 || update_site_indexes_2d(sites, lon, lat, xlen, ylen) < 0)
+        goto finish;
+
+    rval = 0;
 
 finish:
-    GT3_freeDimBound(y_bnds);
-    GT3_freeDimBound(x_bnds);
-    GT3_freeDim(y);
-    GT3_freeDim(x);
+    bufpool_put(lat);
+    bufpool_put(lon);
+    release_dimbound(y_bnds);
+    release_dim(y);
+    release_dim(x);
     return rval;
 }
 
@@ -326,6 +455,7 @@ setup_axes(int *axis_ids, int *num_ids,
     cmor_axis_def_t *timedef = NULL;
     gtool3_dim_prop dims[3];
     int grid_pos1 = -1, grid_pos2 = -1;
+    double t0;
 
     /*
      * count the number of axes except for singleton-axis and time-axis.
@@ -375,7 +505,7 @@ setup_axes(int *axis_ids, int *num_ids,
              * special treatment for axes used in grid mapping.
              * 'axis_id' will be set later.
              */
-            logging(LOG_INFO, "mapping axis: %s", dp->aitm);
+            LOGGING(LOG_INFO, "mapping axis: %s", dp->aitm);
             axis_ids[n] = -1000; /* dummy */
             if (i == 0) grid_pos1 = n;
             if (i == 1) grid_pos2 = n;
@@ -392,7 +522,7 @@ setup_axes(int *axis_ids, int *num_ids,
             return -1;
         }
         for (j = 0; j < nids; j++, n++) {
-            logging(LOG_INFO, "axisid = %d for %s", ids[j], dp->aitm);
+            LOGGING(LOG_INFO, "axisid = %d for %s", ids[j], dp->aitm);
             if (n < CMOR_MAX_DIMENSIONS)
                 axis_ids[n] = ids[j];
         }
@@ -404,9 +534,9 @@ setup_axes(int *axis_ids, int *num_ids,
     }
 
     /*
-     * setup grid mapping if needed.
+     * setup grid mapping if needed (sites have their own grid).
      */
-    if (grid_mapping) {
+    if (grid_mapping && !sites) {
         int grid_id;
 
         if (grid_pos1 == -1 || grid_pos2 == -1) {
@@ -419,8 +549,10 @@ setup_axes(int *axis_ids, int *num_ids,
             return -1;
         }
 
+        t0 = stats_clock();
         if (setup_grid_mapping(&grid_id, dims, grid_mapping) < 0)
             return -1;
+        trace_span("setup_grid_mapping", t0);
 
         /*
          * Replace two IDs(lat/lon) by an ID of the grid mapping.
@@ -438,14 +570,28 @@ setup_axes(int *axis_ids, int *num_ids,
      */
     if (sites) {
         int site_id, grid_id;
-
-        if (cmor_axis(&site_id, "site", " ", sites->nlocs,
-                      sites->ids, 'i', NULL, 0, NULL) != 0
-            || cmor_grid(&grid_id, 1, &site_id, 'd',
-                         sites->grid_lats, sites->grid_lons,
-                         0, NULL, NULL) != 0) {
-            logging(LOG_ERR, "failed to define the grids for site locations");
-            return -1;
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        char key[64];
+
+        hash = idreg_hash(hash, sites->ids, sizeof(int) * sites->nlocs);
+        hash = idreg_hash(hash, sites->grid_lats,
+                          sizeof(double) * sites->nlocs);
+        hash = idreg_hash(hash, sites->grid_lons,
+                          sizeof(double) * sites->nlocs);
+        snprintf(key, sizeof key, "sites %d %016llx",
+                 (int)sites->nlocs, (unsigned long long)hash);
+
+        if ((grid_id = idreg_lookup(key)) < 0) {
+            if (cmor_axis(&site_id, "site", " ", sites->nlocs,
+                          sites->ids, 'i', NULL, 0, NULL) != 0
+                || cmor_grid(&grid_id, 1, &site_id, 'd',
+                             sites->grid_lats, sites->grid_lons,
+                             0, NULL, NULL) != 0) {
+                logging(LOG_ERR,
+                        "failed to define the grids for site locations");
+                return -1;
+            }
+            idreg_register(key, grid_id);
         }
         axis_ids[grid_pos1] = grid_id;
     }
@@ -455,7 +601,7 @@ setup_axes(int *axis_ids, int *num_ids,
      */
     if (timedef) {
         axis_ids[num_axis_ids] = get_timeaxis(timedef);
-        logging(LOG_INFO, "axisid = %d for %s.",
+        LOGGING(LOG_INFO, "axisid = %d for %s.",
                 axis_ids[num_axis_ids], timedef->id);
         num_axis_ids++;
     }
@@ -504,7 +650,7 @@ setup_variable(const int *axis_ids, int num_axis_ids,
         logging(LOG_ERR, "cmor_variable() failed.");
         return -1;
     }
-    logging(LOG_INFO, "varid = %d for %s", varid, vdef->id);
+    LOGGING(LOG_INFO, "varid = %d for %s", varid, vdef->id);
     return varid;
 }
 
@@ -563,12 +709,14 @@ required_zfactors(int var_id)
 
 
 static int
-write_var(int var_id, const myvar_t *var, int *ref_varid)
+write_values(int var_id, const myvar_t *var,
+             float *values, size_t nelems, int *ref_varid)
 {
     double *timep = NULL;
     double *tbnd = NULL;
+    double t0 = stats_clock();
     int ntimes = 0;
-    float *values;
+    int rc;
 
     if (var->timedepend != TIME_INDEP) {
         timep = (double *)(&var->time);
@@ -580,21 +728,15 @@ write_var(int var_id, const myvar_t *var, int *ref_varid)
 
     cmor_set_deflate(var_id, shuffle, deflate, deflate_level);
 
-    if (sites) {
-        int i, k, offset;
-        float *p = site_databuf;
-
-        assert(sites->nlocs * var->dimlen[2] <= site_databuf_capacity);
-
-        for (k = 0; k < var->dimlen[2]; k++, p += sites->nlocs) {
-            offset = k * var->dimlen[0] * var->dimlen[1];
-
-            for (i = 0; i < sites->nlocs; i++)
-                p[i] = var->data[offset + sites->indexes[i]];
+    if (ref_varid == NULL && fast_write_ready(var_id, nelems)) {
+        rc = fast_write(var_id, values, nelems, timep, tbnd);
+        if (rc == 0) {
+            io_account(IO_OUTPUT, IO_WRITE, cmor_vars[var_id].id,
+                       sizeof(float) * nelems, t0);
+            stats_add(STAGE_WRITE, t0, sizeof(float) * nelems);
         }
-        values = site_databuf;
-    } else {
-        values = var->data;
+        if (rc <= 0)
+            return rc;
     }
 
     if (cmor_write(var_id, values, 'f', NULL, ntimes,
@@ -602,6 +744,248 @@ write_var(int var_id, const myvar_t *var, int *ref_varid)
         logging(LOG_ERR, "cmor_write() failed.");
         return -1;
     }
+    io_account(IO_OUTPUT, IO_WRITE, cmor_vars[var_id].id,
+               sizeof(float) * nelems, t0);
+    stats_add(STAGE_WRITE, t0, sizeof(float) * nelems);
+    return 0;
+}
+
+
+static int
+write_var(int var_id, const myvar_t *var, int *ref_varid)
+{
+    if (sites) {
+        assert(sites->nlocs * var->dimlen[2] <= site_databuf_capacity);
+
+        gather_sites(site_databuf, var->data, sites,
+                     var->dimlen[0] * var->dimlen[1], var->dimlen[2]);
+        return write_values(var_id, var, site_databuf,
+                            sites->nlocs * var->dimlen[2], ref_varid);
+    }
+    return write_values(var_id, var, var->data, var->nelems, ref_varid);
+}
+
+
+/*
+ * The number of z-levels in a slab.
+ */
+static int
+levels_per_slab(const myvar_t *var)
+{
+    size_t nxy, size;
+    int nlev;
+
+    nxy = (size_t)var->dimlen[0] * var->dimlen[1];
+
+    /* slab_buf, and a copy for fast_write() or eval_calc(). */
+    size = sizeof(float) * nxy;
+    if (!sites)
+        size += sizeof(float) * nxy;
+    if (calc_expression)
+        size += 2 * sizeof(double) * nxy;
+
+    nlev = slab_budget / size;
+    if (nlev < 1)
+        nlev = 1;
+    if (nlev > var->dimlen[2])
+        nlev = var->dimlen[2];
+    return nlev;
+}
+
+
+/*
+ * Return 1 if the main variable can be processed by slabs.
+ *
+ * The first time step must be written by cmor_write() with a whole
+ * array (for sites, the gathered array is small enough).
+ */
+static int
+slab_available(int var_id, const myvar_t *var, const int *ref_varid)
+{
+    if (slab_budget == 0 || ref_varid != NULL || var->dimlen[2] < 2)
+        return 0;
+    if (sites)
+        return 1;
+
+    return var->timedepend != TIME_INDEP
+        && fast_write_ready(var_id, var->nelems)
+        && fast_write_nlevels(var_id) == var->dimlen[2];
+}
+
+
+static int
+eval_var(myvar_t *var, double miss)
+{
+    size_t chunk, n, size;
+
+    if (!calc_expression)
+        return 0;
+
+    /*
+     * eval_calc() is element-wise, so that it can be applied
+     * to a part of the array in order to save memory.
+     */
+    chunk = var->nelems;
+    if (slab_budget > 0)
+        chunk = (size_t)levels_per_slab(var) * var->dimlen[0]
+            * var->dimlen[1];
+
+    for (n = 0; n < var->nelems; n += size) {
+        size = var->nelems - n < chunk ? var->nelems - n : chunk;
+        if (eval_calc(calc_expression, var->data + n, miss, size) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Read and evaluate a whole time step.
+ */
+static int
+read_eval_var(myvar_t *var, GT3_Varbuf *vbuf)
+{
+    double t0;
+
+    if (axis_slice[2])
+        rewindSeq(axis_slice[2]);
+
+    t0 = stats_clock();
+    if (read_var(var, vbuf, axis_slice[2]) < 0)
+        return -1;
+    stats_add(STAGE_READ, t0, sizeof(float) * var->nelems);
+
+    t0 = stats_clock();
+    if (eval_var(var, vbuf->miss) < 0)
+        return -1;
+    if (calc_expression)
+        stats_add(STAGE_CALC, t0, sizeof(float) * var->nelems);
+    return 0;
+}
+
+
+/*
+ * Read, evaluate, and write a time step only at the site locations.
+ */
+static int
+convert_sites(int var_id, myvar_t *var, GT3_Varbuf *vbuf,
+              const GT3_HEADER *head, int *ref_varid)
+{
+    size_t nelems = sites->nlocs * var->dimlen[2];
+    double miss = -999.;
+    double t0;
+
+    assert(nelems <= site_databuf_capacity);
+
+    /*
+     * The whole array is no longer needed.
+     */
+    if (var->data) {
+        LOGGING(LOG_INFO, "sparse read: %d point(s) per z-level",
+                (int)sites->nlocs);
+        bufpool_release(var->data);
+        var->data = NULL;
+    }
+
+    if (GT3_decodeHeaderDouble(&miss, head, "MISS") < 0)
+        GT3_clearLastError();
+
+    if (axis_slice[2])
+        rewindSeq(axis_slice[2]);
+
+    t0 = stats_clock();
+    if (read_var_points(var, site_databuf, vbuf, axis_slice[2],
+                        sites->indexes, sites->nlocs, miss) < 0)
+        return -1;
+    stats_add(STAGE_READ, t0, sizeof(float) * nelems);
+
+    if (calc_expression) {
+        t0 = stats_clock();
+        if (eval_calc(calc_expression, site_databuf, miss, nelems) < 0)
+            return -1;
+        stats_add(STAGE_CALC, t0, sizeof(float) * nelems);
+    }
+
+    return write_values(var_id, var, site_databuf, nelems, ref_varid);
+}
+
+
+/*
+ * Read, evaluate, and write a time step by slabs of z-levels.
+ */
+static int
+convert_by_slab(int var_id, myvar_t *var, GT3_Varbuf *vbuf)
+{
+    int nxy, nz, nlev, z, n;
+    size_t siz;
+    double *tbnd = NULL;
+    double t0;
+
+    nxy = var->dimlen[0] * var->dimlen[1];
+    nz = var->dimlen[2];
+    nlev = levels_per_slab(var);
+
+    /*
+     * The whole array is no longer needed.
+     */
+    if (var->data) {
+        LOGGING(LOG_INFO, "slab mode: %d z-level(s) at once", nlev);
+        bufpool_release(var->data);
+        var->data = NULL;
+    }
+
+    siz = (size_t)nxy * nlev;
+    if (siz > slab_buf_capacity) {
+        float *ptr;
+
+        bufpool_put(slab_buf);
+        slab_buf = NULL;
+        slab_buf_capacity = 0;
+        if ((ptr = bufpool_get(sizeof(float) * siz)) == NULL)
+            return -1;
+        slab_buf = ptr;
+        slab_buf_capacity = siz;
+    }
+
+    if (var->timedepend == TIME_MEAN || var->timedepend == TIME_CLIM)
+        tbnd = var->timebnd;
+
+    if (axis_slice[2])
+        rewindSeq(axis_slice[2]);
+
+    for (z = 0; z < nz; z += n) {
+        n = nz - z < nlev ? nz - z : nlev;
+        siz = (size_t)nxy * n;
+
+        t0 = stats_clock();
+        if (read_var_slab(var, slab_buf, vbuf, axis_slice[2], z, n) < 0)
+            return -1;
+        stats_add(STAGE_READ, t0, sizeof(float) * siz);
+
+        if (calc_expression) {
+            t0 = stats_clock();
+            if (eval_calc(calc_expression, slab_buf, vbuf->miss, siz) < 0)
+                return -1;
+            stats_add(STAGE_CALC, t0, sizeof(float) * siz);
+        }
+
+        if (sites)
+            gather_sites(site_databuf + (size_t)z * sites->nlocs,
+                         slab_buf, sites, nxy, n);
+        else {
+            t0 = stats_clock();
+            if (fast_write_slab(var_id, slab_buf, z, n,
+                                &var->time, tbnd) < 0)
+                return -1;
+            io_account(IO_OUTPUT, IO_WRITE, cmor_vars[var_id].id,
+                       sizeof(float) * siz, t0);
+            stats_add(STAGE_WRITE, t0, sizeof(float) * siz);
+        }
+    }
+
+    if (sites)
+        return write_values(var_id, var, site_databuf,
+                            sites->nlocs * nz, NULL);
     return 0;
 }
 
@@ -664,124 +1048,432 @@ cmp_date(const GT3_HEADER *head, const char *key, const GT3_Date *reference)
 
 
 /*
- * varname: a string(PCMDI name) or NULL.
- * varcnt: 1, 2, 3, ...
+ * state of dates through the time steps.
  */
-int
-convert(const char *varname, const char *path, int varcnt)
-{
-    static GT3_Varbuf *vbuf = NULL;
-    static int varid;
-    static int main_varid;
-    static cmor_var_def_t *vdef;
-    static myvar_t *var = NULL;
-    static GT3_Date date0;
-    static GT3_Date date1;
-    static GT3_Date date2;
-    static GT3_Duration intv;
-    static int const_interval;
-    static int zfac_ids[16];
-    static int nzfac;
+struct time_state {
+    GT3_Date date0;             /* very first date */
+    GT3_Date date1, date2;      /* DATE1 and DATE2 (expected) */
+    GT3_Duration intv;
+    int const_interval;
+};
 
-    int axis_ids[CMOR_MAX_DIMENSIONS], num_axis_ids;
-    GT3_File *fp;
-    GT3_HEADER head;
-    struct file_iterator it;
-    int stat;
-    int rval = -1;
-    int *ref_varid;
-    int cal;
 
-    fp = safe_open_mode ? GT3_open(path) : GT3_openHistFile(path);
-    if (fp == NULL) {
-        GT3_printErrorMessages(stderr);
+/*
+ * Check the first DATE1 and DATE2.
+ * The main variable ('main_var' is nonzero) sets up the state,
+ * and the others (zfactors) must start with the same date.
+ */
+static int
+check_first_date(struct time_state *ts, const GT3_HEADER *head,
+                 const GT3_File *fp, const cmor_var_def_t *vdef,
+                 const myvar_t *var, int main_var)
+{
+    if (check_basetime() < 0) {
+        logging(LOG_ERR, "invalid basetime.");
         return -1;
     }
 
-    if (time_seq)
-        reinitSeq(time_seq, 1, 0x7fffffff);
-
-    setup_file_iterator(&it, fp, time_seq);
-
     /*
-     * skip chunks out of range.
+     * first DATE1 and DATE2.
      */
-    while ((stat = iterate_file(&it)) == ITER_OUTRANGE)
-        ;
-    if (stat != ITER_CONTINUE) {
-        logging(LOG_ERR, "No data in %s.", path);
-        goto finish;
+    if (   GT3_decodeHeaderDate(&ts->date1, head, "DATE1") < 0
+        || GT3_decodeHeaderDate(&ts->date2, head, "DATE2") < 0) {
+        GT3_printErrorMessages(stderr);
+        logging(LOG_ERR, "missing DATE1 and/or DATE2.");
+        return -1;
     }
 
-    if (varname) {
-        int shape[3];
+    if (main_var) {
+        ts->const_interval = get_interval(&ts->intv, vdef) == 0;
+        ts->date0 = ts->date1;
+        LOGGING(LOG_INFO,
+                "Date of the first: %d-%02d-%02d %02d:%02d:%02d",
+                ts->date0.year, ts->date0.mon, ts->date0.day,
+                ts->date0.hour, ts->date0.min, ts->date0.sec);
+
+        if (var->timedepend == TIME_POINT
+            && GT3_cmpDate2(&ts->date1, &ts->date2) != 0)
+            logging(LOG_WARN,
+                    "'DATE2 - DATE1' must be zero"
+                    " for instantaneous data.");
+    } else if (GT3_cmpDate2(&ts->date0, &ts->date1) != 0) {
+        logging(LOG_ERR, "mismatch the first date in %s.", fp->path);
+        return -1;
+    }
+    return 0;
+}
 
-        vdef = (varcnt == 1)
-            ? lookup_vardef(varname)
-            : lookup_formula_vardef(varname);
-        if (vdef == NULL) {
-            logging(LOG_ERR, "%s: No such variable in MIP table.", varname);
-            goto finish;
-        }
 
-        GT3_freeVarbuf(vbuf);
-        vbuf = NULL;
-        free_var(var);
-        var = NULL;
+/*
+ * Check DATE1 and DATE2 of a time step, and set the time of 'var'.
+ */
+static int
+set_step_time(struct time_state *ts, myvar_t *var,
+              const GT3_HEADER *head, const GT3_File *fp)
+{
+    if (ts->const_interval) {
+        if (   cmp_date(head, "DATE1", &ts->date1) != 0
+            || cmp_date(head, "DATE2", &ts->date2) != 0) {
 
-        if (GT3_readHeader(&head, fp) < 0
-            || (vbuf = GT3_getVarbuf(fp)) == NULL) {
+            logging(LOG_ERR, "invalid DATE[12] in %s (No.%d).",
+                    fp->path, fp->curr + 1);
+            return -1;
+        }
+    } else {
+        if (   GT3_decodeHeaderDate(&ts->date1, head, "DATE1") < 0
+            || GT3_decodeHeaderDate(&ts->date2, head, "DATE2") < 0) {
             GT3_printErrorMessages(stderr);
-            goto finish;
+            logging(LOG_ERR, "in %s (No.%d).", fp->path, fp->curr + 1);
+            return -1;
         }
-        if (edit_header(&head) < 0)
-            goto finish;
-        if ((var = new_var()) == NULL)
-            goto finish;
+    }
+    var->timebnd[0] = get_time(&ts->date1);
+    var->timebnd[1] = get_time(&ts->date2);
 
-        var->timedepend = check_timedependency(vdef);
+    if (var->timedepend == TIME_CLIM) {
+        GT3_Date date;
 
-        if (varcnt == 1) {
-            char *zfattr;
+        GT3_decodeHeaderDate(&date, head, "DATE");
+        var->time = get_time(&date);
+    } else
+        var->time = .5 * (var->timebnd[0] + var->timebnd[1]);
 
-            logging(LOG_INFO, "deflate level = %d, shuffle = %d",
-                    deflate_level, shuffle);
+    if (ts->const_interval) {
+        step_time(&ts->date1, &ts->intv);
+        step_time(&ts->date2, &ts->intv);
+    }
+    return 0;
+}
 
-            if (var->timedepend > 0 && get_calendar() == GT3_CAL_DUMMY) {
-                /*
-                 * set calendar automatically.
-                 */
-                if ((cal = GT3_guessCalendarFile(path)) < 0) {
-                    GT3_printErrorMessages(stderr);
-                    goto finish;
-                }
-                if (cal == GT3_CAL_DUMMY) {
-                    logging(LOG_ERR, "cannot guess calendar.");
-                    goto finish;
-                }
-                if (set_calendar(cal) < 0)
-                    goto finish;
-            }
 
-            if (sites && update_site_indexes(sites, &head) < 0)
-                goto finish;
+/*
+ * Set up the main variable: axes, variable, and zfactors.
+ */
+static int
+setup_main_variable(int *varid, int *zfac_ids, int *nzfac,
+                    const cmor_var_def_t *vdef, const myvar_t *var,
+                    GT3_Varbuf *vbuf, const GT3_HEADER *head,
+                    const char *path)
+{
+    int axis_ids[CMOR_MAX_DIMENSIONS], num_axis_ids;
+    char *zfattr;
+    double t0;
+    int cal;
 
-            if (setup_axes(axis_ids, &num_axis_ids, vdef, &head) < 0
-                || (varid = setup_variable(axis_ids, num_axis_ids,
-                                           vdef, vbuf, &head)) < 0)
-                goto finish;
+    LOGGING(LOG_INFO, "deflate level = %d, shuffle = %d",
+            deflate_level, shuffle);
+
+    if (var->timedepend > 0 && get_calendar() == GT3_CAL_DUMMY) {
+        /*
+         * set calendar automatically.
+         */
+        if ((cal = GT3_guessCalendarFile(path)) < 0) {
+            GT3_printErrorMessages(stderr);
+            return -1;
+        }
+        if (cal == GT3_CAL_DUMMY) {
+            logging(LOG_ERR, "cannot guess calendar.");
+            return -1;
+        }
+        if (set_calendar(cal) < 0)
+            return -1;
+    }
 
-            nzfac = 0;
-            if ((zfattr = required_zfactors(varid))) {
-                logging(LOG_INFO, "required zfactors: %s", zfattr);
+    if (sites
+        && (grid_mapping
+            ? update_site_indexes_mapping(head, grid_mapping)
+            : update_site_indexes(sites, head)) < 0)
+        return -1;
 
-                if (axis_slice[2])
-                    rewindSeq(axis_slice[2]);
-                if ((nzfac = setup_zfactors(zfac_ids, varid,
-                                            axis_ids, num_axis_ids,
-                                            &head, axis_slice[2])) < 0)
-                    goto finish;
-            }
+    t0 = stats_clock();
+    if (setup_axes(axis_ids, &num_axis_ids, vdef, head) < 0)
+        return -1;
+    trace_span("setup_axes", t0);
+
+    t0 = stats_clock();
+    if ((*varid = setup_variable(axis_ids, num_axis_ids,
+                                 vdef, vbuf, head)) < 0)
+        return -1;
+    trace_span("setup_variable", t0);
+
+    *nzfac = 0;
+    if ((zfattr = required_zfactors(*varid))) {
+        LOGGING(LOG_INFO, "required zfactors: %s", zfattr);
+
+        if (axis_slice[2])
+            rewindSeq(axis_slice[2]);
+        t0 = stats_clock();
+        if ((*nzfac = setup_zfactors(zfac_ids, *varid,
+                                     axis_ids, num_axis_ids,
+                                     head, axis_slice[2])) < 0)
+            return -1;
+        trace_span("setup_zfactors", t0);
+    }
+    register_output(*varid);
+    return 0;
+}
+
+
+/*
+ * With --mem-limit (and without -Z), process 3-D fields by slabs if
+ * a whole time step would not fit under the limit, together with the
+ * operands of the calculator and a copy for fast-write.
+ *
+ * Slabs are available for sites, or with -F (fast-write) after the
+ * first time step, which still needs the whole array.
+ */
+static void
+fit_mem_limit(const int *shape)
+{
+    static int auto_slab = 0;
+    size_t limit = get_mem_limit();
+    size_t rss, nelems, whole, need;
+
+    if (auto_slab) {
+        slab_budget = 0;
+        auto_slab = 0;
+    }
+    if (limit == 0 || slab_budget > 0 || shape[2] < 2)
+        return;
+
+    nelems = (size_t)shape[0] * shape[1] * shape[2];
+    whole = sizeof(float) * nelems;
+    need = 2 * whole;
+    if (calc_expression)
+        need += 2 * sizeof(double) * nelems;
+
+    rss = mem_rss();
+    if (rss + need <= limit)
+        return;
+
+    if (!sites && !fast_write_enabled()) {
+        logging(LOG_NOTICE, "a time step (%.1f MB) may exceed --mem-limit "
+                "(-F is needed to process by slabs).", need / 1048576.);
+        return;
+    }
+    slab_budget = limit > rss + whole ? limit - rss - whole : 1;
+    auto_slab = 1;
+    logging(LOG_NOTICE, "process by slabs within %.1f MB (--mem-limit).",
+            slab_budget / 1048576.);
+}
+
+
+/*
+ * Allocate data buffers for the shape of 'vbuf'.
+ */
+static int
+prepare_var(myvar_t *var, const GT3_Varbuf *vbuf)
+{
+    int shape[3];
+
+    shape[0] = vbuf->dimlen[0];
+    shape[1] = vbuf->dimlen[1];
+    shape[2] = vbuf->dimlen[2];
+    if (axis_slice[2]) {
+        rewindSeq(axis_slice[2]);
+        shape[2] = countSeq(axis_slice[2]);
+    }
+    fit_mem_limit(shape);
+    if (sites && slab_budget > 0 && shape[2] > 1) {
+        /*
+         * Sites are read by slabs (or sparsely) from the first time
+         * step, so that the whole array is allocated on demand
+         * (see convert_step()).
+         */
+        bufpool_release(var->data);
+        var->data = NULL;
+        memcpy(var->dimlen, shape, sizeof shape);
+        var->nelems = (size_t)shape[0] * shape[1] * shape[2];
+    } else if (resize_var(var, shape, 3) < 0)
+        return -1;
+
+    /* alloc data buffer for site data. */
+    if (sites && sites->nlocs * shape[2] > site_databuf_capacity) {
+        size_t siz;
+        float *ptr;
+
+        siz = sites->nlocs * shape[2];
+        bufpool_put(site_databuf);
+        site_databuf = NULL;
+        site_databuf_capacity = 0;
+        if ((ptr = bufpool_get(sizeof(float) * siz)) == NULL)
+            return -1;
+
+        site_databuf = ptr;
+        site_databuf_capacity = siz;
+    }
+    return 0;
+}
+
+
+/*
+ * Convert a time step (the header has been read).
+ */
+static int
+convert_step(int varid, myvar_t *var, GT3_Varbuf *vbuf,
+             const GT3_HEADER *head, int *ref_varid)
+{
+    if (sites && sparse_readable(vbuf))
+        return convert_sites(varid, var, vbuf, head, ref_varid);
+
+    if (slab_available(varid, var, ref_varid))
+        return convert_by_slab(varid, var, vbuf);
+
+    /*
+     * The whole array has been released by a previous sparse or slab
+     * read (a later chunk or file may not allow it).
+     */
+    if (var->data == NULL && resize_var(var, var->dimlen, 3) < 0)
+        return -1;
+
+    if (read_eval_var(var, vbuf) < 0
+        || write_var(varid, var, ref_varid) < 0)
+        return -1;
+    return 0;
+}
+
+
+static GT3_File *
+open_input(const char *path)
+{
+    GT3_File *fp;
+    double t0 = stats_clock();
+
+    fp = safe_open_mode ? GT3_open(path) : GT3_openHistFile(path);
+    io_account(IO_DATA, IO_OPEN, path, 0, t0);
+    if (fp == NULL)
+        GT3_printErrorMessages(stderr);
+    return fp;
+}
+
+
+/*
+ * GT3_readHeader() and GT3_seek() with I/O accounting.
+ */
+static int
+read_header(GT3_HEADER *head, GT3_File *fp)
+{
+    double t0 = stats_clock();
+    int rval;
+
+    rval = GT3_readHeader(head, fp);
+    io_account(IO_HEADER, IO_READ, fp->path, GT3_HEADER_SIZE, t0);
+    return rval;
+}
+
+
+static int
+seek_chunk(GT3_File *fp, int curr)
+{
+    double t0 = stats_clock();
+    int rval;
+
+    rval = GT3_seek(fp, curr, SEEK_SET);
+    io_account(IO_DATA, IO_SEEK, fp->path, 0, t0);
+    return rval;
+}
+
+
+/*
+ * varname: a string(PCMDI name) or NULL.
+ * varcnt: 1, 2, 3, ...
+ */
+/*
+ * The main variable of convert().
+ */
+static int main_varid = -1;
+
+
+/*
+ * All the files of the main variable (and its zfactors) have been
+ * converted: close it so that its file is staged out at once.
+ */
+int
+finish_convert(void)
+{
+    int id = main_varid;
+
+    main_varid = -1;
+    return id >= 0 ? stage_variable(id) : 0;
+}
+
+
+int
+convert(const char *varname, const char *path, int varcnt)
+{
+    static GT3_Varbuf *vbuf = NULL;
+    static int varid;
+    static cmor_var_def_t *vdef;
+    static myvar_t *var = NULL;
+    static struct time_state ts;
+    static int zfac_ids[16];
+    static int nzfac;
+
+    GT3_File *fp;
+    GT3_HEADER head;
+    struct file_iterator it;
+    int stat;
+    int rval = -1;
+    int *ref_varid;
+    double t0, t_step;
+
+    if (varname)
+        stats_begin_var(varname);
+
+    t0 = stats_clock();
+    if ((fp = open_input(path)) == NULL)
+        return -1;
+
+    if (time_seq)
+        reinitSeq(time_seq, 1, 0x7fffffff);
+
+    setup_file_iterator(&it, fp, time_seq);
+
+    /*
+     * skip chunks out of range.
+     */
+    while ((stat = iterate_file(&it)) == ITER_OUTRANGE)
+        ;
+    if (stat != ITER_CONTINUE) {
+        logging(LOG_ERR, "No data in %s.", path);
+        goto finish;
+    }
+    stats_add(STAGE_OPEN, t0, 0);
+
+    if (varname) {
+        vdef = (varcnt == 1)
+            ? lookup_vardef(varname)
+            : lookup_formula_vardef(varname);
+        if (vdef == NULL) {
+            logging(LOG_ERR, "%s: No such variable in MIP table.", varname);
+            goto finish;
+        }
+
+        GT3_freeVarbuf(vbuf);
+        vbuf = NULL;
+        free_var(var);
+
+        t0 = stats_clock();
+        if (read_header(&head, fp) < 0
+            || (vbuf = GT3_getVarbuf(fp)) == NULL) {
+            GT3_printErrorMessages(stderr);
+            goto finish;
+        }
+        if (edit_header(&head) < 0)
+            goto finish;
+        if (var == NULL && (var = new_var()) == NULL)
+            goto finish;
+
+        var->timedepend = check_timedependency(vdef);
+        stats_add(STAGE_HEADER, t0, 0);
+
+        t0 = stats_clock();
+        if (varcnt == 1) {
+            if (finish_convert() < 0)
+                goto finish;
+            if (setup_main_variable(&varid, zfac_ids, &nzfac,
+                                    vdef, var, vbuf, &head, path) < 0)
+                goto finish;
             main_varid = varid;
         } else {
             /*
@@ -796,70 +1488,18 @@ convert(const char *varname, const char *path, int varcnt)
                 logging(LOG_ERR, "%s: Not a zfactor.", varname);
                 goto finish;
             }
-            logging(LOG_INFO, "use %s(id=%d) as zfactor.", varname, varid);
+            LOGGING(LOG_INFO, "use %s(id=%d) as zfactor.", varname, varid);
         }
 
-        shape[0] = vbuf->dimlen[0];
-        shape[1] = vbuf->dimlen[1];
-        shape[2] = vbuf->dimlen[2];
-        if (axis_slice[2]) {
-            rewindSeq(axis_slice[2]);
-            shape[2] = countSeq(axis_slice[2]);
-        }
-        if (resize_var(var, shape, 3) < 0)
+        if (prepare_var(var, vbuf) < 0)
             goto finish;
+        stats_add(STAGE_SETUP, t0, 0);
 
-        /* alloc data buffer for site data. */
-        if (sites && sites->nlocs * shape[2] > site_databuf_capacity) {
-            size_t siz;
-            float *ptr;
-
-            siz = sites->nlocs * shape[2];
-            if ((ptr = malloc(sizeof(float) * siz)) == NULL) {
-                logging(LOG_SYSERR, NULL);
-                goto finish;
-            }
-            free(site_databuf);
-
-            site_databuf = ptr;
-            site_databuf_capacity = siz;
-        }
-
-        if (var->timedepend > 0) {
-            if (check_basetime() < 0) {
-                logging(LOG_ERR, "invalid basetime.");
-                goto finish;
-            }
-
-            /*
-             * first DATE1 and DATE2.
-             */
-            if (   GT3_decodeHeaderDate(&date1, &head, "DATE1") < 0
-                || GT3_decodeHeaderDate(&date2, &head, "DATE2") < 0) {
-                GT3_printErrorMessages(stderr);
-                logging(LOG_ERR, "missing DATE1 and/or DATE2.");
-                goto finish;
-            }
-
-            if (varcnt == 1) {
-                const_interval = get_interval(&intv, vdef) == 0;
-                date0 = date1;  /* very first date */
-                logging(LOG_INFO,
-                        "Date of the first: %d-%02d-%02d %02d:%02d:%02d",
-                        date0.year, date0.mon, date0.day,
-                        date0.hour, date0.min, date0.sec);
-
-                if (var->timedepend == TIME_POINT
-                    && GT3_cmpDate2(&date1, &date2) != 0)
-                    logging(LOG_WARN,
-                            "'DATE2 - DATE1' must be zero"
-                            " for instantaneous data.");
-            }
-            if (varcnt > 1 && GT3_cmpDate2(&date0, &date1) != 0) {
-                logging(LOG_ERR, "mismatch the first date in %s.", fp->path);
-                goto finish;
-            }
-        }
+        t0 = stats_clock();
+        if (var->timedepend > 0
+            && check_first_date(&ts, &head, fp, vdef, var, varcnt == 1) < 0)
+            goto finish;
+        stats_add(STAGE_HEADER, t0, 0);
     } else {
         assert(vbuf != NULL);
         if (GT3_reattachVarbuf(vbuf, fp) < 0)
@@ -875,7 +1515,8 @@ convert(const char *varname, const char *path, int varcnt)
         if (stat == ITER_OUTRANGE)
             continue;
 
-        if (GT3_readHeader(&head, fp) < 0) {
+        t_step = t0 = stats_clock();
+        if (read_header(&head, fp) < 0) {
             GT3_printErrorMessages(stderr);
             goto finish;
         }
@@ -884,62 +1525,399 @@ convert(const char *varname, const char *path, int varcnt)
             logging(LOG_ERR, "Array shape has changed.");
             goto finish;
         }
+        if (var->timedepend > 0
+            && set_step_time(&ts, var, &head, fp) < 0)
+            goto finish;
+        stats_add(STAGE_HEADER, t0, 0);
 
-        if (var->timedepend > 0) {
-            if (const_interval) {
-                if (   cmp_date(&head, "DATE1", &date1) != 0
-                    || cmp_date(&head, "DATE2", &date2) != 0) {
+        if (convert_step(varid, var, vbuf, &head, ref_varid) < 0)
+            goto finish;
+        stats_add_step();
+        trace_span_arg("step", t_step, "chunk", fp->curr + 1);
+    }
+    rval = 0;
 
-                    logging(LOG_ERR, "invalid DATE[12] in %s (No.%d).",
-                            fp->path, fp->curr + 1);
-                    goto finish;
-                }
-            } else {
-                if (   GT3_decodeHeaderDate(&date1, &head, "DATE1") < 0
-                    || GT3_decodeHeaderDate(&date2, &head, "DATE2") < 0) {
-                    GT3_printErrorMessages(stderr);
-                    logging(LOG_ERR, "in %s (No.%d).", fp->path, fp->curr + 1);
-                    goto finish;
-                }
+finish:
+    GT3_close(fp);
+    return rval;
+}
+
+
+/*
+ * Batch mode (-x): convert several variables in a single pass.
+ *
+ * The input files of the variables must be aligned: the same number
+ * of files, and the same chunks (time steps) in each file.
+ * A variable which is a zfactor (ps, eta, depth) of the preceding
+ * ones is read once per time step, and written for each of them.
+ */
+#define MAX_BATCH 32
+
+struct batch_var {
+    char *name;
+    char **paths;
+    int npaths;
+    int max_paths;
+
+    cmor_var_def_t *vdef;
+    myvar_t *var;
+    GT3_Varbuf *vbuf;
+    GT3_File *fp;
+    int zfactor;                /* 1 if a zfactor */
+    int stats_idx;              /* record in stats.c */
+
+    /* main variable */
+    int varid;
+    int zfac_ids[16];
+    int nzfac;
+
+    /* zfactor: zfactor IDs and main variable IDs to be written */
+    int ref_zfac_ids[MAX_BATCH];
+    int ref_varids[MAX_BATCH];
+    int nrefs;
+};
+
+static struct batch_var batch[MAX_BATCH];
+static int nbatch = 0;
+
+
+int
+add_batch_var(const char *name)
+{
+    struct batch_var *bv;
+
+    if (nbatch == MAX_BATCH) {
+        logging(LOG_ERR, "too many variables in a batch (max: %d).",
+                MAX_BATCH);
+        return -1;
+    }
+    bv = batch + nbatch;
+    memset(bv, 0, sizeof(struct batch_var));
+    if ((bv->name = strdup(name)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    nbatch++;
+    return 0;
+}
+
+
+int
+add_batch_file(const char *path)
+{
+    struct batch_var *bv;
+
+    if (nbatch == 0) {
+        logging(LOG_ERR, "No variable name specified.");
+        return -1;
+    }
+    bv = batch + nbatch - 1;
+    if (bv->npaths == bv->max_paths) {
+        int newsize = bv->max_paths > 0 ? 2 * bv->max_paths : 16;
+        char **p;
+
+        if ((p = realloc(bv->paths, sizeof(char *) * newsize)) == NULL) {
+            logging(LOG_SYSERR, NULL);
+            return -1;
+        }
+        bv->paths = p;
+        bv->max_paths = newsize;
+    }
+    if ((bv->paths[bv->npaths] = strdup(path)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    bv->npaths++;
+    return 0;
+}
+
+
+/*
+ * Find the main variables which require 'bv' as a zfactor.
+ */
+static int
+link_zfactor(struct batch_var *bv, int nmain)
+{
+    int i, j, id;
+
+    bv->nrefs = 0;
+    for (i = 0; i < nmain; i++) {
+        if (batch[i].zfactor)
+            continue;
+
+        for (j = 0; j < batch[i].nzfac; j++) {
+            id = batch[i].zfac_ids[j];
+            if (strcmp(cmor_vars[id].id, bv->vdef->out_name) == 0) {
+                bv->ref_zfac_ids[bv->nrefs] = id;
+                bv->ref_varids[bv->nrefs] = batch[i].varid;
+                bv->nrefs++;
+                LOGGING(LOG_INFO, "use %s(id=%d) as zfactor of %s.",
+                        bv->name, id, batch[i].name);
+                break;
             }
-            var->timebnd[0] = get_time(&date1);
-            var->timebnd[1] = get_time(&date2);
+        }
+    }
+    return bv->nrefs;
+}
+
+
+/*
+ * Set up each variable with its first file (the chunk is 'curr').
+ */
+static int
+setup_batch_var(struct batch_var *bv, int idx, int curr,
+                struct time_state *ts)
+{
+    GT3_HEADER head;
+    double t0 = stats_clock();
+
+    if (seek_chunk(bv->fp, curr) < 0
+        || read_header(&head, bv->fp) < 0
+        || (bv->vbuf = GT3_getVarbuf(bv->fp)) == NULL) {
+        GT3_printErrorMessages(stderr);
+        return -1;
+    }
+    if (edit_header(&head) < 0 || (bv->var = new_var()) == NULL)
+        return -1;
+
+    /*
+     * A variable is a zfactor if one of the preceding variables
+     * requires it.
+     */
+    if (idx > 0 && (bv->vdef = lookup_formula_vardef(bv->name)) != NULL
+        && link_zfactor(bv, idx) > 0)
+        bv->zfactor = 1;
+    else if ((bv->vdef = lookup_vardef(bv->name)) == NULL) {
+        logging(LOG_ERR, "%s: No such variable in MIP table.", bv->name);
+        return -1;
+    }
+
+    bv->var->timedepend = check_timedependency(bv->vdef);
+    if (idx > 0 && bv->var->timedepend != batch[0].var->timedepend) {
+        logging(LOG_ERR, "%s: time dependency differs from %s.",
+                bv->name, batch[0].name);
+        return -1;
+    }
+
+    if (!bv->zfactor
+        && setup_main_variable(&bv->varid, bv->zfac_ids, &bv->nzfac,
+                               bv->vdef, bv->var, bv->vbuf, &head,
+                               bv->paths[0]) < 0)
+        return -1;
+
+    if (prepare_var(bv->var, bv->vbuf) < 0)
+        return -1;
 
-            if (var->timedepend == TIME_CLIM) {
-                GT3_Date date;
+    if (bv->var->timedepend > 0
+        && check_first_date(ts, &head, bv->fp, bv->vdef, bv->var,
+                            idx == 0) < 0)
+        return -1;
+    stats_add(STAGE_SETUP, t0, 0);
+    return 0;
+}
+
+
+/*
+ * Convert a time step of a variable other than the first one,
+ * whose chunk and dates must match those of the first one.
+ */
+static int
+convert_batch_step(struct batch_var *bv, int curr,
+                   const GT3_HEADER *head0)
+{
+    GT3_HEADER head;
+    GT3_Date date1, date2;
+    double t0 = stats_clock();
+    int i;
 
-                GT3_decodeHeaderDate(&date, &head, "DATE");
-                var->time = get_time(&date);
-            } else
-                var->time = .5 * (var->timebnd[0] + var->timebnd[1]);
+    stats_select(bv->stats_idx);
+    if (seek_chunk(bv->fp, curr) < 0
+        || read_header(&head, bv->fp) < 0) {
+        GT3_printErrorMessages(stderr);
+        return -1;
+    }
+    if (   bv->var->dimlen[0] != bv->fp->dimlen[0]
+        || bv->var->dimlen[1] != bv->fp->dimlen[1]) {
+        logging(LOG_ERR, "Array shape has changed.");
+        return -1;
+    }
+    if (bv->var->timedepend > 0) {
+        if (   GT3_decodeHeaderDate(&date1, head0, "DATE1") < 0
+            || GT3_decodeHeaderDate(&date2, head0, "DATE2") < 0) {
+            GT3_printErrorMessages(stderr);
+            return -1;
         }
+        if (   cmp_date(&head, "DATE1", &date1) != 0
+            || cmp_date(&head, "DATE2", &date2) != 0) {
+            logging(LOG_ERR, "mismatch DATE[12] in %s (No.%d).",
+                    bv->fp->path, curr + 1);
+            return -1;
+        }
+        bv->var->time = batch[0].var->time;
+        bv->var->timebnd[0] = batch[0].var->timebnd[0];
+        bv->var->timebnd[1] = batch[0].var->timebnd[1];
+    }
+    stats_add(STAGE_HEADER, t0, 0);
+
+    if (!bv->zfactor) {
+        if (convert_step(bv->varid, bv->var, bv->vbuf, &head, NULL) < 0)
+            return -1;
+        stats_add_step();
+        return 0;
+    }
+
+    /*
+     * zfactor: read once, and write for each main variable.
+     */
+    if (read_eval_var(bv->var, bv->vbuf) < 0)
+        return -1;
+
+    for (i = 0; i < bv->nrefs; i++)
+        if (write_var(bv->ref_zfac_ids[i], bv->var,
+                      bv->ref_varids + i) < 0)
+            return -1;
+    stats_add_step();
+    return 0;
+}
+
+
+static void
+free_batch(void)
+{
+    int i, j;
+
+    for (i = 0; i < nbatch; i++) {
+        if (batch[i].fp)
+            GT3_close(batch[i].fp);
+        GT3_freeVarbuf(batch[i].vbuf);
+        free_var(batch[i].var);
+        free(batch[i].var);
+        for (j = 0; j < batch[i].npaths; j++)
+            free(batch[i].paths[j]);
+        free(batch[i].paths);
+        free(batch[i].name);
+    }
+    nbatch = 0;
+}
 
-        if (axis_slice[2])
-            rewindSeq(axis_slice[2]);
 
-        if (read_var(var, vbuf, axis_slice[2]) < 0
-            || (calc_expression && eval_calc(calc_expression,
-                                             var->data,
-                                             vbuf->miss,
-                                             var->nelems) < 0)
-            || write_var(varid, var, ref_varid) < 0) {
+int
+convert_batch(void)
+{
+    struct time_state ts;
+    struct file_iterator it;
+    GT3_HEADER head;
+    struct batch_var *bv0 = batch;
+    int i, k, stat, curr;
+    int rval = -1;
+    double t0, t_step;
+
+    if (nbatch == 0)
+        return 0;
+
+    for (i = 1; i < nbatch; i++)
+        if (batch[i].npaths != bv0->npaths) {
+            logging(LOG_ERR, "%s: %d file(s), but %s: %d file(s).",
+                    batch[i].name, batch[i].npaths,
+                    bv0->name, bv0->npaths);
             goto finish;
         }
 
-        if (var->timedepend > 0 && const_interval) {
-            step_time(&date1, &intv);
-            step_time(&date2, &intv);
+    for (i = 0; i < nbatch; i++)
+        batch[i].stats_idx = stats_begin_var(batch[i].name);
+
+    for (k = 0; k < bv0->npaths; k++) {
+        for (i = 0; i < nbatch; i++) {
+            LOGGING(LOG_INFO, "input file: (%s)", batch[i].paths[k]);
+            stats_select(batch[i].stats_idx);
+            t0 = stats_clock();
+            if ((batch[i].fp = open_input(batch[i].paths[k])) == NULL)
+                goto finish;
+            stats_add(STAGE_OPEN, t0, 0);
+        }
+
+        /*
+         * The first variable drives the iteration (and time slicing).
+         */
+        if (time_seq)
+            reinitSeq(time_seq, 1, 0x7fffffff);
+        setup_file_iterator(&it, bv0->fp, time_seq);
+
+        if (k == 0) {
+            while ((stat = iterate_file(&it)) == ITER_OUTRANGE)
+                ;
+            if (stat != ITER_CONTINUE) {
+                logging(LOG_ERR, "No data in %s.", bv0->paths[0]);
+                goto finish;
+            }
+            curr = bv0->fp->curr;
+            for (i = 0; i < nbatch; i++) {
+                stats_select(batch[i].stats_idx);
+                if (setup_batch_var(batch + i, i, curr, &ts) < 0)
+                    goto finish;
+            }
+        } else {
+            for (i = 0; i < nbatch; i++)
+                if (GT3_reattachVarbuf(batch[i].vbuf, batch[i].fp) < 0)
+                    goto finish;
+        }
+
+        rewind_file_iterator(&it);
+        while ((stat = iterate_file(&it)) != ITER_END) {
+            if (stat == ITER_ERROR || stat == ITER_ERRORCHUNK)
+                goto finish;
+            if (stat == ITER_OUTRANGE)
+                continue;
+
+            stats_select(bv0->stats_idx);
+            t_step = t0 = stats_clock();
+            if (read_header(&head, bv0->fp) < 0) {
+                GT3_printErrorMessages(stderr);
+                goto finish;
+            }
+            if (   bv0->var->dimlen[0] != bv0->fp->dimlen[0]
+                || bv0->var->dimlen[1] != bv0->fp->dimlen[1]) {
+                logging(LOG_ERR, "Array shape has changed.");
+                goto finish;
+            }
+            if (bv0->var->timedepend > 0
+                && set_step_time(&ts, bv0->var, &head, bv0->fp) < 0)
+                goto finish;
+            stats_add(STAGE_HEADER, t0, 0);
+
+            if (convert_step(bv0->varid, bv0->var, bv0->vbuf,
+                             &head, NULL) < 0)
+                goto finish;
+            stats_add_step();
+
+            curr = bv0->fp->curr;
+            for (i = 1; i < nbatch; i++)
+                if (convert_batch_step(batch + i, curr, &head) < 0)
+                    goto finish;
+            trace_span_arg("step", t_step, "chunk", curr + 1);
+        }
+
+        for (i = 0; i < nbatch; i++) {
+            GT3_close(batch[i].fp);
+            batch[i].fp = NULL;
         }
     }
+
+    /* stage out each file while the others are being closed. */
+    for (i = 0; i < nbatch; i++)
+        if (!batch[i].zfactor && stage_variable(batch[i].varid) < 0)
+            goto finish;
     rval = 0;
 
 finish:
-    GT3_close(fp);
+    free_batch();
     return rval;
 }
 
 
 #ifdef TEST_MAIN2
+#include <unistd.h>
+
 int
 test_converter(void)
 {
@@ -950,6 +1928,64 @@ test_converter(void)
     tdep = check_timedependency(vdef);
     assert(tdep == TIME_MEAN);
 
+    /* =c and =H are kept at a new variable in batch mode (-x). */
+    {
+        char path[] = "/tmp/sdbXXXXXX";
+        char buf[17], *value;
+        GT3_HEADER head;
+        FILE *fp;
+        int fd;
+
+        assert((fd = mkstemp(path)) >= 0);
+        fp = fdopen(fd, "w");
+        fprintf(fp, "comment  none\n");
+        fclose(fp);
+
+        assert(sdb_open(path) == 0);
+        assert(set_header_edit("item:CLDFRC") == 0);
+        unset_var_options(1);
+        value = sdb_readitem("comment");
+        assert(value && strcmp(value, "none") == 0);
+        free(value);
+        GT3_initHeader(&head);
+        assert(edit_header(&head) == 0);
+        GT3_copyHeaderItem(buf, sizeof buf, &head, "ITEM");
+        assert(strcmp(buf, "CLDFRC") == 0);
+
+        unset_var_options(0);
+        assert(sdb_readitem("comment") == NULL);
+        GT3_initHeader(&head);
+        assert(edit_header(&head) == 0);
+        GT3_copyHeaderItem(buf, sizeof buf, &head, "ITEM");
+        assert(strcmp(buf, "CLDFRC") != 0);
+
+        unlink(path);
+        sdb_free();
+    }
+
+    /* --mem-limit: slabs for sites (or with -F). */
+    {
+        site_locations dummy;
+        myvar_t var;
+        int shape[] = { 1024, 1024, 8 };
+
+        memset(&var, 0, sizeof var);
+        memcpy(var.dimlen, shape, sizeof shape);
+        assert(set_mem_limit((int)(mem_rss() >> 20) + 1) == 0);
+
+        fit_mem_limit(shape);
+        assert(slab_budget == 0);   /* neither sites nor -F */
+
+        sites = &dummy;
+        fit_mem_limit(shape);
+        assert(slab_budget > 0 && slab_available(0, &var, NULL));
+
+        assert(set_mem_limit(0) == 0);
+        fit_mem_limit(shape);
+        assert(slab_budget == 0 && !slab_available(0, &var, NULL));
+        sites = NULL;
+    }
+
     printf("test_converter(): DONE\n");
     return 0;
 }
@@ -4,9 +4,13 @@
  * utilities for coordinates.
  */
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
+#include "logging.h"
+#include "internal.h"
+
 #define RAD2DEG(x) (180. * (x) / M_PI)
 #define DEG2RAD(x) (M_PI * (x) / 180.)
 
@@ -209,27 +213,6 @@ M3_mulV3(V3 u, M3 ma, V3 v)
 }
 
 
-/*
- * set pos(in Cartesian coordinates) from longitude/latitude in degrees.
- */
-static void
-set_lonlat(V3 pos, double lon, double lat)
-{
-    if (lat >= 90.) {
-        pos[0] = pos[1] = 0.;
-        pos[2] = 1.;
-    } else if (lat <= -90.) {
-        pos[0] = pos[1] = 0.;
-        pos[2] = -1.;
-    } else {
-        pos[0] = pos[1] = degcos(lat);
-        pos[2] = degsin(lat);
-    }
-    pos[0] *= degcos(lon);
-    pos[1] *= degsin(lon);
-}
-
-
 /*
  * Cartesian (x, y, z) => (lon, lat).
  * "x**2 + y**2 + z**2 == 1" is assumed.
@@ -273,6 +256,51 @@ get_lonlat(double *lon, double *lat, V3 v)
 }
 
 
+/*
+ * cos/sin of latitude (the poles are exact).
+ */
+static void
+lat_factors(double *c, double *s, double lat)
+{
+    if (lat >= 90.) {
+        *c = 0.;
+        *s = 1.;
+    } else if (lat <= -90.) {
+        *c = 0.;
+        *s = -1.;
+    } else {
+        *c = degcos(lat);
+        *s = degsin(lat);
+    }
+}
+
+
+/*
+ * Rotate a row of points, whose longitudes are given by
+ * (clon[i], slon[i]) = (cos(rlon[i]), sin(rlon[i])), and latitude
+ * by (clat, slat).
+ *
+ * This gives the same result as rotating each point separately,
+ * bit by bit.
+ */
+static void
+rotate_row(double *lon, double *lat,
+           const double *clon, const double *slon, int nlon,
+           double clat, double slat, M3 mat)
+{
+    V3 rpos, pos;
+    int i;
+
+    for (i = 0; i < nlon; i++) {
+        rpos[0] = clat * clon[i];
+        rpos[1] = clat * slon[i];
+        rpos[2] = slat;
+        M3_mulV3(pos, mat, rpos);
+        get_lonlat(lon + i, lat + i, pos);
+    }
+}
+
+
 /*
  * get true logitude/latitude from rotated longitude/latitude.
  *
@@ -295,9 +323,10 @@ rotate_lonlat(double *lon, double *lat,
               int nlon, int nlat,
               double phi, double theta, double psi)
 {
-    int i, j, n;
     M3 mat, m1, m2, m3, m4;
-    V3 rpos, pos;
+    double *clon = NULL, *slon = NULL;
+    double clat, slat;
+    int i, j, rval = -1;
 
     make_Rz(m1, phi);
     make_Ry(m2, theta);
@@ -306,21 +335,58 @@ rotate_lonlat(double *lon, double *lat,
     M3_mul(m4, m1, m2);
     M3_mul(mat, m4, m3);
 
-    for (j = 0; j < nlat; j++)
-        for (i = 0; i < nlon; i++) {
-            set_lonlat(rpos, rlon[i], rlat[j]);
-            M3_mulV3(pos, mat, rpos);
+    if ((clon = malloc(sizeof(double) * nlon)) == NULL
+        || (slon = malloc(sizeof(double) * nlon)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+    for (i = 0; i < nlon; i++) {
+        clon[i] = degcos(rlon[i]);
+        slon[i] = degsin(rlon[i]);
+    }
 
-            n = i + j * nlon;
-            get_lonlat(lon + n, lat + n, pos);
-        }
-    return 0;
+#ifdef _OPENMP
+#pragma omp parallel for private(clat, slat) schedule(static)
+#endif
+    for (j = 0; j < nlat; j++) {
+        lat_factors(&clat, &slat, rlat[j]);
+        rotate_row(lon + nlon * j, lat + nlon * j,
+                   clon, slon, nlon, clat, slat, mat);
+    }
+    rval = 0;
+
+finish:
+    free(slon);
+    free(clon);
+    return rval;
 }
 
 
 #ifdef TEST_MAIN2
 #include <stdio.h>
 
+
+/*
+ * set pos(in Cartesian coordinates) from longitude/latitude in degrees.
+ */
+static void
+set_lonlat(V3 pos, double lon, double lat)
+{
+    if (lat >= 90.) {
+        pos[0] = pos[1] = 0.;
+        pos[2] = 1.;
+    } else if (lat <= -90.) {
+        pos[0] = pos[1] = 0.;
+        pos[2] = -1.;
+    } else {
+        pos[0] = pos[1] = degcos(lat);
+        pos[2] = degsin(lat);
+    }
+    pos[0] *= degcos(lon);
+    pos[1] *= degsin(lon);
+}
+
+
 static void
 M3_print(M3 ma, const char *name)
 {
@@ -575,6 +641,62 @@ test7(void)
 }
 
 
+/*
+ * rotate_lonlat() point by point (reference).
+ */
+static int
+rotate_lonlat_ref(double *lon, double *lat,
+              const double *rlon, const double *rlat,
+              int nlon, int nlat,
+              double phi, double theta, double psi)
+{
+    int i, j, n;
+    M3 mat, m1, m2, m3, m4;
+    V3 rpos, pos;
+
+    make_Rz(m1, phi);
+    make_Ry(m2, theta);
+    make_Rz(m3, psi);
+
+    M3_mul(m4, m1, m2);
+    M3_mul(mat, m4, m3);
+
+    for (j = 0; j < nlat; j++)
+        for (i = 0; i < nlon; i++) {
+            set_lonlat(rpos, rlon[i], rlat[j]);
+            M3_mulV3(pos, mat, rpos);
+
+            n = i + j * nlon;
+            get_lonlat(lon + n, lat + n, pos);
+        }
+    return 0;
+}
+
+
+/*
+ * rotate_lonlat() must be identical to rotate_lonlat_ref().
+ */
+static void
+test8(void)
+{
+    double rlon[73], rlat[37];
+    double lon[73 * 37], lat[73 * 37];
+    double lon2[73 * 37], lat2[73 * 37];
+    int i;
+
+    for (i = 0; i < 73; i++)
+        rlon[i] = -180. + 5. * i;
+    for (i = 0; i < 37; i++)
+        rlat[i] = -90. + 5. * i;
+
+    rotate_lonlat(lon, lat, rlon, rlat, 73, 37, -40., 13., 90.);
+    rotate_lonlat_ref(lon2, lat2, rlon, rlat, 73, 37, -40., 13., 90.);
+
+    assert(memcmp(lon, lon2, sizeof lon) == 0);
+    assert(memcmp(lat, lat2, sizeof lat) == 0);
+}
+
+
 int
 test_coord(void)
 {
@@ -588,6 +710,7 @@ test_coord(void)
     test5();
     test6();
     test7();
+    test8();
 
     printf("test_coord(): DONE\n");
     return 0;
@@ -0,0 +1,231 @@
+/*
+ * dimcache.c -- in-process cache of axes (GT3_Dim and GT3_DimBound).
+ *
+ * The same GTAXLOC files are loaded for every variable (and several
+ * times for a variable). Loaded axes are kept in an LRU cache keyed
+ * by name, and handed out as read-only views. A view must be returned
+ * by release_dim()/release_dimbound(); callers which modify values
+ * have to make their own copy.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtool3.h"
+#include "logging.h"
+#include "internal.h"
+#include "myutils.h"
+
+#define DIMCACHE_SIZE 32
+
+enum { DIM, DIMBOUND };
+
+struct dim_entry {
+    char name[17];
+    int kind;
+    void *ptr;                  /* GT3_Dim * or GT3_DimBound * */
+    int refcnt;
+    unsigned long last_used;
+};
+
+static struct dim_entry cache[DIMCACHE_SIZE];
+static int nentries = 0;
+static unsigned long clock_ = 0;
+
+/* statistics */
+static unsigned num_hits = 0;
+static unsigned num_loads = 0;
+
+
+static void
+free_entry_ptr(int kind, void *ptr)
+{
+    if (kind == DIM)
+        GT3_freeDim(ptr);
+    else
+        GT3_freeDimBound(ptr);
+}
+
+
+static struct dim_entry *
+lookup_entry(const char *name, int kind)
+{
+    int i;
+
+    for (i = 0; i < nentries; i++)
+        if (cache[i].kind == kind && strcmp(cache[i].name, name) == 0)
+            return cache + i;
+    return NULL;
+}
+
+
+/*
+ * Return a free slot, evicting the least recently used entry
+ * which is not in use. NULL if all the entries are in use.
+ */
+static struct dim_entry *
+free_slot(void)
+{
+    struct dim_entry *victim = NULL;
+    int i;
+
+    if (nentries < DIMCACHE_SIZE)
+        return cache + nentries++;
+
+    for (i = 0; i < nentries; i++)
+        if (cache[i].refcnt == 0
+            && (victim == NULL || cache[i].last_used < victim->last_used))
+            victim = cache + i;
+
+    if (victim) {
+        free_entry_ptr(victim->kind, victim->ptr);
+        victim->ptr = NULL;
+    }
+    return victim;
+}
+
+
+static void *
+get_cached(const char *name, int kind)
+{
+    struct dim_entry *ent;
+    void *ptr;
+
+    if ((ent = lookup_entry(name, kind)) != NULL) {
+        ent->refcnt++;
+        ent->last_used = ++clock_;
+        num_hits++;
+        return ent->ptr;
+    }
+
+    if (kind == DIM) {
+        if ((ptr = bundle_dim(name)) == NULL) {
+            double t0 = stats_clock();
+
+            ptr = GT3_getDim(name);
+            io_account(IO_AXIS, IO_READ, name,
+                       ptr ? sizeof(double) * ((GT3_Dim *)ptr)->len : 0, t0);
+            if (ptr == NULL)
+                return NULL;
+        }
+    } else {
+        if ((ptr = get_dimbound(name)) == NULL)
+            return NULL;
+    }
+    num_loads++;
+
+    /* if the cache is full of views in use, the caller owns it. */
+    if ((ent = free_slot()) == NULL)
+        return ptr;
+
+    strlcpy(ent->name, name, sizeof ent->name);
+    ent->kind = kind;
+    ent->ptr = ptr;
+    ent->refcnt = 1;
+    ent->last_used = ++clock_;
+    return ptr;
+}
+
+
+static void
+release_cached(const void *ptr, int kind)
+{
+    int i;
+
+    if (ptr == NULL)
+        return;
+
+    for (i = 0; i < nentries; i++)
+        if (cache[i].ptr == ptr) {
+            cache[i].refcnt--;
+            return;
+        }
+
+    /* not cached. */
+    free_entry_ptr(kind, (void *)ptr);
+}
+
+
+/*
+ * Return a read-only view of axis 'name', or NULL on error
+ * (error messages of libgtool3 are not printed).
+ */
+const GT3_Dim *
+get_dim(const char *name)
+{
+    return get_cached(name, DIM);
+}
+
+
+void
+release_dim(const GT3_Dim *dim)
+{
+    release_cached(dim, DIM);
+}
+
+
+/*
+ * get_dimbound() with the cache.
+ */
+const GT3_DimBound *
+get_cached_dimbound(const char *name)
+{
+    return get_cached(name, DIMBOUND);
+}
+
+
+void
+release_dimbound(const GT3_DimBound *bnd)
+{
+    release_cached(bnd, DIMBOUND);
+}
+
+
+void
+clear_dim_cache(void)
+{
+    int i;
+
+    if (num_loads > 0)
+        logging(LOG_INFO, "axis cache: %u load(s), %u hit(s)",
+                num_loads, num_hits);
+
+    for (i = 0; i < nentries; i++) {
+        if (cache[i].refcnt > 0)
+            logging(LOG_WARN, "%s: axis still in use.", cache[i].name);
+        free_entry_ptr(cache[i].kind, cache[i].ptr);
+    }
+    nentries = 0;
+    num_hits = num_loads = 0;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+
+int
+test_dimcache(void)
+{
+    const GT3_Dim *dim, *dim2;
+    const GT3_DimBound *bnd;
+
+    dim = get_dim("GGLA64");
+    assert(dim && dim->len == 64);
+    dim2 = get_dim("GGLA64");
+    assert(dim2 == dim);
+    assert(num_loads == 1 && num_hits == 1);
+
+    bnd = get_cached_dimbound("GGLA64");
+    assert(bnd && bnd->len == 65);
+    release_dimbound(bnd);
+
+    release_dim(dim2);
+    release_dim(dim);
+    assert(lookup_entry("GGLA64", DIM)->refcnt == 0);
+
+    clear_dim_cache();
+    assert(nentries == 0);
+    printf("test_dimcache(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
@@ -0,0 +1,688 @@
+/*
+ * fastwrite.c -- write time steps directly to netCDF.
+ *
+ * The first cmor_write() for a variable creates the output file with
+ * all the metadata. After that, cmor_write() repeats the same work
+ * (reordering, unit checks, range checks and so on) for every time
+ * step. In fast-write mode, the following time steps are written
+ * by nc_put_vara_float() into the variable that CMOR has defined.
+ *
+ * XXX: This depends on the internal of CMOR (as cmor_supp.c does).
+ *
+ * A time step is handed back to cmor_write() whenever it might be
+ * treated differently by CMOR (out of valid range, non-monotonic
+ * time, and so on), so that the output is identical to that of
+ * the normal path.
+ */
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "netcdf.h"
+
+#include "cmor.h"
+#include "logging.h"
+#include "internal.h"
+
+static int fast_write_mode = 0;
+
+/*
+ * Eligibility of each variable.
+ */
+enum {
+    FW_UNKNOWN = 0,
+    FW_ELIGIBLE,
+    FW_INELIGIBLE
+};
+static unsigned char fw_status[CMOR_MAX_VARIABLES];
+
+/*
+ * Shape of the variable except for time-axis (slowest first).
+ */
+static int fw_ndims[CMOR_MAX_VARIABLES];
+static int fw_shape[CMOR_MAX_VARIABLES][CMOR_MAX_DIMENSIONS];
+static int fw_revert[CMOR_MAX_VARIABLES][CMOR_MAX_DIMENSIONS];
+
+static float *fw_buf = NULL;
+static size_t fw_buf_capacity = 0;
+
+/*
+ * As in CMOR, a value within this relative tolerance of the missing
+ * value is taken as missing.
+ */
+#define MISS_RTOL 1e-4f
+
+
+void
+set_fast_write(void)
+{
+    fast_write_mode = 1;
+}
+
+
+int
+fast_write_enabled(void)
+{
+    return fast_write_mode;
+}
+
+
+static int
+check_eligibility(int var_id, size_t nelems)
+{
+    cmor_var_t *var = cmor_vars + var_id;
+    cmor_axis_t *axis;
+    size_t num = 1;
+    int i, n;
+
+    if (var->ndims < 1 || var->ndims > CMOR_MAX_DIMENSIONS)
+        return FW_INELIGIBLE;
+
+    /* unit conversion is done by CMOR. */
+    if (strcmp(var->iunits, var->ounits) != 0) {
+        LOGGING(LOG_INFO, "fast-write: disabled (units: %s -> %s)",
+                var->iunits, var->ounits);
+        return FW_INELIGIBLE;
+    }
+
+    /* time-axis must be the first (the slowest). */
+    if (cmor_axes[var->axes_ids[0]].axis != 'T')
+        return FW_INELIGIBLE;
+
+    for (i = 1, n = 0; i < var->ndims; i++, n++) {
+        /* axes reordered by CMOR. */
+        if (var->original_order[i] != var->axes_ids[i])
+            return FW_INELIGIBLE;
+
+        axis = cmor_axes + var->axes_ids[i];
+        if (axis->offset != 0) {
+            LOGGING(LOG_INFO, "fast-write: disabled (offset in %s)",
+                    axis->id);
+            return FW_INELIGIBLE;
+        }
+        fw_shape[var_id][n] = axis->length;
+        fw_revert[var_id][n] = axis->revert == -1;
+        num *= axis->length;
+    }
+    fw_ndims[var_id] = n;
+
+    if (n == 0 || num != nelems) {
+        LOGGING(LOG_INFO, "fast-write: disabled (shape mismatch)");
+        return FW_INELIGIBLE;
+    }
+    LOGGING(LOG_INFO, "fast-write: enabled for %s", var->id);
+    return FW_ELIGIBLE;
+}
+
+
+/*
+ * Return 1 if 'var_id' can be written by fast_write().
+ * It becomes ready after the first cmor_write() for the variable.
+ */
+int
+fast_write_ready(int var_id, size_t nelems)
+{
+    if (!fast_write_mode || var_id < 0 || var_id >= CMOR_MAX_VARIABLES)
+        return 0;
+
+    if (fw_status[var_id] == FW_UNKNOWN) {
+        if (cmor_vars[var_id].initialized == -1
+            || cmor_vars[var_id].ntimes_written < 1)
+            return 0;           /* not yet written by CMOR */
+
+        fw_status[var_id] = check_eligibility(var_id, nelems);
+    }
+    return fw_status[var_id] == FW_ELIGIBLE;
+}
+
+
+static float
+miss_tolerance(float miss)
+{
+    return MISS_RTOL * fabsf(miss);
+}
+
+
+/*
+ * Scan the range of non-missing values.
+ * Return the number of non-missing values.
+ */
+static size_t
+scan_range(float *vmin, float *vmax,
+           const float *values, size_t nelems, float miss)
+{
+    float lo = HUGE_VALF, hi = -HUGE_VALF;
+    float tol = miss_tolerance(miss);
+    size_t i, cnt = 0;
+
+    /* branchless, so that it can be vectorized. */
+    for (i = 0; i < nelems; i++) {
+        float v = values[i];
+        int ok = !(fabsf(v - miss) <= tol);
+
+        lo = (ok && v < lo) ? v : lo;
+        hi = (ok && v > hi) ? v : hi;
+        cnt += ok;
+    }
+    *vmin = lo;
+    *vmax = hi;
+    return cnt;
+}
+
+
+/*
+ * Copy 'src' into 'dest' with the same transformation as CMOR:
+ * reverting axes, substituting the missing value, and sign.
+ */
+static void
+transform_values(float *dest, const float *src,
+                 int ndims, const int *shape, const int *revert,
+                 float miss, float omiss, float sign)
+{
+    size_t idx[CMOR_MAX_DIMENSIONS];
+    size_t n, m, nelems, stride;
+    float tol = miss_tolerance(miss);
+    int i, last;
+
+    nelems = 1;
+    for (i = 0; i < ndims; i++) {
+        idx[i] = 0;
+        nelems *= shape[i];
+    }
+
+    /*
+     * The innermost axis is processed as a whole line.
+     */
+    last = ndims - 1;
+    for (n = 0; n < nelems; n += shape[last]) {
+        m = 0;
+        stride = 1;
+        for (i = last; i >= 0; i--) {
+            if (i < last)
+                m += stride * (revert[i] ? shape[i] - 1 - idx[i] : idx[i]);
+            stride *= shape[i];
+        }
+
+        if (revert[last]) {
+            for (i = 0; i < shape[last]; i++) {
+                float v = src[n + shape[last] - 1 - i];
+
+                dest[m + i] = (fabsf(v - miss) <= tol) ? omiss : sign * v;
+            }
+        } else {
+            for (i = 0; i < shape[last]; i++) {
+                float v = src[n + i];
+
+                dest[m + i] = (fabsf(v - miss) <= tol) ? omiss : sign * v;
+            }
+        }
+
+        /* increment index (except for the innermost). */
+        for (i = last - 1; i >= 0; i--) {
+            if (++idx[i] < shape[i])
+                break;
+            idx[i] = 0;
+        }
+    }
+}
+
+
+/*
+ * Return the length of the slowest axis except for time-axis,
+ * or 0 if the variable is not ready for fast_write_slab().
+ */
+int
+fast_write_nlevels(int var_id)
+{
+    if (var_id < 0 || var_id >= CMOR_MAX_VARIABLES
+        || fw_status[var_id] != FW_ELIGIBLE || fw_ndims[var_id] < 2)
+        return 0;
+
+    return fw_shape[var_id][0];
+}
+
+
+static int
+is_monotonic(const cmor_var_t *var, const double *time, const double *tbnd)
+{
+    return time != NULL && *time > var->last_time
+        && !(tbnd && (tbnd[0] > tbnd[1] || tbnd[0] < var->last_bound));
+}
+
+
+/*
+ * Return 1 if some values seem out of valid range.
+ */
+static int
+out_of_range(const cmor_var_t *var, const float *values, size_t nelems)
+{
+    size_t cnt;
+    float vmin, vmax;
+
+    cnt = scan_range(&vmin, &vmax, values, nelems, (float)var->missing);
+    if (var->sign == -1) {
+        float temp = -vmax;
+
+        vmax = -vmin;
+        vmin = temp;
+    }
+    return cnt > 0
+        && ((var->valid_min != 1.e20f && vmin < var->valid_min)
+            || (var->valid_max != 1.e20f && vmax > var->valid_max));
+}
+
+
+static int
+reserve_buf(size_t nelems)
+{
+    float *ptr;
+
+    if (nelems <= fw_buf_capacity)
+        return 0;
+
+    bufpool_put(fw_buf);
+    fw_buf = NULL;
+    fw_buf_capacity = 0;
+    if ((ptr = bufpool_get(sizeof(float) * nelems)) == NULL)
+        return -1;
+    fw_buf = ptr;
+    fw_buf_capacity = nelems;
+    return 0;
+}
+
+
+/*
+ * Write values of a hyperslab, and time (if it is the last one).
+ */
+static int
+put_values(int var_id, const size_t *start, const size_t *count,
+           int last, const double *time, const double *tbnd)
+{
+    cmor_var_t *var = cmor_vars + var_id;
+    size_t tstart[2], tcount[2];
+    int ncid, status;
+
+    ncid = var->initialized;
+    status = nc_put_vara_float(ncid, var->nc_var_id, start, count, fw_buf);
+    if (status == NC_NOERR && last) {
+        tstart[0] = start[0];
+        tstart[1] = 0;
+        tcount[0] = 1;
+        tcount[1] = 2;
+        status = nc_put_vara_double(ncid, var->time_nc_id,
+                                    tstart, tcount, time);
+        if (status == NC_NOERR && tbnd && var->time_bnds_nc_id != -1)
+            status = nc_put_vara_double(ncid, var->time_bnds_nc_id,
+                                        tstart, tcount, tbnd);
+    }
+    if (status != NC_NOERR) {
+        logging(LOG_ERR, "fast-write: %s", nc_strerror(status));
+        return -1;
+    }
+
+    if (last) {
+        var->ntimes_written++;
+        var->last_time = *time;
+        if (tbnd)
+            var->last_bound = tbnd[1];
+    }
+    return 0;
+}
+
+
+/*
+ * Return values:
+ *    0: written.
+ *    1: not written (use cmor_write() instead).
+ *   -1: error.
+ */
+int
+fast_write(int var_id, const float *values, size_t nelems,
+           const double *time, const double *tbnd)
+{
+    cmor_var_t *var = cmor_vars + var_id;
+    size_t start[CMOR_MAX_DIMENSIONS], count[CMOR_MAX_DIMENSIONS];
+    int i;
+
+    assert(fw_status[var_id] == FW_ELIGIBLE);
+
+    /*
+     * If time or values seem suspicious, let CMOR check (and report) them.
+     */
+    if (!is_monotonic(var, time, tbnd)
+        || out_of_range(var, values, nelems))
+        return 1;
+
+    if (reserve_buf(nelems) < 0)
+        return -1;
+
+    transform_values(fw_buf, values,
+                     fw_ndims[var_id], fw_shape[var_id], fw_revert[var_id],
+                     (float)var->missing, (float)var->omissing,
+                     var->sign == -1 ? -1.f : 1.f);
+
+    start[0] = var->ntimes_written;
+    count[0] = 1;
+    for (i = 0; i < fw_ndims[var_id]; i++) {
+        start[i + 1] = 0;
+        count[i + 1] = fw_shape[var_id][i];
+    }
+    return put_values(var_id, start, count, 1, time, tbnd);
+}
+
+
+/*
+ * Write z-levels ['lev0', 'lev0' + 'nlev') of a time step (in the
+ * order of input). Time is written with the last z-level.
+ *
+ * Unlike fast_write(), this cannot fall back to cmor_write(),
+ * so that suspicious values are only reported.
+ */
+int
+fast_write_slab(int var_id, const float *values, int lev0, int nlev,
+                const double *time, const double *tbnd)
+{
+    cmor_var_t *var = cmor_vars + var_id;
+    size_t start[CMOR_MAX_DIMENSIONS], count[CMOR_MAX_DIMENSIONS];
+    int shape[CMOR_MAX_DIMENSIONS];
+    int *revert = fw_revert[var_id];
+    int i, ndims, nlevels;
+    size_t nelems;
+
+    assert(fast_write_nlevels(var_id) > 0);
+
+    ndims = fw_ndims[var_id];
+    nlevels = fw_shape[var_id][0];
+    assert(lev0 >= 0 && nlev > 0 && lev0 + nlev <= nlevels);
+
+    if (lev0 == 0 && !is_monotonic(var, time, tbnd)) {
+        logging(LOG_ERR, "fast-write: time is not monotonic.");
+        return -1;
+    }
+
+    nelems = nlev;
+    shape[0] = nlev;
+    for (i = 1; i < ndims; i++) {
+        shape[i] = fw_shape[var_id][i];
+        nelems *= shape[i];
+    }
+
+    if (out_of_range(var, values, nelems))
+        logging(LOG_WARN, "%s: some values out of valid range.", var->id);
+
+    if (reserve_buf(nelems) < 0)
+        return -1;
+
+    transform_values(fw_buf, values, ndims, shape, revert,
+                     (float)var->missing, (float)var->omissing,
+                     var->sign == -1 ? -1.f : 1.f);
+
+    start[0] = var->ntimes_written;
+    count[0] = 1;
+    start[1] = revert[0] ? nlevels - lev0 - nlev : lev0;
+    count[1] = nlev;
+    for (i = 1; i < ndims; i++) {
+        start[i + 1] = 0;
+        count[i + 1] = shape[i];
+    }
+    return put_values(var_id, start, count, lev0 + nlev == nlevels,
+                      time, tbnd);
+}
+
+
+#ifdef TEST_MAIN2
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+ * Compare transform_values() with a straightforward implementation.
+ */
+static void
+test1(int nz, int ny, int nx, int rev_z, int rev_y, int rev_x)
+{
+    int shape[3], revert[3];
+    float src[4 * 5 * 6], dest[4 * 5 * 6];
+    int i, j, k, ii, jj, kk;
+
+    assert(nx * ny * nz <= 4 * 5 * 6);
+    shape[0] = nz;
+    shape[1] = ny;
+    shape[2] = nx;
+    revert[0] = rev_z;
+    revert[1] = rev_y;
+    revert[2] = rev_x;
+
+    /* including values near the missing value. */
+    for (i = 0; i < nx * ny * nz; i++)
+        src[i] = (i % 7 == 3) ? -999.f
+            : (i % 7 == 5) ? -999.05f
+            : (i % 7 == 6) ? -999.2f
+            : (float)i;
+
+    transform_values(dest, src, 3, shape, revert, -999.f, 1e20f, -1.f);
+
+    for (k = 0; k < nz; k++)
+        for (j = 0; j < ny; j++)
+            for (i = 0; i < nx; i++) {
+                float v = src[i + nx * (j + ny * k)];
+
+                ii = rev_x ? nx - 1 - i : i;
+                jj = rev_y ? ny - 1 - j : j;
+                kk = rev_z ? nz - 1 - k : k;
+                assert(dest[ii + nx * (jj + ny * kk)]
+                       == (fabs(v + 999.) <= 1e-4 * 999. ? 1e20f : -v));
+            }
+}
+
+
+static void
+test2(void)
+{
+    float v[] = { 1.f, -999.f, -3.f, 2.f, -999.05f };
+    float w[] = { 1e20f, 1.00001e20f, 0.99999e20f, 5.f, 1.1e20f };
+    float vmin, vmax;
+    size_t cnt;
+
+    cnt = scan_range(&vmin, &vmax, v, 5, -999.f);
+    assert(cnt == 3);
+    assert(vmin == -3.f);
+    assert(vmax == 2.f);
+
+    cnt = scan_range(&vmin, &vmax, w, 5, 1e20f);
+    assert(cnt == 2);
+    assert(vmin == 5.f);
+    assert(vmax == 1.1e20f);
+}
+
+
+/*
+ * Writing by slabs must be identical to writing at once.
+ */
+static void
+test3(int nlev, int rev_z)
+{
+    int shape[] = { 7, 3, 2 }, revert[3], sshape[3];
+    float src[7 * 3 * 2], whole[7 * 3 * 2], dest[7 * 3 * 2];
+    int i, z, n, start, nxy = 3 * 2;
+
+    revert[0] = rev_z;
+    revert[1] = 1;
+    revert[2] = 0;
+    for (i = 0; i < 7 * 3 * 2; i++)
+        src[i] = (float)i;
+
+    transform_values(whole, src, 3, shape, revert, -999.f, 1e20f, 1.f);
+
+    for (z = 0; z < shape[0]; z += n) {
+        n = shape[0] - z < nlev ? shape[0] - z : nlev;
+        sshape[0] = n;
+        sshape[1] = shape[1];
+        sshape[2] = shape[2];
+        start = rev_z ? shape[0] - z - n : z;
+        transform_values(dest + start * nxy, src + z * nxy,
+                         3, sshape, revert, -999.f, 1e20f, 1.f);
+    }
+    assert(memcmp(whole, dest, sizeof whole) == 0);
+}
+
+
+/*
+ * Write "tas" of 'nt' time steps by cmor_write() (fast = 0) or by
+ * fast_write() after the first step (fast = 1). Return the var_id,
+ * and the path of the output file in 'path'.
+ */
+static int
+write_tas(char *path, int fast, const float *values, int nt)
+{
+    double lon[] = { 45., 135., 225., 315. };
+    double lon_bnds[] = { 0., 90., 180., 270., 360. };
+    double lat[] = { -60., 0., 60. };
+    double lat_bnds[] = { -90., -30., 30., 90. };
+    double time, tbnd[2];
+    float miss = 1e20f;
+    char positive = '\0';
+    int axis_ids[3], var_id, t;
+    size_t nelems = 3 * 4;
+
+    assert(cmor_axis(&axis_ids[0], "time", "days since 2000-01-01", nt,
+                     NULL, 'd', NULL, 0, NULL) == 0);
+    assert(cmor_axis(&axis_ids[1], "latitude", "degrees_north", 3,
+                     lat, 'd', lat_bnds, 1, NULL) == 0);
+    assert(cmor_axis(&axis_ids[2], "longitude", "degrees_east", 4,
+                     lon, 'd', lon_bnds, 1, NULL) == 0);
+    assert(cmor_variable(&var_id, "tas", "K", 3, axis_ids, 'f', &miss,
+                         NULL, &positive, "tas", NULL, NULL) == 0);
+
+    for (t = 0; t < nt; t++) {
+        tbnd[0] = 30. * t;
+        tbnd[1] = 30. * (t + 1);
+        time = .5 * (tbnd[0] + tbnd[1]);
+        if (fast && t > 0) {
+            assert(fast_write_ready(var_id, nelems));
+            assert(fast_write(var_id, values + nelems * t, nelems,
+                              &time, tbnd) == 0);
+        } else
+            assert(cmor_write(var_id, (void *)(values + nelems * t), 'f',
+                              NULL, 1, &time, tbnd, NULL) == 0);
+    }
+    assert(cmor_close_variable(var_id, path, NULL) == 0);
+    return var_id;
+}
+
+
+/*
+ * Compare the values of a variable in two files.
+ */
+static void
+compare_values(int nc1, int nc2, const char *name, size_t nelems)
+{
+    double v1[64], v2[64];
+    int id1, id2;
+
+    assert(nelems <= 64);
+    assert(nc_inq_varid(nc1, name, &id1) == NC_NOERR
+           && nc_inq_varid(nc2, name, &id2) == NC_NOERR);
+    assert(nc_get_var_double(nc1, id1, v1) == NC_NOERR
+           && nc_get_var_double(nc2, id2, v2) == NC_NOERR);
+    assert(memcmp(v1, v2, sizeof(double) * nelems) == 0);
+}
+
+
+/*
+ * Compare the attributes of a variable in two files.
+ */
+static void
+compare_attributes(int nc1, int nc2, const char *name)
+{
+    char attname[NC_MAX_NAME + 1];
+    char buf1[4096], buf2[4096];
+    nc_type type1, type2;
+    size_t len1, len2;
+    int id1, id2, natts1, natts2, i;
+
+    assert(nc_inq_varid(nc1, name, &id1) == NC_NOERR
+           && nc_inq_varid(nc2, name, &id2) == NC_NOERR);
+    assert(nc_inq_varnatts(nc1, id1, &natts1) == NC_NOERR
+           && nc_inq_varnatts(nc2, id2, &natts2) == NC_NOERR);
+    assert(natts1 == natts2);
+
+    for (i = 0; i < natts1; i++) {
+        assert(nc_inq_attname(nc1, id1, i, attname) == NC_NOERR);
+        assert(nc_inq_att(nc1, id1, attname, &type1, &len1) == NC_NOERR
+               && nc_inq_att(nc2, id2, attname, &type2, &len2) == NC_NOERR);
+        assert(type1 == type2 && len1 == len2 && len1 <= sizeof buf1 / 8);
+
+        memset(buf1, 0, sizeof buf1);
+        memset(buf2, 0, sizeof buf2);
+        assert(nc_get_att(nc1, id1, attname, buf1) == NC_NOERR
+               && nc_get_att(nc2, id2, attname, buf2) == NC_NOERR);
+        assert(memcmp(buf1, buf2, sizeof buf1) == 0);
+    }
+}
+
+
+/*
+ * The output of fast-write must be the same as that of cmor_write().
+ */
+static void
+test4(void)
+{
+    char path1[CMOR_MAX_STRING], path2[CMOR_MAX_STRING];
+    char saved[CMOR_MAX_STRING + 8];
+    float values[3 * 3 * 4];
+    const char *base1, *base2;
+    int mode = fast_write_mode;
+    int nc1, nc2, i;
+
+    for (i = 0; i < 3 * 3 * 4; i++)
+        values[i] = (i % 5 == 2) ? 1e20f : 250.f + i;
+
+    write_tas(path1, 0, values, 3);
+    snprintf(saved, sizeof saved, "%s.cmor", path1);
+    assert(rename(path1, saved) == 0);
+
+    set_fast_write();
+    write_tas(path2, 1, values, 3);
+    fast_write_mode = mode;
+
+    /* the same time range in the file name. */
+    base1 = strrchr(path1, '/') ? strrchr(path1, '/') + 1 : path1;
+    base2 = strrchr(path2, '/') ? strrchr(path2, '/') + 1 : path2;
+    assert(strcmp(base1, base2) == 0);
+
+    assert(nc_open(saved, NC_NOWRITE, &nc1) == NC_NOERR
+           && nc_open(path2, NC_NOWRITE, &nc2) == NC_NOERR);
+    compare_values(nc1, nc2, "tas", 3 * 3 * 4);
+    compare_values(nc1, nc2, "time", 3);
+    compare_values(nc1, nc2, "time_bnds", 3 * 2);
+    compare_attributes(nc1, nc2, "tas");
+    compare_attributes(nc1, nc2, "time");
+    nc_close(nc1);
+    nc_close(nc2);
+
+    unlink(saved);
+    unlink(path2);
+}
+
+
+int
+test_fastwrite(void)
+{
+    int n;
+
+    for (n = 0; n < 8; n++) {
+        test1(4, 5, 6, n & 1, n & 2, n & 4);
+        test1(1, 5, 6, n & 1, n & 2, n & 4);
+        test1(4, 1, 1, n & 1, n & 2, n & 4);
+    }
+    test2();
+    for (n = 1; n < 8; n++) {
+        test3(n, 0);
+        test3(n, 1);
+    }
+    test4();
+    printf("test_fastwrite(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
@@ -20,10 +20,14 @@ setup_file_iterator(file_iterator *it, GT3_File *fp, struct sequence *seq)
 void
 rewind_file_iterator(file_iterator *it)
 {
+    double t0;
+
     it->flags_ = 0;
-    if (it->seq == NULL)
+    if (it->seq == NULL) {
+        t0 = stats_clock();
         GT3_rewind(it->fp);
-    else
+        io_account(IO_DATA, IO_SEEK, it->fp->path, 0, t0);
+    } else
         rewindSeq(it->seq);
 }
 
@@ -34,11 +38,17 @@ iterate_file(file_iterator *it)
     int stat, err;
     int next;
     int rval;
+    double t0;
 
     if (it->seq == NULL) {
-        if (it->flags_ && GT3_next(it->fp) < 0) {
-            GT3_printErrorMessages(stderr);
-            return ITER_ERRORCHUNK;
+        if (it->flags_) {
+            t0 = stats_clock();
+            stat = GT3_next(it->fp);
+            io_account(IO_DATA, IO_SEEK, it->fp->path, 0, t0);
+            if (stat < 0) {
+                GT3_printErrorMessages(stderr);
+                return ITER_ERRORCHUNK;
+            }
         }
         if (GT3_eof(it->fp))
             return ITER_END;
@@ -86,7 +96,9 @@ iterate_file(file_iterator *it)
             return rval;
     }
 
+    t0 = stats_clock();
     stat = GT3_seek(it->fp, next, SEEK_SET);
+    io_account(IO_DATA, IO_SEEK, it->fp->path, 0, t0);
     if (GT3_eof(it->fp)) {
         it->seq->last = GT3_getNumChunk(it->fp);
         if (it->seq->step > 0)
@@ -0,0 +1,226 @@
+/*
+ * grid.c -- lat/lon of cell centers and vertices for grid mappings.
+ *
+ * A grid mapping (rotated pole, tripolar, bipolar) gives a function
+ * which transforms (x, y) into true (lon, lat). Cell vertices are
+ * assembled from a band of transformed bounds, which rolls over the
+ * grid row by row; the full (x_len+1) * (y_len+1) arrays of bounds
+ * are never allocated.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "internal.h"
+
+/* the number of rows of cells in a band. */
+#define GRID_BAND 64
+
+
+/*
+ * Copy bounds of 'nrows' rows of cells into vertices.
+ *
+ * bnds: (xlen + 1) * (nrows + 1)
+ * vertices: 4 * xlen * nrows
+ */
+static void
+put_vertices(double *vertices, const double *bnds, int xlen, int nrows)
+{
+    const double *lower, *upper;
+    int i, j;
+
+    for (j = 0; j < nrows; j++) {
+        lower = bnds + (xlen + 1) * j;
+        upper = lower + xlen + 1;
+
+        for (i = 0; i < xlen; i++) {
+            vertices[0] = lower[i];
+            vertices[1] = lower[i + 1];
+            vertices[2] = upper[i + 1];
+            vertices[3] = upper[i];
+            vertices += 4;
+        }
+    }
+}
+
+
+static int
+make_grid(cached_grid *grid,
+          const double *x, const double *x_bnds, int xlen,
+          const double *y, const double *y_bnds, int ylen,
+          grid_transform transform)
+{
+    double *lon_bnds = NULL, *lat_bnds = NULL;
+    size_t rowsize = xlen + 1;
+    int j0, nrows, offset;
+    int rval = -1;
+
+    /*
+     * cell centers.
+     */
+    if (transform(grid->lon, grid->lat, x, y, xlen, ylen) < 0)
+        return -1;
+
+    /*
+     * cell vertices, band by band.
+     */
+    if ((lon_bnds = malloc(sizeof(double) * rowsize * (GRID_BAND + 1)))
+        == NULL
+        || (lat_bnds = malloc(sizeof(double) * rowsize * (GRID_BAND + 1)))
+        == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+
+    for (j0 = 0; j0 < ylen; j0 += nrows) {
+        nrows = ylen - j0 < GRID_BAND ? ylen - j0 : GRID_BAND;
+
+        /*
+         * The upper bounds of the last band are the lower bounds
+         * of this band.
+         */
+        offset = 0;
+        if (j0 > 0) {
+            memcpy(lon_bnds, lon_bnds + rowsize * GRID_BAND,
+                   sizeof(double) * rowsize);
+            memcpy(lat_bnds, lat_bnds + rowsize * GRID_BAND,
+                   sizeof(double) * rowsize);
+            offset = 1;
+        }
+        if (transform(lon_bnds + rowsize * offset,
+                      lat_bnds + rowsize * offset,
+                      x_bnds, y_bnds + j0 + offset,
+                      xlen + 1, nrows + 1 - offset) < 0)
+            goto finish;
+
+        put_vertices(grid->lon_vertices + 4 * xlen * j0,
+                     lon_bnds, xlen, nrows);
+        put_vertices(grid->lat_vertices + 4 * xlen * j0,
+                     lat_bnds, xlen, nrows);
+    }
+    rval = 0;
+
+finish:
+    free(lat_bnds);
+    free(lon_bnds);
+    return rval;
+}
+
+
+/*
+ * Set up lat/lon of cell centers and vertices of a grid, which
+ * is loaded from the grid cache if any.
+ *
+ * transform() converts (x, y) into true (lon, lat) for each point
+ * of xlen * ylen.
+ * The grid must be released by free_grid().
+ */
+int
+build_grid(cached_grid *grid,
+           const double *x, const double *x_bnds, int xlen,
+           const double *y, const double *y_bnds, int ylen,
+           grid_transform transform)
+{
+    int len = xlen * ylen;
+
+    if (load_grid_cache(grid, len) == 0)
+        return 0;
+
+    if ((grid->lon = malloc(sizeof(double) * len)) == NULL
+        || (grid->lat = malloc(sizeof(double) * len)) == NULL
+        || (grid->lon_vertices = malloc(sizeof(double) * 4 * len)) == NULL
+        || (grid->lat_vertices = malloc(sizeof(double) * 4 * len)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto error;
+    }
+    if (make_grid(grid, x, x_bnds, xlen, y, y_bnds, ylen, transform) < 0)
+        goto error;
+
+    save_grid_cache(grid->lon, grid->lat,
+                    grid->lon_vertices, grid->lat_vertices, len);
+    return 0;
+
+error:
+    free_grid(grid);
+    return -1;
+}
+
+
+void
+free_grid(cached_grid *grid)
+{
+    if (grid->map)
+        release_grid_cache(grid);
+    else {
+        free(grid->lat_vertices);
+        free(grid->lon_vertices);
+        free(grid->lat);
+        free(grid->lon);
+        memset(grid, 0, sizeof(cached_grid));
+    }
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+#include <stdio.h>
+
+static int
+identity(double *lon, double *lat,
+         const double *x, const double *y, int xlen, int ylen)
+{
+    int i, j;
+
+    for (j = 0; j < ylen; j++)
+        for (i = 0; i < xlen; i++) {
+            lon[i + xlen * j] = x[i];
+            lat[i + xlen * j] = y[j];
+        }
+    return 0;
+}
+
+
+int
+test_grid(void)
+{
+    int xlen = 5, ylen = 2 * GRID_BAND + 3;
+    double x[5], x_bnds[6], *y, *y_bnds;
+    cached_grid grid;
+    int i, j, n;
+
+    y = malloc(sizeof(double) * ylen);
+    y_bnds = malloc(sizeof(double) * (ylen + 1));
+    for (i = 0; i < xlen + 1; i++) {
+        x_bnds[i] = 10. * i;
+        if (i < xlen)
+            x[i] = 10. * i + 5.;
+    }
+    for (j = 0; j < ylen + 1; j++) {
+        y_bnds[j] = -90. + j;
+        if (j < ylen)
+            y[j] = -89.5 + j;
+    }
+
+    assert(build_grid(&grid, x, x_bnds, xlen, y, y_bnds, ylen,
+                      identity) == 0);
+    for (j = 0; j < ylen; j++)
+        for (i = 0; i < xlen; i++) {
+            n = i + xlen * j;
+
+            assert(grid.lon[n] == x[i] && grid.lat[n] == y[j]);
+            assert(grid.lon_vertices[4 * n + 0] == x_bnds[i]);
+            assert(grid.lon_vertices[4 * n + 1] == x_bnds[i + 1]);
+            assert(grid.lon_vertices[4 * n + 2] == x_bnds[i + 1]);
+            assert(grid.lon_vertices[4 * n + 3] == x_bnds[i]);
+            assert(grid.lat_vertices[4 * n + 0] == y_bnds[j]);
+            assert(grid.lat_vertices[4 * n + 1] == y_bnds[j]);
+            assert(grid.lat_vertices[4 * n + 2] == y_bnds[j + 1]);
+            assert(grid.lat_vertices[4 * n + 3] == y_bnds[j + 1]);
+        }
+    free_grid(&grid);
+    free(y_bnds);
+    free(y);
+    printf("test_grid(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
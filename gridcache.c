@@ -0,0 +1,327 @@
+/*
+ * gridcache.c -- on-disk cache of computed grids.
+ *
+ * Grids for grid mappings (lat/lon of cell centers and vertices)
+ * are computed by trigonometry-heavy transformation, which gives
+ * the same result every time. They are saved in a cache directory,
+ * and loaded by mmap(2) in the following runs.
+ *
+ * File format (native byte order):
+ *   header (GRID_HEADER_SIZE bytes):
+ *     magic[8], version, len, key[]
+ *   double lon[len], lat[len];
+ *   double lon_vertices[4 * len], lat_vertices[4 * len];
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "internal.h"
+#include "myutils.h"
+
+#ifndef PATH_MAX
+#  define PATH_MAX 1024
+#endif
+
+#define GRID_MAGIC "MIPCGRID"
+#define GRID_VERSION 2
+
+/*
+ * Version of the computation of grids (coord.c, bipolar.c, tripolar.c,
+ * and grid.c), which is a part of the key. Bump it whenever a change
+ * may give different values, so that stale grids are never loaded.
+ */
+#define GRID_ALGORITHM 2
+#define GRID_HEADER_SIZE 512
+#define GRID_KEY_SIZE (GRID_HEADER_SIZE - 16)
+
+struct grid_header {
+    char magic[8];
+    int32_t version;
+    int32_t len;
+    char key[GRID_KEY_SIZE];
+};
+
+static char *cache_dir = NULL;
+static char cache_key[GRID_KEY_SIZE];
+
+
+int
+set_grid_cache_dir(const char *dir)
+{
+    struct stat sb;
+
+    if (stat(dir, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        logging(LOG_ERR, "%s: not a directory.", dir);
+        return -1;
+    }
+    free(cache_dir);
+    if ((cache_dir = strdup(dir)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * FNV-1a (64-bit).
+ */
+static uint64_t
+fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+/*
+ * Set the key of a grid to be set up next.
+ * The key consists of the version of the computation, the mapping,
+ * the axes, the pole latitude, and a hash of the axis values.
+ */
+void
+set_grid_cache_key(const char *mapping, const gtool3_dim_prop *dims,
+                   double plat,
+                   const double *x, const double *x_bnds, int xlen,
+                   const double *y, const double *y_bnds, int ylen)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    cache_key[0] = '\0';
+    if (!cache_dir)
+        return;
+
+    hash = fnv1a(hash, x, sizeof(double) * xlen);
+    hash = fnv1a(hash, x_bnds, sizeof(double) * (xlen + 1));
+    hash = fnv1a(hash, y, sizeof(double) * ylen);
+    hash = fnv1a(hash, y_bnds, sizeof(double) * (ylen + 1));
+
+    snprintf(cache_key, sizeof cache_key,
+             "v%d %s %s:%d:%d %s:%d:%d %.17g %016llx",
+             GRID_ALGORITHM, mapping,
+             dims[0].aitm, dims[0].astr, dims[0].aend,
+             dims[1].aitm, dims[1].astr, dims[1].aend,
+             plat, (unsigned long long)hash);
+}
+
+
+static int
+cache_path(char *path, size_t size)
+{
+    uint64_t hash;
+
+    hash = fnv1a(0xcbf29ce484222325ULL, cache_key, strlen(cache_key));
+    return snprintf(path, size, "%s/grid-%016llx.bin",
+                    cache_dir, (unsigned long long)hash) < size ? 0 : -1;
+}
+
+
+/*
+ * Load a cached grid of 'len' cells.
+ * Return 0 on success, -1 if not cached.
+ */
+int
+load_grid_cache(cached_grid *grid, int len)
+{
+    char path[PATH_MAX + 1];
+    struct stat sb;
+    const struct grid_header *head;
+    size_t size;
+    double *data;
+    void *ptr;
+    int fd;
+
+    memset(grid, 0, sizeof(cached_grid));
+    if (!cache_dir || cache_key[0] == '\0'
+        || cache_path(path, sizeof path) < 0)
+        return -1;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    size = GRID_HEADER_SIZE + sizeof(double) * 10 * len;
+    if (fstat(fd, &sb) < 0 || sb.st_size != size) {
+        close(fd);
+        return -1;
+    }
+    /* private writable mapping, in case the arrays are modified. */
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return -1;
+
+    head = ptr;
+    if (memcmp(head->magic, GRID_MAGIC, 8) != 0
+        || head->version != GRID_VERSION
+        || head->len != len
+        || strcmp(head->key, cache_key) != 0) {
+        logging(LOG_WARN, "%s: mismatched grid cache (ignored).", path);
+        munmap(ptr, size);
+        return -1;
+    }
+
+    data = (double *)((char *)ptr + GRID_HEADER_SIZE);
+    grid->lon = data;
+    grid->lat = data + len;
+    grid->lon_vertices = data + 2 * len;
+    grid->lat_vertices = data + 6 * len;
+    grid->map = ptr;
+    grid->mapsize = size;
+    logging(LOG_INFO, "grid loaded from cache: %s", path);
+    return 0;
+}
+
+
+void
+release_grid_cache(cached_grid *grid)
+{
+    if (grid->map)
+        munmap(grid->map, grid->mapsize);
+    memset(grid, 0, sizeof(cached_grid));
+}
+
+
+static int
+write_all(int fd, const void *buf, size_t size)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (size > 0) {
+        if ((n = write(fd, p, size)) < 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+
+/*
+ * Save a computed grid. A failure is not fatal.
+ */
+int
+save_grid_cache(const double *lon, const double *lat,
+                const double *lon_vertices, const double *lat_vertices,
+                int len)
+{
+    char path[PATH_MAX + 1], temp[PATH_MAX + 1];
+    struct grid_header head;
+    size_t nbytes = sizeof(double) * len;
+    int fd;
+
+    if (!cache_dir || cache_key[0] == '\0'
+        || cache_path(path, sizeof path) < 0
+        || snprintf(temp, sizeof temp, "%s.%d", path, (int)getpid())
+           >= sizeof temp)
+        return -1;
+
+    memset(&head, 0, sizeof head);
+    memcpy(head.magic, GRID_MAGIC, 8);
+    head.version = GRID_VERSION;
+    head.len = len;
+    strlcpy(head.key, cache_key, sizeof head.key);
+
+    if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        logging(LOG_SYSERR, temp);
+        return -1;
+    }
+    if (write_all(fd, &head, sizeof head) < 0
+        || write_all(fd, lon, nbytes) < 0
+        || write_all(fd, lat, nbytes) < 0
+        || write_all(fd, lon_vertices, 4 * nbytes) < 0
+        || write_all(fd, lat_vertices, 4 * nbytes) < 0
+        || close(fd) < 0
+        || rename(temp, path) < 0) {
+        logging(LOG_SYSERR, temp);
+        unlink(temp);
+        return -1;
+    }
+    logging(LOG_INFO, "grid saved to cache: %s", path);
+    return 0;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+
+int
+test_gridcache(void)
+{
+    char dir[] = "/tmp/gridcacheXXXXXX";
+    char path[PATH_MAX + 1];
+    gtool3_dim_prop dims[2];
+    double x[] = { 0., 1., 2. }, xb[] = { -.5, .5, 1.5, 2.5 };
+    double y[] = { 10., 20. }, yb[] = { 5., 15., 25. };
+    double lon[6], lat[6], lonv[24], latv[24];
+    cached_grid grid;
+    int i;
+
+    for (i = 0; i < 24; i++) {
+        if (i < 6) {
+            lon[i] = i;
+            lat[i] = -i;
+        }
+        lonv[i] = 100. + i;
+        latv[i] = -100. - i;
+    }
+    strlcpy(dims[0].aitm, "OCLONTPV", sizeof dims[0].aitm);
+    dims[0].astr = 1;
+    dims[0].aend = 3;
+    strlcpy(dims[1].aitm, "OCLATTPV", sizeof dims[1].aitm);
+    dims[1].astr = 1;
+    dims[1].aend = 2;
+
+    assert(mkdtemp(dir) != NULL);
+    set_grid_cache_dir(dir);
+    set_grid_cache_key("tripolar", dims, 63., x, xb, 3, y, yb, 2);
+
+    assert(load_grid_cache(&grid, 6) < 0);
+    assert(save_grid_cache(lon, lat, lonv, latv, 6) == 0);
+    assert(load_grid_cache(&grid, 6) == 0);
+    assert(memcmp(grid.lon, lon, sizeof lon) == 0);
+    assert(memcmp(grid.lat, lat, sizeof lat) == 0);
+    assert(memcmp(grid.lon_vertices, lonv, sizeof lonv) == 0);
+    assert(memcmp(grid.lat_vertices, latv, sizeof latv) == 0);
+    release_grid_cache(&grid);
+
+    /* computed by another version. */
+    snprintf(path, sizeof path, "v%d ", GRID_ALGORITHM);
+    assert(strncmp(cache_key, path, strlen(path)) == 0);
+    cache_key[1]++;
+    assert(load_grid_cache(&grid, 6) < 0);
+
+    /* different axis values. */
+    x[1] = 1.5;
+    set_grid_cache_key("tripolar", dims, 63., x, xb, 3, y, yb, 2);
+    assert(load_grid_cache(&grid, 6) < 0);
+
+    x[1] = 1.;
+    set_grid_cache_key("tripolar", dims, 63., x, xb, 3, y, yb, 2);
+    cache_path(path, sizeof path);
+    unlink(path);
+    rmdir(dir);
+
+    free(cache_dir);
+    cache_dir = NULL;
+    cache_key[0] = '\0';
+    printf("test_gridcache(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
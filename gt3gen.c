@@ -0,0 +1,551 @@
+/*
+ * gt3gen.c -- generate synthetic GTOOL3 history files (for benchmarks).
+ *
+ * A smooth field (a wave travelling eastward, damped upward) with a
+ * little noise is written for each time step, with DATE1/DATE2 of
+ * a constant interval in a given calendar. The values depend only on
+ * the options (and the seed of the noise), so that the same dataset
+ * is made on every run.
+ *
+ * With -A, the axes of the field (and their bounds in "*.M") are
+ * written into GTAXLOC files in the directory.
+ */
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gtool3.h"
+#include "logging.h"
+#include "myutils.h"
+
+#define PROGNAME "gt3gen"
+
+#ifndef PATH_MAX
+#  define PATH_MAX 1024
+#endif
+
+enum {
+    GRID_LONLAT,
+    GRID_TRIPOLAR
+};
+
+static int nx = 128, ny = 64, nz = 1;
+static int nchunks = 12;
+static const char *format = "UR4";
+static const char *item = "T";
+static const char *unit = "K";
+static double base = 280., amplitude = 20.;
+static double miss_fraction = 0.;
+static double miss = -999.;
+static int calendar = GT3_CAL_GREGORIAN;
+static GT3_Duration interval = { 1, GT3_UNIT_MON };
+static GT3_Date start_date = { 2000, 1, 1, 0, 0, 0 };
+static int instantaneous = 0;
+static int grid = GRID_LONLAT;
+static uint64_t seed = 1;
+
+/* axes */
+static char xname[17], yname[17], zname[17];
+static double *lon, *lat;
+
+
+/*
+ * xorshift64*: deterministic for a seed.
+ */
+static double
+uniform(void)
+{
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return (seed * 0x2545f4914f6cdd1dULL >> 11) * (1. / 9007199254740992.);
+}
+
+
+static int
+parse_interval(GT3_Duration *dur, const char *str)
+{
+    struct { const char *key; int value; } tab[] = {
+        { "yr",  GT3_UNIT_YEAR },
+        { "mon", GT3_UNIT_MON  },
+        { "day", GT3_UNIT_DAY  },
+        { "hr",  GT3_UNIT_HOUR },
+        { "min", GT3_UNIT_MIN  },
+        { "sec", GT3_UNIT_SEC  }
+    };
+    char *endp;
+    long value = 1;
+    int i;
+
+    if (*str >= '0' && *str <= '9') {
+        value = strtol(str, &endp, 10);
+        str = endp;
+    }
+    if (value <= 0)
+        return -1;
+
+    for (i = 0; i < sizeof tab / sizeof tab[0]; i++)
+        if (strcmp(str, tab[i].key) == 0) {
+            dur->value = value;
+            dur->unit = tab[i].value;
+            return 0;
+        }
+    return -1;
+}
+
+
+static int
+parse_calendar(const char *str)
+{
+    struct { const char *key; int value; } tab[] = {
+        { "gregorian", GT3_CAL_GREGORIAN },
+        { "noleap", GT3_CAL_NOLEAP },
+        { "360_day", GT3_CAL_360_DAY },
+        { "julian", GT3_CAL_JULIAN }
+    };
+    int i;
+
+    for (i = 0; i < sizeof tab / sizeof tab[0]; i++)
+        if (strcmp(str, tab[i].key) == 0) {
+            calendar = tab[i].value;
+            return 0;
+        }
+    return -1;
+}
+
+
+static int
+parse_grid(const char *str)
+{
+    if (strcmp(str, "lonlat") == 0)
+        grid = GRID_LONLAT;
+    else if (strcmp(str, "tripolar") == 0)
+        grid = GRID_TRIPOLAR;
+    else
+        return -1;
+    return 0;
+}
+
+
+static void
+set_axis_header(GT3_HEADER *head, const char *name, int len)
+{
+    GT3_setHeaderString(head, "AITM1", name);
+    GT3_setHeaderInt(head, "ASTR1", 1);
+    GT3_setHeaderInt(head, "AEND1", len);
+    GT3_setHeaderString(head, "AITM2", "SFC1");
+    GT3_setHeaderInt(head, "ASTR2", 1);
+    GT3_setHeaderInt(head, "AEND2", 1);
+    GT3_setHeaderString(head, "AITM3", "SFC1");
+    GT3_setHeaderInt(head, "ASTR3", 1);
+    GT3_setHeaderInt(head, "AEND3", 1);
+}
+
+
+/*
+ * Write GTAXLOC.<name> in 'dir'.
+ */
+static int
+write_axis(const char *dir, const char *name,
+           const char *title, const char *aunit,
+           const double *values, int len, double dmin, double dmax)
+{
+    GT3_HEADER head;
+    char path[PATH_MAX + 1];
+    FILE *fp;
+
+    snprintf(path, sizeof path, "%s/GTAXLOC.%s", dir, name);
+    if ((fp = fopen(path, "wb")) == NULL) {
+        logging(LOG_SYSERR, path);
+        return -1;
+    }
+    GT3_initHeader(&head);
+    GT3_setHeaderString(&head, "DSET", "AXLOC");
+    GT3_setHeaderString(&head, "ITEM", name);
+    GT3_setHeaderString(&head, "TITLE", title);
+    GT3_setHeaderString(&head, "UNIT", aunit);
+    GT3_setHeaderDouble(&head, "DMIN", dmin);
+    GT3_setHeaderDouble(&head, "DMAX", dmax);
+    set_axis_header(&head, name, len);
+
+    if (GT3_write(values, GT3_TDOUBLE, len, 1, 1, &head, "UR8", fp) < 0) {
+        GT3_printErrorMessages(stderr);
+        fclose(fp);
+        return -1;
+    }
+    if (fclose(fp) != 0) {
+        logging(LOG_SYSERR, path);
+        return -1;
+    }
+    logging(LOG_INFO, "%s: %d points.", path, len);
+    return 0;
+}
+
+
+/*
+ * Write an axis of 'len' cells evenly spaced over [v0, v1], and its
+ * bounds. If 'cyclic', the first point is repeated at the end.
+ */
+static int
+write_even_axis(const char *dir, const char *name,
+                const char *title, const char *aunit,
+                double v0, double v1, int len, int cyclic)
+{
+    char bname[17];
+    double *values, *bnds;
+    double d = (v1 - v0) / len;
+    int i, rval = -1;
+
+    values = malloc(sizeof(double) * (len + 1));
+    bnds = malloc(sizeof(double) * (len + 1));
+    if (values == NULL || bnds == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+    for (i = 0; i < len + 1; i++) {
+        values[i] = cyclic ? v0 + d * i : v0 + d * (i + .5);
+        bnds[i] = cyclic ? v0 + d * (i - .5) : v0 + d * i;
+    }
+
+    snprintf(bname, sizeof bname, "%s.M", name);
+    if (write_axis(dir, name, title, aunit,
+                   values, cyclic ? len + 1 : len, v0, v1) < 0
+        || write_axis(dir, bname, title, aunit,
+                      bnds, len + 1, v0, v1) < 0)
+        goto finish;
+    rval = 0;
+
+finish:
+    free(bnds);
+    free(values);
+    return rval;
+}
+
+
+static int
+write_axes(const char *dir)
+{
+    if (grid == GRID_TRIPOLAR) {
+        /* pseudo latitude beyond 90 for the northern patch (63N). */
+        if (write_even_axis(dir, xname, "longitude", "degrees_east",
+                            0., 360., nx, 1) < 0
+            || write_even_axis(dir, yname, "latitude", "degrees_north",
+                               -78., 153., ny, 0) < 0)
+            return -1;
+    } else {
+        if (write_even_axis(dir, xname, "longitude", "degrees_east",
+                            0., 360., nx, 1) < 0
+            || write_even_axis(dir, yname, "latitude", "degrees_north",
+                               -90., 90., ny, 0) < 0)
+            return -1;
+    }
+    /* sigma decreasing upward */
+    if (nz > 1
+        && write_even_axis(dir, zname, "sigma", "1", 1., 0., nz, 0) < 0)
+        return -1;
+    return 0;
+}
+
+
+static void
+set_axis_names(void)
+{
+    if (grid == GRID_TRIPOLAR) {
+        snprintf(xname, sizeof xname, "OCLONT%d", nx);
+        snprintf(yname, sizeof yname, "OCLATT%d", ny);
+    } else {
+        snprintf(xname, sizeof xname, "GLON%d", nx);
+        snprintf(yname, sizeof yname, "GLAT%d", ny);
+    }
+    if (nz > 1)
+        snprintf(zname, sizeof zname, "CSIG%d", nz);
+    else
+        strlcpy(zname, "SFC1", sizeof zname);
+}
+
+
+static int
+setup_coords(void)
+{
+    double y0 = grid == GRID_TRIPOLAR ? -78. : -90.;
+    double y1 = grid == GRID_TRIPOLAR ? 153. : 90.;
+    int i;
+
+    if ((lon = malloc(sizeof(double) * nx)) == NULL
+        || (lat = malloc(sizeof(double) * ny)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    for (i = 0; i < nx; i++)
+        lon[i] = 2. * M_PI * i / nx;
+    for (i = 0; i < ny; i++)
+        lat[i] = M_PI / 180. * (y0 + (y1 - y0) * (i + .5) / ny);
+    return 0;
+}
+
+
+/*
+ * Fill a time step 'n'.
+ */
+static void
+fill_step(float *data, int n)
+{
+    double phase = 2. * M_PI * n / 12.;
+    double damp, v;
+    size_t ij = 0;
+    int i, j, k;
+
+    for (k = 0; k < nz; k++) {
+        damp = 1. - .5 * k / nz;
+        for (j = 0; j < ny; j++)
+            for (i = 0; i < nx; i++, ij++) {
+                v = base
+                    + amplitude * damp * cos(lat[j]) * cos(lon[i] - phase)
+                    + .05 * amplitude * (uniform() - .5);
+                if (miss_fraction > 0. && uniform() < miss_fraction)
+                    v = miss;
+                data[ij] = (float)v;
+            }
+    }
+}
+
+
+static void
+set_dates(GT3_HEADER *head, int n)
+{
+    GT3_Date date1, date2, origin;
+    GT3_Duration step;
+    double hours;
+
+    step = interval;
+    step.value *= n;
+    date1 = start_date;
+    GT3_addDuration(&date1, &step, calendar);
+    date2 = date1;
+    if (!instantaneous)
+        GT3_addDuration(&date2, &interval, calendar);
+
+    GT3_setDate(&origin, 0, 1, 1, 0, 0, 0);
+    hours = GT3_getTime(&date1, &origin, GT3_UNIT_HOUR, calendar);
+
+    GT3_setHeaderDate(head, "DATE", &date1);
+    GT3_setHeaderDate(head, "DATE1", &date1);
+    GT3_setHeaderDate(head, "DATE2", &date2);
+    GT3_setHeaderInt(head, "TIME", (int)hours);
+    GT3_setHeaderString(head, "UTIM", "HOUR");
+    GT3_setHeaderInt(head, "TDUR",
+                     (int)(GT3_getTime(&date2, &origin, GT3_UNIT_HOUR,
+                                       calendar) - hours));
+}
+
+
+static int
+write_history(const char *path)
+{
+    GT3_HEADER head;
+    float *data;
+    FILE *fp;
+    int n, rval = -1;
+
+    if ((data = malloc(sizeof(float) * nx * ny * nz)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    if ((fp = fopen(path, "wb")) == NULL) {
+        logging(LOG_SYSERR, path);
+        free(data);
+        return -1;
+    }
+
+    GT3_initHeader(&head);
+    GT3_setHeaderString(&head, "DSET", PROGNAME);
+    GT3_setHeaderString(&head, "ITEM", item);
+    GT3_setHeaderString(&head, "TITLE", "synthetic data");
+    GT3_setHeaderString(&head, "UNIT", unit);
+    GT3_setHeaderString(&head, "AITM1", xname);
+    GT3_setHeaderInt(&head, "ASTR1", 1);
+    GT3_setHeaderInt(&head, "AEND1", nx);
+    GT3_setHeaderString(&head, "AITM2", yname);
+    GT3_setHeaderInt(&head, "ASTR2", 1);
+    GT3_setHeaderInt(&head, "AEND2", ny);
+    GT3_setHeaderString(&head, "AITM3", zname);
+    GT3_setHeaderInt(&head, "ASTR3", 1);
+    GT3_setHeaderInt(&head, "AEND3", nz);
+    GT3_setHeaderDouble(&head, "MISS", miss);
+
+    for (n = 0; n < nchunks; n++) {
+        fill_step(data, n);
+        set_dates(&head, n);
+        if (GT3_write(data, GT3_TFLOAT, nx, ny, nz, &head, format, fp) < 0) {
+            GT3_printErrorMessages(stderr);
+            goto finish;
+        }
+    }
+    if (fclose(fp) != 0) {
+        logging(LOG_SYSERR, path);
+        fp = NULL;
+        goto finish;
+    }
+    fp = NULL;
+    logging(LOG_INFO, "%s: %s %dx%dx%d, %d step(s).",
+            path, format, nx, ny, nz, nchunks);
+    rval = 0;
+
+finish:
+    if (fp)
+        fclose(fp);
+    free(data);
+    return rval;
+}
+
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: " PROGNAME " [options] output\n"
+            "\n"
+            "Generate a synthetic GTOOL3 history file.\n"
+            "\n"
+            "Options:\n"
+            "    -A DIR       write GTAXLOC files of the axes in DIR.\n"
+            "    -c calendar  gregorian, noleap, 360_day, or julian"
+            " (default: gregorian).\n"
+            "    -d Y-M-D     date of the first step (default: 2000-01-01).\n"
+            "    -f format    data format such as UR4, URY16, MR4"
+            " (default: UR4).\n"
+            "    -g grid      lonlat or tripolar (default: lonlat).\n"
+            "    -i item      ITEM of the header (default: T).\n"
+            "    -m fraction  fraction of missing values (default: 0).\n"
+            "    -n chunks    number of time steps (default: 12).\n"
+            "    -p           instantaneous (DATE1 == DATE2).\n"
+            "    -r seed      seed of the noise (default: 1).\n"
+            "    -s interval  interval of time steps such as 1mon, 1day,\n"
+            "                 3hr, 30min (default: 1mon).\n"
+            "    -u unit      UNIT of the header (default: K).\n"
+            "    -v base,amp  base value and amplitude (default: 280,20).\n"
+            "    -x nx -y ny -z nz\n"
+            "                 size of the grid (default: 128x64x1).\n"
+            "    -V           verbose mode.\n"
+            "    -h           print this message.\n");
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const char *axisdir = NULL;
+    char *endp;
+    int ch;
+
+    open_logging(stderr, PROGNAME);
+    GT3_setProgname(PROGNAME);
+
+    while ((ch = getopt(argc, argv, "A:c:d:f:g:i:m:n:pr:s:u:v:x:y:z:Vh"))
+           != -1)
+        switch (ch) {
+        case 'A':
+            axisdir = optarg;
+            break;
+        case 'c':
+            if (parse_calendar(optarg) < 0) {
+                logging(LOG_ERR, "%s: unknown calendar.", optarg);
+                exit(1);
+            }
+            break;
+        case 'd':
+            if (sscanf(optarg, "%d-%d-%d", &start_date.year,
+                       &start_date.mon, &start_date.day) != 3) {
+                logging(LOG_ERR, "%s: invalid date.", optarg);
+                exit(1);
+            }
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'g':
+            if (parse_grid(optarg) < 0) {
+                logging(LOG_ERR, "%s: unknown grid.", optarg);
+                exit(1);
+            }
+            break;
+        case 'i':
+            item = optarg;
+            break;
+        case 'm':
+            miss_fraction = strtod(optarg, &endp);
+            if (*endp != '\0' || miss_fraction < 0. || miss_fraction > 1.) {
+                logging(LOG_ERR, "%s: invalid fraction.", optarg);
+                exit(1);
+            }
+            break;
+        case 'n':
+            nchunks = atoi(optarg);
+            break;
+        case 'p':
+            instantaneous = 1;
+            break;
+        case 'r':
+            seed = strtoull(optarg, NULL, 10);
+            if (seed == 0)
+                seed = 1;
+            break;
+        case 's':
+            if (parse_interval(&interval, optarg) < 0) {
+                logging(LOG_ERR, "%s: invalid interval.", optarg);
+                exit(1);
+            }
+            break;
+        case 'u':
+            unit = optarg;
+            break;
+        case 'v':
+            if (sscanf(optarg, "%lf,%lf", &base, &amplitude) != 2) {
+                logging(LOG_ERR, "%s: invalid base,amp.", optarg);
+                exit(1);
+            }
+            break;
+        case 'x':
+            nx = atoi(optarg);
+            break;
+        case 'y':
+            ny = atoi(optarg);
+            break;
+        case 'z':
+            nz = atoi(optarg);
+            break;
+        case 'V':
+            set_logging_level("verbose");
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+
+    if (argc - optind != 1) {
+        usage();
+        exit(1);
+    }
+    if (nx < 1 || ny < 1 || nz < 1 || nchunks < 1) {
+        logging(LOG_ERR, "invalid size: %dx%dx%d, %d step(s).",
+                nx, ny, nz, nchunks);
+        exit(1);
+    }
+
+    set_axis_names();
+    if (axisdir && write_axes(axisdir) < 0)
+        exit(1);
+    if (setup_coords() < 0 || write_history(argv[optind]) < 0)
+        exit(1);
+
+    free(lat);
+    free(lon);
+    return 0;
+}
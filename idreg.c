@@ -0,0 +1,163 @@
+/*
+ * idreg.c -- registry of CMOR IDs (axes, grids, formula terms).
+ *
+ * CMOR has no lookup of an axis already defined, and each call of
+ * cmor_axis()/cmor_grid() adds a new entry to its tables.
+ * The IDs are registered with a key describing the definition, and
+ * reused for the following variables in the same session.
+ *
+ * Keys are local to the current MIP table (CMOR_TABLE).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmor.h"
+#include "logging.h"
+#include "internal.h"
+
+struct id_entry {
+    uint64_t hash;
+    char *key;
+    int table_id;               /* CMOR_TABLE when registered */
+    int id;
+};
+
+static struct id_entry *entries = NULL;
+static int nentries = 0;
+static int maxentries = 0;
+
+
+/*
+ * FNV-1a (64-bit), for keys and values used in keys.
+ */
+uint64_t
+idreg_hash(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+static uint64_t
+key_hash(const char *key)
+{
+    return idreg_hash(0xcbf29ce484222325ULL, key, strlen(key));
+}
+
+
+/*
+ * Return the ID registered with 'key', or -1 if not registered.
+ */
+int
+idreg_lookup(const char *key)
+{
+    uint64_t hash = key_hash(key);
+    int i;
+
+    for (i = 0; i < nentries; i++)
+        if (entries[i].hash == hash
+            && entries[i].table_id == CMOR_TABLE
+            && strcmp(entries[i].key, key) == 0) {
+            logging(LOG_INFO, "reuse id %d: %s", entries[i].id, key);
+            return entries[i].id;
+        }
+    return -1;
+}
+
+
+/*
+ * Register 'id' with 'key'. A failure is not fatal (the ID is
+ * just not reused).
+ */
+int
+idreg_register(const char *key, int id)
+{
+    struct id_entry *p;
+
+    if (id < 0)
+        return -1;
+
+    if (nentries == maxentries) {
+        int newmax = maxentries > 0 ? 2 * maxentries : 64;
+
+        if ((p = realloc(entries, sizeof(struct id_entry) * newmax))
+            == NULL) {
+            logging(LOG_SYSERR, NULL);
+            return -1;
+        }
+        entries = p;
+        maxentries = newmax;
+    }
+    p = entries + nentries;
+    if ((p->key = strdup(key)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    p->hash = key_hash(key);
+    p->table_id = CMOR_TABLE;
+    p->id = id;
+    nentries++;
+    return 0;
+}
+
+
+void
+idreg_clear(void)
+{
+    int i;
+
+    for (i = 0; i < nentries; i++)
+        free(entries[i].key);
+    free(entries);
+    entries = NULL;
+    nentries = maxentries = 0;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+
+int
+test_idreg(void)
+{
+    char key[64];
+    int i;
+
+    assert(idreg_lookup("latitude GGLA64 1:64") == -1);
+    assert(idreg_register("latitude GGLA64 1:64", 3) == 0);
+    assert(idreg_lookup("latitude GGLA64 1:64") == 3);
+    assert(idreg_lookup("latitude GGLA64 1:32") == -1);
+
+    for (i = 0; i < 200; i++) {
+        snprintf(key, sizeof key, "axis %d", i);
+        assert(idreg_register(key, i + 100) == 0);
+    }
+    assert(idreg_lookup("axis 199") == 299);
+    assert(idreg_lookup("latitude GGLA64 1:64") == 3);
+
+    /* keys are local to a table. */
+    {
+        int saved = CMOR_TABLE;
+
+        CMOR_TABLE = saved + 1;
+        assert(idreg_lookup("latitude GGLA64 1:64") == -1);
+        assert(idreg_register("latitude GGLA64 1:64", 5) == 0);
+        assert(idreg_lookup("latitude GGLA64 1:64") == 5);
+        CMOR_TABLE = saved;
+        assert(idreg_lookup("latitude GGLA64 1:64") == 3);
+    }
+
+    idreg_clear();
+    assert(idreg_lookup("axis 0") == -1);
+    printf("test_idreg(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
@@ -4,6 +4,7 @@
 #ifndef INTERNAL_H
 #define INTERNAL_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 #include "gtool3.h"
@@ -21,9 +22,20 @@ struct gtool3_dim_prop {
 typedef struct gtool3_dim_prop gtool3_dim_prop;
 
 
+/* prefetch.c */
+int set_prefetch_dir(const char *dir);
+int set_prefetch_params(int depth, int cap_mb);
+int prefetch_enabled(void);
+int add_prefetch(const char *path);
+int start_prefetch(void);
+const char *prefetched_path(const char *path);
+void release_prefetched(const char *path);
+void finish_prefetch(void);
+
 /* setup.c */
 int use_netcdf(int v);
 int set_writing_mode(const char *str);
+int preserve_mode(void);
 int set_outdir(const char *dir);
 int read_config(FILE *fp);
 void logging_current_attributes(void);
@@ -45,6 +57,26 @@ int match_axisname(const char *name, const char *pattern);
 int dummy_dimname(const char *name);
 GT3_DimBound *get_dimbound(const char *name);
 
+/* axisbundle.c */
+int set_axis_bundle(const char *path);
+void unset_axis_bundle(void);
+GT3_Dim *bundle_dim(const char *name);
+GT3_DimBound *bundle_dimbound(const char *name);
+FILE *bundle_labels(const char *name);
+
+/* dimcache.c */
+const GT3_Dim *get_dim(const char *name);
+void release_dim(const GT3_Dim *dim);
+const GT3_DimBound *get_cached_dimbound(const char *name);
+void release_dimbound(const GT3_DimBound *bnd);
+void clear_dim_cache(void);
+
+/* idreg.c */
+uint64_t idreg_hash(uint64_t hash, const void *data, size_t size);
+int idreg_lookup(const char *key);
+int idreg_register(const char *key, int id);
+void idreg_clear(void);
+
 /* timeaxis.c */
 int set_basetime(const char *str);
 int check_basetime(void);
@@ -67,6 +99,7 @@ int set_site_locations(const char *path);
 int set_deflate_level(int level);
 int set_shuffle(int shuffle);
 void set_safe_open(void);
+int set_slab_budget(int mbytes);
 int get_dim_prop(gtool3_dim_prop *dim, const GT3_HEADER *head, int idx);
 int set_axis_slice(int idx, const char *spec);
 void unset_axis_slice(void);
@@ -74,9 +107,93 @@ int set_calcexpr(const char *str);
 void unset_calcexpr(void);
 int set_positive(const char *str);
 void unset_positive(void);
+void unset_var_options(int batch);
 int set_time_slice(const char *str);
 int set_grid_mapping(const char *name);
 int convert(const char *varname, const char *inputfile, int cnt);
+int finish_convert(void);
+int add_batch_var(const char *name);
+int add_batch_file(const char *path);
+int convert_batch(void);
+
+/* bufpool.c */
+void *bufpool_get(size_t size);
+void bufpool_put(void *ptr);
+void bufpool_release(void *ptr);
+void bufpool_report(void);
+int set_mem_limit(int mbytes);
+size_t get_mem_limit(void);
+size_t bufpool_bytes(void);
+size_t mem_rss(void);
+
+/* stats.c */
+enum {
+    STAGE_OPEN,                 /* open and index input files */
+    STAGE_HEADER,               /* decode headers, check dates */
+    STAGE_SETUP,                /* axes, grid, variable, zfactors */
+    STAGE_READ,                 /* read_var() */
+    STAGE_CALC,                 /* eval_calc() */
+    STAGE_WRITE,                /* write_var(), cmor_write() */
+    NUM_STAGES
+};
+double stats_clock(void);
+int set_stats_report(const char *path);
+int stats_begin_var(const char *name);
+void stats_select(int idx);
+void stats_add(int stage, double start, size_t nbytes);
+void stats_add_step(void);
+int stats_report(int status);
+
+/* ioacct.c */
+enum {
+    IO_DATA,                    /* data records of input files */
+    IO_HEADER,                  /* headers of input files */
+    IO_AXIS,                    /* axis files and labels */
+    IO_OUTPUT,                  /* output files */
+    NUM_IO_CATEGORIES
+};
+enum {
+    IO_OPEN,
+    IO_READ,
+    IO_SEEK,
+    IO_WRITE,
+    NUM_IO_OPS
+};
+void set_io_stats(void);
+void io_account(int category, int op, const char *name,
+                size_t nbytes, double start);
+void io_report(void);
+void io_write_json(FILE *fp);
+
+/* trace.c */
+extern int trace_enabled;
+int set_trace_file(const char *path);
+void trace_thread_name(const char *name);
+void trace_span_arg(const char *name, double start,
+                    const char *argname, long argval);
+void trace_span(const char *name, double start);
+int finish_trace(void);
+
+/* fastwrite.c */
+void set_fast_write(void);
+int fast_write_enabled(void);
+int fast_write_ready(int var_id, size_t nelems);
+int fast_write(int var_id, const float *values, size_t nelems,
+               const double *time, const double *tbnd);
+int fast_write_nlevels(int var_id);
+int fast_write_slab(int var_id, const float *values, int lev0, int nlev,
+                    const double *time, const double *tbnd);
+
+/* staging.c */
+int set_staging_dir(const char *dir);
+int staging_enabled(void);
+const char *staging_outpath(const char *outdir);
+void register_output(int var_id);
+int stage_output(const char *path);
+int stage_variable(int var_id);
+int stage_outputs(void);
+int finish_staging(void);
+int copy_fd(int dest, int src);
 
 /* zfactor.c */
 int setup_zfactors(int *zfac_ids, int var_id,
@@ -96,6 +213,7 @@ int eval_calc(const char *expr, float *data, double miss, size_t size);
 int sdb_close(void);
 int sdb_open(const char *path);
 char *sdb_readitem(const char *item);
+void sdb_free(void);
 
 /* coord.c */
 int rotate_lonlat(double *lon, double *lat,
@@ -103,23 +221,80 @@ int rotate_lonlat(double *lon, double *lat,
                   int nlon, int nlat,
                   double phi, double theta, double psi);
 
+/* grid.c */
+struct cached_grid;
+typedef int (*grid_transform)(double *lon, double *lat,
+                              const double *x, const double *y,
+                              int xlen, int ylen);
+int build_grid(struct cached_grid *grid,
+               const double *x, const double *x_bnds, int xlen,
+               const double *y, const double *y_bnds, int ylen,
+               grid_transform transform);
+void free_grid(struct cached_grid *grid);
+
+/* gridcache.c */
+struct cached_grid {
+    double *lon, *lat;
+    double *lon_vertices, *lat_vertices;
+    void *map;
+    size_t mapsize;
+};
+typedef struct cached_grid cached_grid;
+
+int set_grid_cache_dir(const char *dir);
+void set_grid_cache_key(const char *mapping, const gtool3_dim_prop *dims,
+                        double plat,
+                        const double *x, const double *x_bnds, int xlen,
+                        const double *y, const double *y_bnds, int ylen);
+int load_grid_cache(cached_grid *grid, int len);
+void release_grid_cache(cached_grid *grid);
+int save_grid_cache(const double *lon, const double *lat,
+                    const double *lon_vertices, const double *lat_vertices,
+                    int len);
+
+/* spindex.c */
+typedef struct spindex spindex;
+
+int monotonicity(const double *xs, int size);
+int nearest_sorted(const double *xs, int size, int sign, double x);
+int nearest_sorted_modulo(const double *xs, int size, int sign, double x,
+                          double modulo);
+spindex *spindex_new(const double *lon, const double *lat, int len);
+void spindex_free(spindex *idx);
+int spindex_nearest(const spindex *idx, double lon, double lat);
+
 /* rotated_pole.c */
 int setup_rotated_pole(int *grid_id,
                        const double *rlon, const double *rlon_bnds,
                        int rlonlen,
                        const double *rlat, const double *rlat_bnds,
                        int rlatlen);
+int get_rotated_pole_lonlat(double *lon, double *lat,
+                            const double *rlon, int rlonlen,
+                            const double *rlat, int rlatlen);
 
 /* bipolar.c */
 int setup_bipolar(int *grid_id,
                   const double *x, const double *x_bnds, int xlen,
                   const double *y, const double *y_bnds, int ylen);
+int get_bipolar_lonlat(double *lon, double *lat,
+                       const double *x, int xlen,
+                       const double *y, int ylen);
 
 /* tripolar.c */
 int setup_tripolar(int *grid_id,
                    const double *xx, const double *x_bnds, int x_len,
                    const double *yy, const double *y_bnds, int y_len,
                    double plat);
+int get_tripolar_lonlat(double *lon, double *lat,
+                        const double *xx, int x_len,
+                        const double *yy, int y_len,
+                        double plat);
+
+/* tablesnap.c */
+int set_table_snapshot_dir(const char *dir);
+int load_table_snapshot(const char *path, int *table_id);
+int save_table_snapshot(const char *path, int table_id);
 
 /* editheader.c */
 void unset_header_edit(void);
@@ -0,0 +1,318 @@
+/*
+ * ioacct.c -- I/O accounting of input and output files.
+ *
+ * Calls of file operations (open, read, seek, write), their bytes,
+ * and time spent are counted per category (data, headers, axes,
+ * output), and per file with --io-stats. The counts are at the level
+ * of mipconv's calls into libgtool3, CMOR, and netCDF (one call may
+ * cost several system calls, or none if buffered).
+ *
+ * Only the main thread is accounted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "internal.h"
+
+struct io_count {
+    unsigned long calls;
+    double bytes;
+    double seconds;
+};
+
+struct io_file {
+    char *name;
+    int category;
+    struct io_count ops[NUM_IO_OPS];
+};
+
+static const char *category_names[] = {
+    "data",
+    "header",
+    "axis",
+    "output"
+};
+
+static const char *op_names[] = {
+    "open",
+    "read",
+    "seek",
+    "write"
+};
+
+static struct io_count totals[NUM_IO_CATEGORIES][NUM_IO_OPS];
+
+/* per file (with --io-stats), open addressing */
+static int per_file = 0;
+static struct io_file *files = NULL;
+static size_t nfiles = 0;
+static size_t nslots = 0;
+
+
+void
+set_io_stats(void)
+{
+    per_file = 1;
+}
+
+
+static size_t
+slot_of(const char *name, int category, size_t mask)
+{
+    uint64_t hash;
+
+    hash = idreg_hash(0xcbf29ce484222325ULL, name, strlen(name));
+    hash = idreg_hash(hash, &category, sizeof category);
+    return hash & mask;
+}
+
+
+static int
+grow_files(void)
+{
+    struct io_file *newfiles;
+    size_t newslots = nslots > 0 ? 2 * nslots : 256;
+    size_t i, k;
+
+    if ((newfiles = calloc(newslots, sizeof(struct io_file))) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    for (i = 0; i < nslots; i++) {
+        if (!files[i].name)
+            continue;
+        for (k = slot_of(files[i].name, files[i].category, newslots - 1);
+             newfiles[k].name;
+             k = (k + 1) & (newslots - 1))
+            ;
+        newfiles[k] = files[i];
+    }
+    free(files);
+    files = newfiles;
+    nslots = newslots;
+    return 0;
+}
+
+
+static struct io_file *
+lookup_file(const char *name, int category)
+{
+    struct io_file *p;
+    size_t k;
+
+    if (2 * (nfiles + 1) > nslots && grow_files() < 0)
+        return NULL;
+
+    for (k = slot_of(name, category, nslots - 1);
+         (p = files + k)->name;
+         k = (k + 1) & (nslots - 1))
+        if (p->category == category && strcmp(p->name, name) == 0)
+            return p;
+
+    if ((p->name = strdup(name)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return NULL;
+    }
+    p->category = category;
+    nfiles++;
+    return p;
+}
+
+
+static void
+add_count(struct io_count *c, size_t nbytes, double seconds)
+{
+    c->calls++;
+    c->bytes += nbytes;
+    c->seconds += seconds;
+}
+
+
+/*
+ * Account an operation on file 'name', which has started at 'start'
+ * (by stats_clock()).
+ */
+void
+io_account(int category, int op, const char *name,
+           size_t nbytes, double start)
+{
+    struct io_file *p;
+    double sec = stats_clock() - start;
+
+    add_count(&totals[category][op], nbytes, sec);
+
+    if (per_file && (p = lookup_file(name ? name : "-", category)) != NULL)
+        add_count(&p->ops[op], nbytes, sec);
+}
+
+
+static double
+rate(double bytes, double seconds)
+{
+    return seconds > 0. ? bytes / 1048576. / seconds : 0.;
+}
+
+
+static void
+log_counts(const char *label, const struct io_count *ops)
+{
+    int i;
+
+    for (i = 0; i < NUM_IO_OPS; i++)
+        if (ops[i].calls > 0)
+            logging(LOG_INFO,
+                    "io: %-6s %-5s %10lu call(s) %12.1f MB %9.3f s"
+                    " %9.1f MB/s",
+                    label, op_names[i], ops[i].calls,
+                    ops[i].bytes / 1048576., ops[i].seconds,
+                    rate(ops[i].bytes, ops[i].seconds));
+}
+
+
+static int
+cmp_files(const void *a, const void *b)
+{
+    const struct io_file *p = a, *q = b;
+
+    if (p->category != q->category)
+        return p->category - q->category;
+    return strcmp(p->name, q->name);
+}
+
+
+/*
+ * Sort the table of files (for output). No more lookup is possible.
+ */
+static void
+sort_files(void)
+{
+    size_t i, n;
+
+    for (i = n = 0; i < nslots; i++)
+        if (files[i].name)
+            files[n++] = files[i];
+    qsort(files, n, sizeof(struct io_file), cmp_files);
+    nslots = n;
+}
+
+
+/*
+ * Log the totals per category (and per file with --io-stats).
+ */
+void
+io_report(void)
+{
+    const struct io_count *c;
+    size_t i;
+    int k;
+
+    if (LOG_INFO >= logging_threshold)
+        for (k = 0; k < NUM_IO_CATEGORIES; k++)
+            log_counts(category_names[k], totals[k]);
+
+    if (!per_file)
+        return;
+
+    sort_files();
+    for (i = 0; i < nslots; i++) {
+        for (k = 0; k < NUM_IO_OPS; k++) {
+            c = files[i].ops + k;
+            if (c->calls == 0)
+                continue;
+            logging(LOG_NOTICE,
+                    "io-stats: %s %s %s: %lu call(s), %.0f bytes, %.6f s",
+                    category_names[files[i].category],
+                    files[i].name, op_names[k],
+                    c->calls, c->bytes, c->seconds);
+        }
+        free(files[i].name);
+    }
+    free(files);
+    files = NULL;
+    nfiles = nslots = 0;
+}
+
+
+static void
+write_json_ops(FILE *fp, const struct io_count *ops, const char *indent)
+{
+    int i;
+
+    for (i = 0; i < NUM_IO_OPS; i++)
+        fprintf(fp,
+                "%s\n%s\"%s\": {\"calls\": %lu, \"bytes\": %.0f, "
+                "\"seconds\": %.6f}",
+                i > 0 ? "," : "", indent, op_names[i],
+                ops[i].calls, ops[i].bytes, ops[i].seconds);
+}
+
+
+/*
+ * Write the totals per category as a JSON object (for --report).
+ */
+void
+io_write_json(FILE *fp)
+{
+    int k;
+
+    fprintf(fp, "{");
+    for (k = 0; k < NUM_IO_CATEGORIES; k++) {
+        fprintf(fp, "%s\n    \"%s\": {", k > 0 ? "," : "",
+                category_names[k]);
+        write_json_ops(fp, totals[k], "      ");
+        fprintf(fp, "\n    }");
+    }
+    fprintf(fp, "\n  }");
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+
+int
+test_ioacct(void)
+{
+    struct io_file *p;
+    char name[32];
+    double t0 = stats_clock();
+    int i;
+
+    set_io_stats();
+    io_account(IO_DATA, IO_READ, "a.gt3", 100, t0);
+    io_account(IO_DATA, IO_READ, "a.gt3", 200, t0);
+    io_account(IO_HEADER, IO_READ, "a.gt3", 1032, t0);
+    io_account(IO_DATA, IO_SEEK, "b.gt3", 0, t0);
+    assert(totals[IO_DATA][IO_READ].calls == 2);
+    assert(totals[IO_DATA][IO_READ].bytes == 300.);
+    assert(nfiles == 3);
+
+    p = lookup_file("a.gt3", IO_DATA);
+    assert(p->ops[IO_READ].calls == 2 && p->ops[IO_READ].bytes == 300.);
+
+    /* growing the table */
+    for (i = 0; i < 1000; i++) {
+        snprintf(name, sizeof name, "f%d", i);
+        io_account(IO_AXIS, IO_READ, name, 8, t0);
+    }
+    assert(nfiles == 1003);
+    p = lookup_file("b.gt3", IO_DATA);
+    assert(p->ops[IO_SEEK].calls == 1);
+    assert(nfiles == 1003);
+
+    sort_files();
+    assert(files[0].category == IO_DATA
+           && strcmp(files[0].name, "a.gt3") == 0);
+    for (i = 0; i < nslots; i++)
+        free(files[i].name);
+    free(files);
+    files = NULL;
+    nfiles = nslots = 0;
+    per_file = 0;
+    memset(totals, 0, sizeof totals);
+
+    printf("test_ioacct(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
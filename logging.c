@@ -1,27 +1,73 @@
 /*
  * logging.c
+ *
+ * A message is formatted into a single line (with a timestamp cached
+ * per second) and written by one fwrite(3). With set_logging_async(1),
+ * lines are passed through a bounded lock-free queue to a writer
+ * thread, so that callers do not wait for the output. When the queue
+ * is full, the caller waits for a free slot, so that the lines are
+ * written in order.
  */
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "logging.h"
 
+#define LINE_LOCAL 512
+#define QUEUE_SIZE 1024         /* power of 2 */
+
+int logging_threshold = LOG_NOTICE;
+
 static int low_level = LOG_NOTICE;
 static FILE *output = NULL;
 static int  needtoclose = 0;
 static char logging_name[32];
 
+/* cached timestamp (per thread) */
+static __thread time_t stamp_time = (time_t)-1;
+static __thread char stamp[48];
+
+struct line {
+    char *ptr;
+    size_t len;
+    size_t size;
+    char local[LINE_LOCAL];
+};
+
+/* asynchronous writer */
+struct slot {
+    size_t seq;
+    char *msg;                  /* NULL to stop the writer */
+    size_t len;
+};
+
+static struct slot queue[QUEUE_SIZE];
+static size_t enqueue_pos, dequeue_pos;
+static sem_t nqueued;
+static pthread_t writer;
+static int async_wanted = 0;
+static int async_running = 0;
+static int atexit_done = 0;
+
+
+static const char *labels[] = {
+    "INFO: ",
+    "NOTICE: ",
+    "WARN: ",
+    "ERROR: ",
+    "ERROR: "
+};
+
+
 static void
 default_prefix_func(FILE *fp, int type)
 {
-    const char *labels[] = {
-        "INFO: ",
-        "NOTICE: ",
-        "WARN: ",
-        "ERROR: ",
-        "ERROR: "
-    };
     char timestamp[32];
     time_t tval;
 
@@ -37,6 +83,227 @@ default_prefix_func(FILE *fp, int type)
 
 static void (*prefix_func)(FILE *fp, int type) = default_prefix_func;
 
+
+static void
+update_threshold(void)
+{
+    logging_threshold = output ? low_level : LOG_SYSERR + 1;
+}
+
+
+static const char *
+timestamp(void)
+{
+    struct tm tm;
+    time_t tval;
+
+    time(&tval);
+    if (tval != stamp_time) {
+        localtime_r(&tval, &tm);
+        strftime(stamp, sizeof stamp, "[%F %T %Z] ", &tm);
+        stamp_time = tval;
+    }
+    return stamp;
+}
+
+
+static int
+line_reserve(struct line *ln, size_t size)
+{
+    char *p;
+
+    if (size <= ln->size)
+        return 0;
+
+    if (ln->ptr == ln->local) {
+        if ((p = malloc(size)) == NULL)
+            return -1;
+        memcpy(p, ln->local, ln->len);
+    } else if ((p = realloc(ln->ptr, size)) == NULL)
+        return -1;
+
+    ln->ptr = p;
+    ln->size = size;
+    return 0;
+}
+
+
+static void
+line_vprintf(struct line *ln, const char *fmt, va_list ap)
+{
+    va_list aq;
+    int n;
+
+    va_copy(aq, ap);
+    n = vsnprintf(ln->ptr + ln->len, ln->size - ln->len, fmt, aq);
+    va_end(aq);
+    if (n < 0)
+        return;
+
+    if (ln->len + n >= ln->size) {
+        if (line_reserve(ln, ln->len + n + 1) == 0)
+            vsnprintf(ln->ptr + ln->len, ln->size - ln->len, fmt, ap);
+        else
+            n = ln->size - ln->len - 1; /* truncated */
+    }
+    ln->len += n;
+}
+
+
+static void
+line_printf(struct line *ln, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    line_vprintf(ln, fmt, ap);
+    va_end(ap);
+}
+
+
+/*
+ * Bounded MPMC queue by D. Vyukov. Return -1 if full.
+ */
+static int
+enqueue(char *msg, size_t len)
+{
+    struct slot *slot;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = queue + (pos & (QUEUE_SIZE - 1));
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0)
+            return -1;
+        else
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    }
+    slot->msg = msg;
+    slot->len = len;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    sem_post(&nqueued);
+    return 0;
+}
+
+
+static void *
+writer_main(void *arg)
+{
+    struct slot *slot;
+    char *msg;
+
+    for (;;) {
+        while (sem_wait(&nqueued) < 0 && errno == EINTR)
+            ;
+
+        /* the slot might be claimed but not filled yet */
+        slot = queue + (dequeue_pos & (QUEUE_SIZE - 1));
+        while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)
+               != dequeue_pos + 1)
+            sched_yield();
+
+        msg = slot->msg;
+        if (msg) {
+            fwrite(msg, 1, slot->len, output);
+            free(msg);
+        }
+        __atomic_store_n(&slot->seq, dequeue_pos + QUEUE_SIZE,
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&dequeue_pos, dequeue_pos + 1, __ATOMIC_RELEASE);
+
+        if (!msg)
+            break;
+        if (sem_trywait(&nqueued) == 0)
+            sem_post(&nqueued);
+        else
+            fflush(output);
+    }
+    fflush(output);
+    return NULL;
+}
+
+
+static int
+start_writer(void)
+{
+    size_t i;
+
+    if (async_running || !output)
+        return 0;
+
+    for (i = 0; i < QUEUE_SIZE; i++)
+        queue[i].seq = i;
+    enqueue_pos = dequeue_pos = 0;
+
+    if (sem_init(&nqueued, 0, 0) < 0)
+        return -1;
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+        sem_destroy(&nqueued);
+        return -1;
+    }
+    async_running = 1;
+    return 0;
+}
+
+
+/*
+ * Stop the writer thread after all the queued lines are written.
+ */
+static void
+stop_writer(void)
+{
+    if (!async_running)
+        return;
+
+    while (enqueue(NULL, 0) < 0)
+        sched_yield();
+    pthread_join(writer, NULL);
+    sem_destroy(&nqueued);
+    async_running = 0;
+}
+
+
+/*
+ * Pass a line to the writer thread, or write it directly.
+ *
+ * Lines are never written ahead of the ones queued before: if the
+ * queue is full, wait for the writer to free a slot, and if the line
+ * cannot be copied, wait for the queue to be drained.
+ */
+static void
+write_line(struct line *ln)
+{
+    char *msg;
+
+    if (async_running) {
+        if (ln->ptr != ln->local)
+            msg = ln->ptr;
+        else if ((msg = malloc(ln->len)) != NULL)
+            memcpy(msg, ln->ptr, ln->len);
+
+        if (msg) {
+            while (enqueue(msg, ln->len) < 0)
+                sched_yield();
+            ln->ptr = ln->local;
+            return;
+        }
+        /* out of memory: write it after the queued lines */
+        while (__atomic_load_n(&dequeue_pos, __ATOMIC_ACQUIRE)
+               != __atomic_load_n(&enqueue_pos, __ATOMIC_ACQUIRE))
+            sched_yield();
+    }
+    fwrite(ln->ptr, 1, ln->len, output);
+}
+
+
 static void
 set_logging_name(const char *name)
 {
@@ -54,13 +321,35 @@ set_logging_prefix_func(void (*func)(FILE *, int))
 }
 
 
+/*
+ * Write log messages by a background thread (flag != 0), or by the
+ * caller (flag == 0).
+ */
+int
+set_logging_async(int flag)
+{
+    async_wanted = flag;
+    if (!flag) {
+        stop_writer();
+        return 0;
+    }
+    if (!atexit_done) {
+        atexit(stop_writer);
+        atexit_done = 1;
+    }
+    return start_writer();
+}
+
+
 void
 close_logging(void)
 {
+    stop_writer();
     if (needtoclose)
         fclose(output);
     output = NULL;
     needtoclose = 0;
+    update_threshold();
 }
 
 
@@ -72,6 +361,9 @@ open_logging(FILE *fp, const char *name)
     output = fp;
     needtoclose = 0;
     set_logging_name(name);
+    update_threshold();
+    if (async_wanted)
+        start_writer();
 }
 
 
@@ -88,6 +380,9 @@ open_logfile(const char *path, const char *name, int append)
     output = fp;
     needtoclose = 1;
     set_logging_name(name);
+    update_threshold();
+    if (async_wanted)
+        start_writer();
     return 0;
 }
 
@@ -106,22 +401,130 @@ set_logging_level(const char *str)
     for (i = 0; i < sizeof tab / sizeof tab[0]; i++)
         if (strcmp(str, tab[i].key) == 0)
             low_level = tab[i].value;
+    update_threshold();
 }
 
 
 void
 logging(int type, const char *fmt, ...)
 {
+    int errnum = errno;
+    struct line ln;
     va_list ap;
 
+    if (!output || type < low_level)
+        return;
+
     va_start(ap, fmt);
-    if (output && type >= low_level) {
+    if (prefix_func != default_prefix_func) {
+        /* a user-defined prefix is written directly. */
         prefix_func(output, type);
         if (fmt)
             vfprintf(output, fmt, ap);
-        if (type == LOG_SYSERR && errno != 0)
-            fprintf(output, fmt ? ": %s" : "%s", strerror(errno));
+        if (type == LOG_SYSERR && errnum != 0)
+            fprintf(output, fmt ? ": %s" : "%s", strerror(errnum));
         fputc('\n', output);
+        va_end(ap);
+        return;
     }
+
+    ln.ptr = ln.local;
+    ln.len = 0;
+    ln.size = sizeof ln.local;
+    line_printf(&ln, "%s%s%s",
+                timestamp(),
+                logging_name,
+                (type >= 0 && type < sizeof labels / sizeof labels[0])
+                ? labels[type] : "");
+    if (fmt)
+        line_vprintf(&ln, fmt, ap);
+    if (type == LOG_SYSERR && errnum != 0)
+        line_printf(&ln, fmt ? ": %s" : "%s", strerror(errnum));
     va_end(ap);
+
+    line_printf(&ln, "\n");
+    if (ln.ptr[ln.len - 1] != '\n')
+        ln.ptr[ln.len - 1] = '\n';     /* truncated */
+
+    write_line(&ln);
+    if (ln.ptr != ln.local)
+        free(ln.ptr);
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+#include <unistd.h>
+
+int
+test_logging(void)
+{
+    FILE *saved_output = output;
+    int saved_level = low_level;
+    char saved_name[sizeof logging_name];
+    char path[] = "/tmp/loggingXXXXXX";
+    char buf[4096], expected[32];
+    const char *ts;
+    time_t tval;
+    FILE *fp;
+    int fd, i, n;
+
+    memcpy(saved_name, logging_name, sizeof logging_name);
+
+    /* cached timestamp: reformatted only when the second changes. */
+    ts = timestamp();
+    assert(ts == stamp && stamp_time != (time_t)-1);
+    do {
+        tval = stamp_time = time(NULL);
+        strcpy(stamp, "[cached] ");
+        ts = timestamp();
+    } while (time(NULL) != tval);
+    assert(strcmp(ts, "[cached] ") == 0);
+    stamp_time = 0;
+    assert(strcmp(timestamp(), "[cached] ") != 0 && stamp[0] == '[');
+
+    assert((fd = mkstemp(path)) >= 0);
+    assert((fp = fdopen(fd, "w+")) != NULL);
+
+    /* a line longer than LINE_LOCAL is written whole. */
+    open_logging(fp, "test");
+    set_logging_level("verbose");
+    memset(buf, 'x', 2000);
+    buf[2000] = '\0';
+    logging(LOG_INFO, "%s|", buf);
+    fflush(fp);
+    rewind(fp);
+    assert(fgets(buf, sizeof buf, fp) != NULL);
+    n = strlen(buf);
+    assert(n > 2000 + 2 && strcmp(buf + n - 3, "x|\n") == 0);
+    assert(strstr(buf, "test: INFO: xxx") != NULL);
+    assert(fgets(buf, sizeof buf, fp) == NULL);
+
+    /* ordered output with async on, through a full queue. */
+    assert(ftruncate(fd, 0) == 0);
+    rewind(fp);
+    assert(set_logging_async(1) == 0);
+    for (i = 0; i < 4 * QUEUE_SIZE; i++)
+        logging(LOG_NOTICE, "line %d", i);
+    assert(set_logging_async(0) == 0);
+    fflush(fp);
+    rewind(fp);
+    for (i = 0; fgets(buf, sizeof buf, fp); i++) {
+        snprintf(expected, sizeof expected, "NOTICE: line %d\n", i);
+        assert(strstr(buf, expected) != NULL);
+    }
+    assert(i == 4 * QUEUE_SIZE);
+
+    close_logging();
+    fclose(fp);
+    unlink(path);
+
+    output = saved_output;
+    low_level = saved_level;
+    memcpy(logging_name, saved_name, sizeof logging_name);
+    update_threshold();
+
+    printf("test_logging(): DONE\n");
+    return 0;
 }
+#endif /* TEST_MAIN2 */
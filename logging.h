@@ -20,11 +20,25 @@ enum {
     LOG_SYSERR
 };
 
+/* the lowest level to be written (above LOG_SYSERR if no output) */
+extern int logging_threshold;
+
+/*
+ * LOGGING() does not evaluate the arguments if the message is not
+ * written, e.g., LOGGING(LOG_INFO, ...) without verbose mode.
+ */
+#define LOGGING(type, ...) \
+    do { \
+        if ((type) >= logging_threshold) \
+            logging((type), __VA_ARGS__); \
+    } while (0)
+
 void set_logging_prefix_func(void (*func)(FILE *, int));
 void open_logging(FILE *fp, const char *name);
 int open_logfile(const char *path, const char *name, int append);
 void close_logging(void);
 void set_logging_level(const char *str);
+int set_logging_async(int flag);
 void logging(int type, const char *fmt, ...);
 
 #ifdef __cplusplus
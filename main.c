@@ -2,6 +2,9 @@
  * main.c -- data converter using CMOR3 (from gtool3 to netcdf).
  */
 #include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,29 +23,66 @@
 #define PROGNAME "mipconv"
 
 
+static const char optswitch[] = "ceptuzH";
+
+/* long options */
+enum {
+    OPT_REPORT = 256,
+    OPT_TRACE,
+    OPT_IO_STATS,
+    OPT_MEM_LIMIT
+};
+
+static const struct option long_options[] = {
+    { "report", required_argument, NULL, OPT_REPORT },
+    { "trace", required_argument, NULL, OPT_TRACE },
+    { "io-stats", no_argument, NULL, OPT_IO_STATS },
+    { "mem-limit", required_argument, NULL, OPT_MEM_LIMIT },
+    { NULL, 0, NULL, 0 }
+};
+
+/*
+ * batch mode (-x): variables are converted in a single pass.
+ * Var options which act on each variable are not available.
+ */
+static int batch_mode = 0;
+static const char batch_optswitch[] = "ctH";
+
+
+static int
+is_input_file(const char *arg)
+{
+    return !(arg[0] == ':' || (arg[0] == '=' && strchr(optswitch, arg[1])));
+}
+
+
 static int
 process_args(int argc, char **argv)
 {
-    const char optswitch[] = "ceptuzH";
     int rval = 0;
     char *vname = NULL;
     int cnt = 0;
+    int rc;
 
     for (; argc > 0 && *argv; argc--, argv++) {
         if (*argv[0] == ':') {
-            unset_varunit();
-            unset_calcexpr();
-            unset_positive();
-            sdb_close();
-            unset_axis_slice();
-            unset_header_edit();
+            unset_var_options(batch_mode);
             vname = *argv + 1;
             cnt++;
             logging(LOG_INFO, "variable name: (%s)", vname);
+            if (batch_mode && add_batch_var(vname) < 0)
+                return -1;
             continue;
         }
 
         if (*argv[0] == '=' && strchr(optswitch, argv[0][1])) {
+            if (batch_mode
+                && (cnt > 0 || !strchr(batch_optswitch, argv[0][1]))) {
+                logging(LOG_ERR, "%s: Not available with -x "
+                        "(=c, =t, and =H before the first variable only).",
+                        *argv);
+                return -1;
+            }
             switch (argv[0][1]) {
             case 'c':
                 if (sdb_open(*argv + 2) < 0)
@@ -90,18 +130,48 @@ process_args(int argc, char **argv)
             break;
         }
 
+        if (batch_mode) {
+            if (add_batch_file(*argv) < 0)
+                return -1;
+            continue;
+        }
+
         logging(LOG_INFO, "input file: (%s)", *argv);
-        if (convert(vname, *argv, cnt) < 0) {
+        rc = convert(vname, prefetched_path(*argv), cnt);
+        release_prefetched(*argv);
+        if (rc < 0) {
             logging(LOG_ERR, "%s: failed.", *argv);
             rval = -1;
             break;
         }
         vname = NULL;
     }
+    if (batch_mode && rval == 0)
+        rval = convert_batch();
+    if (!batch_mode && rval == 0)
+        rval = finish_convert();
     return rval;
 }
 
 
+/*
+ * Return a size in MB, or -1 if 'str' is not a non-negative integer.
+ */
+static int
+get_mbytes(const char *str)
+{
+    char *endptr;
+    long val;
+
+    errno = 0;
+    val = strtol(str, &endptr, 10);
+    if (endptr == str || *endptr != '\0' || errno == ERANGE
+        || val < 0 || val > INT_MAX)
+        return -1;
+    return (int)val;
+}
+
+
 static void
 print_version(FILE *fp)
 {
@@ -127,9 +197,22 @@ usage(void)
         "\n"
         "Options:\n"
         "    -3           use netCDF3 format.\n"
+        "    -A bundle    look up axes in an axis bundle (made by\n"
+        "                 mkaxisbundle) before GTAXLOC files.\n"
         "    -b basetime  specify a basetime.\n"
         "    -D int1.int2 specify deflate level and shuffle (default: 6.1).\n"
+        "    -F           fast-write mode (write time steps after the first\n"
+        "                 directly into netCDF).\n"
+        "    -S DIR       stage output files in DIR (e.g., local scratch),\n"
+        "                 and copy them into output directory.\n"
+        "    -G DIR       cache computed grids (for -g) in DIR.\n"
+        "    -I DIR       prefetch input files into DIR (e.g., local scratch).\n"
+        "    -L           write log messages by a background thread.\n"
+        "    -P int1.int2 specify the number of files prefetched ahead and\n"
+        "                 the limit of disk usage in MB (default: 2.0).\n"
         "    -M           specify a directory which contains CMIP6_*.json.\n"
+        "    -T DIR       cache parsed MIP tables in DIR (experimental,\n"
+        "                 if built with USE_TABLE_SNAPSHOT).\n"
         "    -d DIR       specify output directory.\n"
         "    -f conffile  specify global attribute file.\n"
         "    -g mapping   specify grid mapping.\n"
@@ -138,8 +221,25 @@ usage(void)
         "    -m mode      specify writing mode(\"preserve\" or \"replace\").\n"
         "                 (default: \"replace\")\n"
         "    -s           safe mode.\n"
+        "    -Z MB        process 3-D fields by slabs of z-levels within\n"
+        "                 MB megabytes (requires -F except for sites).\n"
+        "    -x           convert all the variables in a single pass\n"
+        "                 (input files must be aligned; zfactors such as\n"
+        "                 ps are read once for every variable).\n"
         "    -v           verbose mode.\n"
         "    -h           print this message.\n"
+        "    --report file\n"
+        "                 write timing and throughput of each variable\n"
+        "                 in JSON.\n"
+        "    --trace file\n"
+        "                 write a timeline of the run in Chrome trace-event\n"
+        "                 format (for Perfetto).\n"
+        "    --io-stats   print I/O counts (calls, bytes, and time)\n"
+        "                 of each file.\n"
+        "    --mem-limit MB\n"
+        "                 keep memory (RSS) within MB megabytes: process\n"
+        "                 by slabs (as -Z) if needed, or fail before\n"
+        "                 exceeding it.\n"
         "\n";
     const char *usage_message2 =
         "Var Options:\n"
@@ -156,6 +256,7 @@ usage(void)
         "  $ ./mipconv -M ../Tables user_input.json CMIP6_Amon.json :ps y*/Ps\n"
         "  $ ./mipconv -M ../Tables user_input.json CMIP6_Amon.json :rlut =pup y*/olr\n"
         "  $ ./mipconv -M ../Tables user_input.json CMIP6_Amon.json :cl y*/cldfrc :ps y*/Ps\n"
+        "  $ ./mipconv -x -M ../Tables user_input.json CMIP6_Amon.json :cl y*/cldfrc :ta y*/T :ps y*/Ps\n"
         "\n";
 
     print_version(stderr);
@@ -168,17 +269,21 @@ usage(void)
 int
 main(int argc, char **argv)
 {
-    int ch, rval = 0;
+    int ch, i, rval = 0;
     FILE *fp = NULL;
     int ntables = 1;
     char *mipdir = NULL;
     char *outputdir = NULL;
     int deflate_params[] = {-1, -1};
+    int prefetch_params[] = {2, 0};
+    double t0;
 
     open_logging(stderr, PROGNAME);
     GT3_setProgname(PROGNAME);
 
-    while ((ch = getopt(argc, argv, "34b:D:M:d:f:g:l:m:svh")) != -1)
+    while ((ch = getopt_long(argc, argv,
+                             "34A:G:I:LP:b:D:FM:S:T:d:f:g:l:m:svxZ:h",
+                             long_options, NULL)) != -1)
         switch (ch) {
         case '3':
             use_netcdf(3);
@@ -186,6 +291,32 @@ main(int argc, char **argv)
         case '4':
             use_netcdf(4);
             break;
+        case 'A':
+            if (set_axis_bundle(optarg) < 0)
+                exit(1);
+            break;
+        case 'G':
+            if (set_grid_cache_dir(optarg) < 0)
+                exit(1);
+            break;
+        case 'I':
+            if (set_prefetch_dir(optarg) < 0)
+                exit(1);
+            break;
+        case 'L':
+            if (set_logging_async(1) < 0) {
+                logging(LOG_SYSERR, "-L");
+                exit(1);
+            }
+            break;
+        case 'P':
+            if (get_ints(prefetch_params, 2, optarg, '.') < 1
+                || set_prefetch_params(prefetch_params[0],
+                                       prefetch_params[1]) < 0) {
+                logging(LOG_ERR, "%s: Invalid argument for -P.", optarg);
+                exit(1);
+            }
+            break;
         case 'b':
             if (set_basetime(optarg) < 0) {
                 logging(LOG_ERR, "%s: Invalid argument for -b.", optarg);
@@ -200,12 +331,23 @@ main(int argc, char **argv)
                 exit(1);
             }
             break;
+        case 'F':
+            set_fast_write();
+            break;
         case 'M':
             if ((mipdir = strdup(optarg)) == NULL) {
                 logging(LOG_SYSERR, optarg);
                 exit(1);
             }
             break;
+        case 'S':
+            if (set_staging_dir(optarg) < 0)
+                exit(1);
+            break;
+        case 'T':
+            if (set_table_snapshot_dir(optarg) < 0)
+                exit(1);
+            break;
         case 'd':
             if ((outputdir = strdup(optarg)) == NULL) {
                 logging(LOG_SYSERR, optarg);
@@ -245,10 +387,38 @@ main(int argc, char **argv)
         case 's':
             set_safe_open();
             break;
+        case 'x':
+            batch_mode = 1;
+            break;
+        case 'Z':
+            if (set_slab_budget(get_mbytes(optarg)) < 0) {
+                logging(LOG_ERR, "%s: Invalid argument for -Z.", optarg);
+                exit(1);
+            }
+            break;
         case 'v':
             print_version(stderr);
             set_logging_level("verbose");
             break;
+        case OPT_REPORT:
+            if (set_stats_report(optarg) < 0)
+                exit(1);
+            break;
+        case OPT_TRACE:
+            if (set_trace_file(optarg) < 0)
+                exit(1);
+            trace_thread_name("main");
+            break;
+        case OPT_IO_STATS:
+            set_io_stats();
+            break;
+        case OPT_MEM_LIMIT:
+            if (set_mem_limit(get_mbytes(optarg)) < 0) {
+                logging(LOG_ERR, "%s: Invalid argument for --mem-limit.",
+                        optarg);
+                exit(1);
+            }
+            break;
         case 'h':
             usage();
             exit(0);
@@ -268,8 +438,10 @@ main(int argc, char **argv)
     /*
      * setup CMOR.
      */
+    t0 = stats_clock();
     if (setup(mipdir, outputdir, *argv) < 0)
         exit(1);
+    trace_span("setup", t0);
     argc--;
     argv++;
 
@@ -283,8 +455,32 @@ main(int argc, char **argv)
 
     argv += ntables;
     argc -= ntables;
+    if (prefetch_enabled() && batch_mode)
+        logging(LOG_WARN, "-I is ignored with -x.");
+    else if (prefetch_enabled()) {
+        for (i = 0; i < argc; i++)
+            if (is_input_file(argv[i]) && add_prefetch(argv[i]) < 0)
+                exit(1);
+        if (start_prefetch() < 0)
+            exit(1);
+    }
     rval = process_args(argc, argv);
+    clear_dim_cache();
+    sdb_free();
+    unset_axis_bundle();
+    finish_prefetch();
+    if (rval == 0 && stage_outputs() < 0)
+        rval = -1;
     cmor_close();
+    idreg_clear();
+    if (finish_staging() < 0)
+        rval = -1;
+    bufpool_report();
+    io_report();
+    if (stats_report(rval) < 0)
+        rval = -1;
+    if (finish_trace() < 0)
+        rval = -1;
     logging(LOG_INFO, rval == 0 ? "SUCCESSFUL END" : "ABNORMAL END");
     return rval < 0 ? 1 : 0;
 }
@@ -54,6 +54,7 @@ main(int argc, char **argv)
 #ifdef TEST_MAIN2
     test_cmor_supp();
     test_axis();
+    test_axisbundle();
     test_timeaxis();
     test_converter();
     test_zfactor();
@@ -63,6 +64,22 @@ main(int argc, char **argv)
     /* test_rotated_pole(); */
     test_bipolar();
     test_tripolar();
+    test_fastwrite();
+    test_bufpool();
+    test_gridcache();
+    test_grid();
+    test_spindex();
+    test_dimcache();
+    test_idreg();
+    test_sdb();
+    test_stats();
+    test_trace();
+    test_ioacct();
+    test_tablesnap();
+    test_staging();
+    test_var();
+    test_prefetch();
+    test_logging();
 #endif
 
     printf("ALL TESTS DONE\n");
@@ -0,0 +1,364 @@
+/*
+ * mkaxisbundle.c -- make an axis bundle of a GTAXLOC directory.
+ *
+ * All the axes (GTAXLOC.*), their bounds, and labels of character
+ * axes (GTAXLOC.*.txt) are put into a single file, which is used by
+ * "mipconv -A".
+ */
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gtool3.h"
+#include "logging.h"
+#include "axisbundle.h"
+#include "myutils.h"
+
+#define PROGNAME "mkaxisbundle"
+#define PREFIX "GTAXLOC."
+
+#ifndef PATH_MAX
+#  define PATH_MAX 1024
+#endif
+
+struct buffer {
+    char *ptr;
+    size_t size;
+    size_t capacity;
+};
+
+static struct buffer data;          /* placed after the header */
+static struct bundle_entry *entries = NULL;
+static int nentries = 0;
+static int maxentries = 0;
+
+
+/*
+ * Append 'size' bytes aligned on 'align' bytes.
+ * Return the offset in the bundle.
+ */
+static int64_t
+append(const void *ptr, size_t size, size_t align)
+{
+    size_t pos = (data.size + align - 1) / align * align;
+    char *p;
+
+    if (pos + size > data.capacity) {
+        size_t newcap = data.capacity > 0 ? data.capacity : 4096;
+
+        while (pos + size > newcap)
+            newcap *= 2;
+        if ((p = realloc(data.ptr, newcap)) == NULL) {
+            logging(LOG_SYSERR, NULL);
+            exit(1);
+        }
+        data.ptr = p;
+        data.capacity = newcap;
+    }
+    memset(data.ptr + data.size, 0, pos - data.size);
+    memcpy(data.ptr + pos, ptr, size);
+    data.size = pos + size;
+    return sizeof(struct bundle_header) + pos;
+}
+
+
+static int64_t
+append_string(const char *str)
+{
+    return str ? append(str, strlen(str) + 1, 1) : 0;
+}
+
+
+static struct bundle_entry *
+new_entry(const char *name, int kind)
+{
+    struct bundle_entry *ent;
+
+    if (nentries == maxentries) {
+        int newmax = maxentries > 0 ? 2 * maxentries : 256;
+
+        if ((ent = realloc(entries, sizeof(struct bundle_entry) * newmax))
+            == NULL) {
+            logging(LOG_SYSERR, NULL);
+            exit(1);
+        }
+        entries = ent;
+        maxentries = newmax;
+    }
+    ent = entries + nentries++;
+    memset(ent, 0, sizeof(struct bundle_entry));
+    strlcpy(ent->name, name, sizeof ent->name);
+    ent->kind = kind;
+    return ent;
+}
+
+
+static int
+has_suffix(const char *name, const char *suffix)
+{
+    size_t len = strlen(name), slen = strlen(suffix);
+
+    return len > slen && strcmp(name + len - slen, suffix) == 0;
+}
+
+
+static int
+add_dim(const char *name)
+{
+    struct bundle_entry *ent;
+    GT3_Dim *dim;
+    GT3_DimBound *bnd;
+
+    if ((dim = GT3_getDim(name)) == NULL) {
+        GT3_printErrorMessages(stderr);
+        return -1;
+    }
+    ent = new_entry(name, BUNDLE_DIM);
+    ent->len = dim->len;
+    ent->aux = dim->cyclic;
+    ent->data_off = append(dim->values, sizeof(double) * dim->len, 8);
+    ent->title_off = append_string(dim->title);
+    ent->unit_off = append_string(dim->unit);
+    ent->range[0] = dim->range[0];
+    ent->range[1] = dim->range[1];
+    GT3_freeDim(dim);
+
+    /*
+     * Bounds given by libgtool3. Bounds in "*.M" are added as
+     * an axis by itself.
+     */
+    if (!has_suffix(name, ".M")) {
+        if ((bnd = GT3_getDimBound(name)) == NULL)
+            GT3_clearLastError();
+        else {
+            ent = new_entry(name, BUNDLE_DIMBOUND);
+            ent->len = bnd->len;
+            ent->aux = bnd->len_orig;
+            ent->data_off = append(bnd->bnd, sizeof(double) * bnd->len, 8);
+            GT3_freeDimBound(bnd);
+        }
+    }
+    return 0;
+}
+
+
+static int
+add_labels(const char *name, const char *path)
+{
+    struct bundle_entry *ent;
+    FILE *fp;
+    char *buf = NULL;
+    long size;
+    int rval = -1;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        logging(LOG_SYSERR, path);
+        return -1;
+    }
+    if (fseek(fp, 0L, SEEK_END) < 0
+        || (size = ftell(fp)) < 0
+        || fseek(fp, 0L, SEEK_SET) < 0) {
+        logging(LOG_SYSERR, path);
+        goto finish;
+    }
+    if ((buf = malloc(size + 1)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+    if (fread(buf, 1, size, fp) != size) {
+        logging(LOG_SYSERR, path);
+        goto finish;
+    }
+    ent = new_entry(name, BUNDLE_LABELS);
+    ent->len = size;
+    ent->data_off = size > 0 ? append(buf, size, 1) : 0;
+    rval = 0;
+
+finish:
+    free(buf);
+    fclose(fp);
+    return rval;
+}
+
+
+static int
+write_bundle(const char *path)
+{
+    struct bundle_header head;
+    int32_t *buckets;
+    int nbuckets, i;
+    uint32_t mask, k;
+    size_t pad;
+    FILE *fp;
+
+    for (nbuckets = 16; nbuckets < 2 * nentries; nbuckets *= 2)
+        ;
+    if ((buckets = malloc(sizeof(int32_t) * nbuckets)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    for (i = 0; i < nbuckets; i++)
+        buckets[i] = -1;
+
+    mask = nbuckets - 1;
+    for (i = 0; i < nentries; i++) {
+        for (k = bundle_hash(entries[i].name, entries[i].kind) & mask;
+             buckets[k] >= 0;
+             k = (k + 1) & mask)
+            ;
+        buckets[k] = i;
+    }
+
+    pad = (8 - data.size % 8) % 8;
+    memset(&head, 0, sizeof head);
+    memcpy(head.magic, AXIS_BUNDLE_MAGIC, 8);
+    head.version = AXIS_BUNDLE_VERSION;
+    head.nentries = nentries;
+    head.nbuckets = nbuckets;
+    head.entries_off = sizeof head + data.size + pad;
+    head.buckets_off = head.entries_off
+        + sizeof(struct bundle_entry) * nentries;
+    head.size = head.buckets_off + sizeof(int32_t) * nbuckets;
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        logging(LOG_SYSERR, path);
+        free(buckets);
+        return -1;
+    }
+    if (fwrite(&head, sizeof head, 1, fp) != 1
+        || fwrite(data.ptr, 1, data.size, fp) != data.size
+        || fwrite("\0\0\0\0\0\0\0", 1, pad, fp) != pad
+        || fwrite(entries, sizeof(struct bundle_entry), nentries, fp)
+           != nentries
+        || fwrite(buckets, sizeof(int32_t), nbuckets, fp) != nbuckets
+        || fclose(fp) != 0) {
+        logging(LOG_SYSERR, path);
+        free(buckets);
+        return -1;
+    }
+    free(buckets);
+    return 0;
+}
+
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: " PROGNAME " [-o output] directory\n"
+            "\n"
+            "Make an axis bundle of GTAXLOC.* in the directory.\n"
+            "The directory is used as GTAXDIR while loading axes.\n"
+            "\n"
+            "Options:\n"
+            "    -o output    specify output file"
+            " (default: axis.bundle).\n"
+            "    -h           print this message.\n");
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const char *output = "axis.bundle";
+    char path[PATH_MAX + 1], name[256];
+    char **names = NULL;
+    int nnames = 0, maxnames = 0;
+    DIR *dir;
+    struct dirent *ent;
+    int ch, i, labels, nerr = 0;
+
+    open_logging(stderr, PROGNAME);
+    GT3_setProgname(PROGNAME);
+
+    while ((ch = getopt(argc, argv, "o:h")) != -1)
+        switch (ch) {
+        case 'o':
+            output = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+
+    if (argc - optind != 1) {
+        usage();
+        exit(1);
+    }
+
+    if ((dir = opendir(argv[optind])) == NULL) {
+        logging(LOG_SYSERR, argv[optind]);
+        exit(1);
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (!startswith(ent->d_name, PREFIX)
+            || ent->d_name[sizeof PREFIX - 1] == '\0')
+            continue;
+
+        if (nnames == maxnames) {
+            maxnames = maxnames > 0 ? 2 * maxnames : 256;
+            if ((names = realloc(names, sizeof(char *) * maxnames)) == NULL) {
+                logging(LOG_SYSERR, NULL);
+                exit(1);
+            }
+        }
+        if ((names[nnames++] = strdup(ent->d_name)) == NULL) {
+            logging(LOG_SYSERR, NULL);
+            exit(1);
+        }
+    }
+    closedir(dir);
+    qsort(names, nnames, sizeof(char *), compare_names);
+
+    if (setenv("GTAXDIR", argv[optind], 1) < 0) {
+        logging(LOG_SYSERR, NULL);
+        exit(1);
+    }
+
+    for (i = 0; i < nnames; i++) {
+        /* "GTAXLOC.xxx" -> "xxx" */
+        strlcpy(name, names[i] + sizeof PREFIX - 1, sizeof name);
+        if ((labels = has_suffix(name, ".txt")))
+            name[strlen(name) - 4] = '\0';
+        if (strlen(name) >= sizeof entries[0].name) {
+            logging(LOG_WARN, "%s: too long name (skipped).", names[i]);
+            continue;
+        }
+
+        if (labels) {
+            snprintf(path, sizeof path, "%s/%s", argv[optind], names[i]);
+            if (add_labels(name, path) < 0)
+                nerr++;
+        } else if (add_dim(name) < 0) {
+            logging(LOG_WARN, "%s: failed to load (skipped).", names[i]);
+            nerr++;
+        }
+    }
+
+    if (write_bundle(output) < 0)
+        exit(1);
+    logging(LOG_NOTICE, "%s: %d entries (%d error(s)).",
+            output, nentries, nerr);
+
+    for (i = 0; i < nnames; i++)
+        free(names[i]);
+    free(names);
+    free(entries);
+    free(data.ptr);
+    return nerr > 0 ? 1 : 0;
+}
@@ -12,6 +12,7 @@ int copysubst(char *dest, size_t len,
 int startswith(const char *s1, const char *s2);
 int startswith_nocase(const char *s1, const char *s2);
 
+char *trimmed_tail(const char *str);
 size_t read_logicline(char *dest, size_t ndest, FILE *fp);
 
 int iarray_cmp(const int *a, const int *b, size_t nelems);
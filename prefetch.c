@@ -0,0 +1,472 @@
+/*
+ * prefetch.c -- stage input files in local scratch.
+ *
+ * While a file is converted, worker threads copy the following input
+ * files (at most 'depth' files ahead) into a local directory.
+ * convert() reads the local copy, which is removed when it is done.
+ * The total size of local copies is kept under 'cap' bytes
+ * (except for the file which is needed right now).
+ * The local copies are removed even if exit() is called on error.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "internal.h"
+
+#ifndef PATH_MAX
+#  define PATH_MAX 1024
+#endif
+
+#define MAX_WORKERS 8
+
+enum {
+    PF_WAITING,
+    PF_COPYING,
+    PF_READY,
+    PF_FAILED,
+    PF_DONE
+};
+
+struct prefetch_entry {
+    char *src;
+    char *local;
+    off_t size;
+    int state;
+};
+
+static char *prefetch_dir = NULL;
+static int depth = 2;
+static off_t cap = 0;                   /* 0: unlimited */
+
+static struct prefetch_entry *entries = NULL;
+static int nentries = 0;
+static int max_entries = 0;
+
+static int next_entry = 0;              /* next entry to be copied */
+static int cursor = 0;                  /* entry being converted */
+static off_t used_bytes = 0;
+static int stopping = 0;
+static int atexit_done = 0;
+
+static pthread_t workers[MAX_WORKERS];
+static int nworkers = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+
+int
+set_prefetch_dir(const char *dir)
+{
+    struct stat sb;
+
+    if (stat(dir, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        logging(LOG_ERR, "%s: not a directory.", dir);
+        return -1;
+    }
+    free(prefetch_dir);
+    if ((prefetch_dir = strdup(dir)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * depth: the number of files copied ahead.
+ * cap_mb: the limit of local disk usage in MB (0: unlimited).
+ */
+int
+set_prefetch_params(int depth_, int cap_mb)
+{
+    if (depth_ < 1 || cap_mb < 0)
+        return -1;
+
+    depth = depth_;
+    cap = (off_t)cap_mb << 20;
+    return 0;
+}
+
+
+int
+prefetch_enabled(void)
+{
+    return prefetch_dir != NULL;
+}
+
+
+/*
+ * Add an input file in order of conversion.
+ */
+int
+add_prefetch(const char *path)
+{
+    struct prefetch_entry *ent;
+
+    if (nentries == max_entries) {
+        int newsize = max_entries > 0 ? 2 * max_entries : 64;
+        struct prefetch_entry *p;
+
+        if ((p = realloc(entries, sizeof(*p) * newsize)) == NULL) {
+            logging(LOG_SYSERR, NULL);
+            return -1;
+        }
+        entries = p;
+        max_entries = newsize;
+    }
+
+    ent = entries + nentries;
+    if ((ent->src = strdup(path)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    ent->local = NULL;
+    ent->size = 0;
+    ent->state = PF_WAITING;
+    nentries++;
+    return 0;
+}
+
+
+static int
+copy_to_local(struct prefetch_entry *ent, int idx)
+{
+    char path[PATH_MAX + 1];
+    const char *base;
+    int src = -1, fd = -1;
+    int rval = -1;
+
+    base = strrchr(ent->src, '/');
+    base = base ? base + 1 : ent->src;
+    if (snprintf(path, sizeof path, "%s/mipconv%d-%d-%s",
+                 prefetch_dir, (int)getpid(), idx, base) >= sizeof path
+        || (ent->local = strdup(path)) == NULL)
+        return -1;
+
+    if ((src = open(ent->src, O_RDONLY)) < 0) {
+        logging(LOG_SYSERR, ent->src);
+        goto finish;
+    }
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0
+        || copy_fd(fd, src) < 0) {
+        logging(LOG_SYSERR, path);
+        goto finish;
+    }
+    if (close(fd) < 0) {
+        fd = -1;
+        logging(LOG_SYSERR, path);
+        goto finish;
+    }
+    fd = -1;
+    rval = 0;
+
+finish:
+    if (fd >= 0)
+        close(fd);
+    if (src >= 0)
+        close(src);
+    if (rval < 0 && ent->local) {
+        unlink(ent->local);
+        free(ent->local);
+        ent->local = NULL;
+    }
+    return rval;
+}
+
+
+static void *
+prefetch_worker(void *arg)
+{
+    struct prefetch_entry *ent;
+    struct stat sb;
+    off_t size;
+    double t0;
+    int idx, rc;
+
+    trace_thread_name("prefetch");
+    pthread_mutex_lock(&mutex);
+    for (;;) {
+        while (!stopping
+               && (next_entry >= nentries || next_entry > cursor + depth))
+            pthread_cond_wait(&cond, &mutex);
+        if (stopping)
+            break;
+
+        idx = next_entry++;
+        ent = entries + idx;
+        ent->state = PF_COPYING;
+        pthread_mutex_unlock(&mutex);
+
+        size = stat(ent->src, &sb) == 0 ? sb.st_size : 0;
+
+        /*
+         * wait for space in local disk.
+         */
+        pthread_mutex_lock(&mutex);
+        while (!stopping && idx > cursor
+               && cap > 0 && used_bytes > 0 && used_bytes + size > cap)
+            pthread_cond_wait(&cond, &mutex);
+        if (stopping) {
+            ent->state = PF_FAILED;
+            break;
+        }
+        used_bytes += size;
+        ent->size = size;
+        pthread_mutex_unlock(&mutex);
+
+        t0 = stats_clock();
+        rc = copy_to_local(ent, idx);
+        trace_span_arg("prefetch", t0, "file", idx);
+
+        pthread_mutex_lock(&mutex);
+        if (rc < 0) {
+            used_bytes -= size;
+            ent->state = PF_FAILED;
+        } else
+            ent->state = PF_READY;
+        pthread_cond_broadcast(&cond);
+    }
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+
+int
+start_prefetch(void)
+{
+    int n;
+
+    if (!prefetch_dir || nentries == 0)
+        return 0;
+
+    if (!atexit_done) {
+        atexit(finish_prefetch);
+        atexit_done = 1;
+    }
+    n = depth < MAX_WORKERS ? depth : MAX_WORKERS;
+    for (nworkers = 0; nworkers < n; nworkers++)
+        if (pthread_create(workers + nworkers, NULL,
+                           prefetch_worker, NULL) != 0) {
+            logging(LOG_ERR, "failed to start a prefetch thread.");
+            break;
+        }
+
+    logging(LOG_INFO, "prefetch: %d files, depth = %d, %d threads",
+            nentries, depth, nworkers);
+    return nworkers > 0 ? 0 : -1;
+}
+
+
+/*
+ * Return a path to be read instead of 'path'.
+ * If 'path' is not prefetched, it is returned as it is.
+ */
+const char *
+prefetched_path(const char *path)
+{
+    struct prefetch_entry *ent;
+    const char *rval = path;
+
+    if (nworkers == 0)
+        return path;
+
+    pthread_mutex_lock(&mutex);
+    if (cursor < nentries && strcmp(entries[cursor].src, path) == 0) {
+        ent = entries + cursor;
+        while (ent->state == PF_WAITING || ent->state == PF_COPYING)
+            pthread_cond_wait(&cond, &mutex);
+
+        if (ent->state == PF_READY)
+            rval = ent->local;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (rval != path)
+        logging(LOG_INFO, "prefetched: %s", rval);
+    return rval;
+}
+
+
+/*
+ * Remove the local copy of 'path', which is no longer needed.
+ */
+void
+release_prefetched(const char *path)
+{
+    struct prefetch_entry *ent;
+
+    if (nworkers == 0)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    if (cursor < nentries && strcmp(entries[cursor].src, path) == 0) {
+        ent = entries + cursor;
+        if (ent->state == PF_READY) {
+            unlink(ent->local);
+            used_bytes -= ent->size;
+        }
+        ent->state = PF_DONE;
+        cursor++;
+        pthread_cond_broadcast(&cond);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+
+/*
+ * Stop the workers, and remove the remaining local copies.
+ * A copy in progress is finished (and removed) first.
+ */
+void
+finish_prefetch(void)
+{
+    int i;
+
+    if (nworkers == 0)
+        return;
+
+    pthread_mutex_lock(&mutex);
+    stopping = 1;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    for (i = 0; i < nworkers; i++)
+        pthread_join(workers[i], NULL);
+    nworkers = 0;
+
+    for (i = 0; i < nentries; i++) {
+        if (entries[i].state == PF_READY)
+            unlink(entries[i].local);
+        free(entries[i].local);
+        free(entries[i].src);
+    }
+    free(entries);
+    entries = NULL;
+    nentries = max_entries = 0;
+    next_entry = cursor = 0;
+    used_bytes = 0;
+    stopping = 0;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+#include <dirent.h>
+
+#define NFILES 6
+#define FILE_KB 600
+
+
+static int
+count_files(const char *dir)
+{
+    struct dirent *ent;
+    DIR *dp;
+    int cnt = 0;
+
+    assert((dp = opendir(dir)) != NULL);
+    while ((ent = readdir(dp)) != NULL)
+        if (ent->d_name[0] != '.')
+            cnt++;
+    closedir(dp);
+    return cnt;
+}
+
+
+/*
+ * Convert (read) input files in order, and check that no more than
+ * 'depth_' files are copied ahead, and the local copies (except for
+ * the current one) fit in 'cap_mb' MB.
+ */
+static void
+test1(const char *srcdir, const char *localdir, int depth_, int cap_mb)
+{
+    char path[NFILES][PATH_MAX + 1];
+    char buf[1024];
+    const char *local;
+    int i, fd, ahead, nlocal;
+    off_t size = (off_t)FILE_KB << 10;
+
+    assert(set_prefetch_dir(localdir) == 0);
+    assert(set_prefetch_params(depth_, cap_mb) == 0);
+    for (i = 0; i < NFILES; i++) {
+        snprintf(path[i], sizeof path[i], "%s/in%d", srcdir, i);
+        assert(add_prefetch(path[i]) == 0);
+    }
+    assert(start_prefetch() == 0 && nworkers > 0);
+
+    for (i = 0; i < NFILES; i++) {
+        local = prefetched_path(path[i]);
+        assert(local != path[i]);
+        assert((fd = open(local, O_RDONLY)) >= 0);
+        assert(read(fd, buf, sizeof buf) == sizeof buf);
+        close(fd);
+        assert(buf[0] == 'a' + i && buf[sizeof buf - 1] == 'a' + i);
+
+        usleep(20000);          /* let the workers run ahead */
+        pthread_mutex_lock(&mutex);
+        ahead = next_entry - cursor - 1;
+        nlocal = used_bytes / size;
+        assert(ahead <= depth_);
+        assert(used_bytes % size == 0 && nlocal <= depth_ + 1);
+        /* the current file may go beyond the cap. */
+        if (cap_mb > 0)
+            assert(used_bytes - entries[cursor].size
+                   <= ((off_t)cap_mb << 20));
+        pthread_mutex_unlock(&mutex);
+
+        release_prefetched(path[i]);
+        assert(access(local, F_OK) < 0);
+    }
+    finish_prefetch();
+    assert(count_files(localdir) == 0);
+    assert(used_bytes == 0 && nentries == 0);
+}
+
+
+int
+test_prefetch(void)
+{
+    char srcdir[] = "/tmp/prefetchXXXXXX";
+    char localdir[] = "/tmp/prefetchXXXXXX";
+    char path[PATH_MAX + 1];
+    char buf[1024];
+    FILE *fp;
+    int i, n;
+
+    assert(mkdtemp(srcdir) != NULL && mkdtemp(localdir) != NULL);
+    for (i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof path, "%s/in%d", srcdir, i);
+        assert((fp = fopen(path, "wb")) != NULL);
+        memset(buf, 'a' + i, sizeof buf);
+        for (n = 0; n < FILE_KB; n++)
+            assert(fwrite(buf, 1, sizeof buf, fp) == sizeof buf);
+        fclose(fp);
+    }
+
+    test1(srcdir, localdir, 2, 0);
+    test1(srcdir, localdir, 3, 1);      /* one 600 KB file ahead */
+    test1(srcdir, localdir, 1, 2);
+
+    free(prefetch_dir);
+    prefetch_dir = NULL;
+    for (i = 0; i < NFILES; i++) {
+        snprintf(path, sizeof path, "%s/in%d", srcdir, i);
+        unlink(path);
+    }
+    rmdir(srcdir);
+    rmdir(localdir);
+    printf("test_prefetch(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
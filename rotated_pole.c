@@ -83,6 +83,33 @@ set_mapping_params(int grid_id)
 }
 
 
+/*
+ * coordinates translation (from rotated to true).
+ */
+static int
+rotate_backward(double *lon, double *lat,
+                const double *rlon, const double *rlat,
+                int rlonlen, int rlatlen)
+{
+    return rotate_lonlat(lon, lat, rlon, rlat, rlonlen, rlatlen,
+                         NORTH_POLE_LON,
+                         90. - NORTH_POLE_LAT,
+                         180. - LONGITUDE_OF_TRUE_NP);
+}
+
+
+/*
+ * true lat/lon of cell centers (for site locations).
+ */
+int
+get_rotated_pole_lonlat(double *lon, double *lat,
+                        const double *rlon, int rlonlen,
+                        const double *rlat, int rlatlen)
+{
+    return rotate_backward(lon, lat, rlon, rlat, rlonlen, rlatlen);
+}
+
+
 /*
  * setup grid mapping: rotated pole.
  */
@@ -93,14 +120,8 @@ setup_rotated_pole(int *grid_id,
 {
     int id;
     int axes_ids[2];
-    double *lon = NULL, *lat = NULL;
-    double *lon_vertices = NULL;
-    double *lat_vertices = NULL;
-    double *lon_bnds = NULL;
-    double *lat_bnds = NULL;
+    cached_grid grid;
     int rval = -1;
-    int len, lenv;
-    int i, j, n, vp0, vp1, vp2, vp3;
 
     /*
      * rlat and rlon.
@@ -122,57 +143,17 @@ setup_rotated_pole(int *grid_id,
     /*
      * lat(rlat, rlon) and lat(rlat, rlon).
      */
-    len = rlonlen * rlatlen;
-    lenv = (rlonlen + 1) * (rlatlen + 1);
-    if ((lon = malloc(sizeof(double) * len)) == NULL
-        || (lat = malloc(sizeof(double) * len)) == NULL
-        || (lon_bnds = malloc(sizeof(double) * lenv)) == NULL
-        || (lat_bnds = malloc(sizeof(double) * lenv)) == NULL
-        || (lon_vertices = malloc(sizeof(double) * 4 * len)) == NULL
-        || (lat_vertices = malloc(sizeof(double) * 4 * len)) == NULL) {
-        logging(LOG_SYSERR, NULL);
+    if (build_grid(&grid,
+                   rlon, rlon_bnds, rlonlen,
+                   rlat, rlat_bnds, rlatlen,
+                   rotate_backward) < 0)
         goto finish;
-    }
-
-    /*
-     * coordinates translation.
-     */
-    rotate_lonlat(lon, lat,
-                  rlon, rlat, rlonlen, rlatlen,
-                  NORTH_POLE_LON,
-                  90. - NORTH_POLE_LAT,
-                  180. - LONGITUDE_OF_TRUE_NP);
-    rotate_lonlat(lon_bnds, lat_bnds,
-                  rlon_bnds, rlat_bnds, rlonlen + 1, rlatlen + 1,
-                  NORTH_POLE_LON,
-                  90. - NORTH_POLE_LAT,
-                  180. - LONGITUDE_OF_TRUE_NP);
-
-    for (j = 0; j < rlatlen; j++)
-        for (i = 0; i < rlonlen; i++) {
-            n = i + rlonlen * j;
-
-            vp0 = n + j;
-            vp1 = vp0 + 1;
-            vp2 = vp1 + rlonlen + 1;
-            vp3 = vp0 + rlonlen + 1;
-
-            lon_vertices[4 * n + 0] = lon_bnds[vp0];
-            lon_vertices[4 * n + 1] = lon_bnds[vp1];
-            lon_vertices[4 * n + 2] = lon_bnds[vp2];
-            lon_vertices[4 * n + 3] = lon_bnds[vp3];
-
-            lat_vertices[4 * n + 0] = lat_bnds[vp0];
-            lat_vertices[4 * n + 1] = lat_bnds[vp1];
-            lat_vertices[4 * n + 2] = lat_bnds[vp2];
-            lat_vertices[4 * n + 3] = lat_bnds[vp3];
-        }
 
     if (cmor_grid(&id, 2, axes_ids, 'd',
-                  lat, lon,
+                  grid.lat, grid.lon,
                   4,
-                  lat_vertices,
-                  lon_vertices) != 0) {
+                  grid.lat_vertices,
+                  grid.lon_vertices) != 0) {
 
         logging(LOG_ERR, "cmor_grid() failed.");
         goto finish;
@@ -186,12 +167,7 @@ setup_rotated_pole(int *grid_id,
     rval = 0;
 
 finish:
-    free(lat_vertices);
-    free(lon_vertices);
-    free(lat_bnds);
-    free(lon_bnds);
-    free(lat);
-    free(lon);
+    free_grid(&grid);
     return rval;
 }
 
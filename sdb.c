@@ -1,39 +1,256 @@
 /*
  * sdb.c -- simple database (plain text).
+ *
+ * A database file consists of logical lines (continued by a backslash
+ * at EOL) of "key value". Lines starting with '#' are comments.
+ *
+ * A file is parsed once into a hash map of items, and the parsed
+ * files are kept by path (and checked by mtime and size) so that
+ * the same file given to many variables is not read again.
  */
-#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "internal.h"
 #include "logging.h"
 #include "myutils.h"
 
+#define SDB_BUCKETS 64
 
-static FILE *db = NULL;
+struct sdb_item {
+    char *key;
+    char *value;
+    struct sdb_item *next;
+};
 
+struct sdb_file {
+    char *path;
+    time_t mtime;
+    off_t size;
+    struct sdb_item *buckets[SDB_BUCKETS];
+    struct sdb_file *next;
+};
 
-int
-sdb_close(void)
+static struct sdb_file *files = NULL;   /* parsed files */
+static struct sdb_file *db = NULL;      /* current database */
+
+
+static unsigned
+bucket_of(const char *key)
+{
+    return idreg_hash(0xcbf29ce484222325ULL, key, strlen(key))
+        % SDB_BUCKETS;
+}
+
+
+static struct sdb_item *
+lookup_item(const struct sdb_file *sdb, const char *key)
+{
+    struct sdb_item *p;
+
+    for (p = sdb->buckets[bucket_of(key)]; p; p = p->next)
+        if (strcmp(p->key, key) == 0)
+            return p;
+    return NULL;
+}
+
+
+/*
+ * Add an item unless the key already exists (the first one wins).
+ */
+static int
+add_item(struct sdb_file *sdb, const char *aline)
 {
-    int rval = 0;
+    struct sdb_item *item;
+    const char *p;
+    size_t len;
+    char *key;
 
-    if (db && (rval = fclose(db)) < 0)
+    for (p = aline; *p != '\0' && !strchr(" \t", *p); p++)
+        ;
+    len = p - aline;
+    if ((key = malloc(len + 1)) == NULL) {
         logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    memcpy(key, aline, len);
+    key[len] = '\0';
+
+    if (lookup_item(sdb, key)) {
+        free(key);
+        return 0;
+    }
+
+    while (*p != '\0' && strchr(" \t", *p))
+        p++;
+
+    if ((item = malloc(sizeof(struct sdb_item))) == NULL
+        || (item->value = strdup(p)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        free(item);
+        free(key);
+        return -1;
+    }
+    item->key = key;
+    item->next = sdb->buckets[bucket_of(key)];
+    sdb->buckets[bucket_of(key)] = item;
+    return 0;
+}
+
+
+/*
+ * Read a logical line of any length (same as read_logicline()).
+ * Return -1 on EOF.
+ */
+static int
+read_line(char **aline, size_t *asize, char **buf, size_t *bsize, FILE *fp)
+{
+    size_t cnt = 0, len;
+    char *ptr, endchr;
+    int nread = 0;
+
+    while (getline(buf, bsize, fp) >= 0) {
+        nread++;
+        ptr = *buf;
+        while (isspace((unsigned char)*ptr))
+            ptr++;
+        if (ptr[0] == '\0')
+            break;
+
+        len = trimmed_tail(ptr) - ptr;
+        endchr = ptr[len - 1];
+        if (endchr == '\\')
+            len--;
+
+        if (cnt + len + 1 > *asize) {
+            size_t newsize = 2 * (cnt + len + 1);
+            char *p;
+
+            if ((p = realloc(*aline, newsize)) == NULL) {
+                logging(LOG_SYSERR, NULL);
+                return -1;
+            }
+            *aline = p;
+            *asize = newsize;
+        }
+        memcpy(*aline + cnt, ptr, len);
+        cnt += len;
+        if (endchr != '\\')
+            break;
+    }
+    if (nread == 0)
+        return -1;
 
+    (*aline)[cnt] = '\0';
+    return 0;
+}
+
+
+static void
+free_sdb_file(struct sdb_file *sdb)
+{
+    struct sdb_item *p, *next;
+    int i;
+
+    for (i = 0; i < SDB_BUCKETS; i++)
+        for (p = sdb->buckets[i]; p; p = next) {
+            next = p->next;
+            free(p->key);
+            free(p->value);
+            free(p);
+        }
+    free(sdb->path);
+    free(sdb);
+}
+
+
+static struct sdb_file *
+parse_sdb_file(const char *path, const struct stat *sb)
+{
+    struct sdb_file *sdb;
+    char *aline = NULL, *buf = NULL;
+    size_t asize = 0, bsize = 0;
+    FILE *fp;
+    int rval = -1;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        logging(LOG_SYSERR, path);
+        return NULL;
+    }
+    if ((sdb = calloc(1, sizeof(struct sdb_file))) == NULL
+        || (sdb->path = strdup(path)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+    sdb->mtime = sb->st_mtime;
+    sdb->size = sb->st_size;
+
+    while (read_line(&aline, &asize, &buf, &bsize, fp) == 0) {
+        /* skip a comment line or a blank line */
+        if (aline[0] == '#' || aline[0] == '\0')
+            continue;
+
+        if (add_item(sdb, aline) < 0)
+            goto finish;
+    }
+    rval = 0;
+
+finish:
+    if (rval < 0 && sdb) {
+        free_sdb_file(sdb);
+        sdb = NULL;
+    }
+    free(buf);
+    free(aline);
+    fclose(fp);
+    return sdb;
+}
+
+
+int
+sdb_close(void)
+{
     db = NULL;
-    return rval;
+    return 0;
 }
 
 
 int
 sdb_open(const char *path)
 {
+    struct sdb_file *p, **prev;
+    struct stat sb;
+
     sdb_close();
 
-    if ((db = fopen(path, "r")) == NULL) {
+    if (stat(path, &sb) < 0) {
         logging(LOG_SYSERR, path);
         return -1;
     }
+
+    for (prev = &files; (p = *prev) != NULL; prev = &p->next)
+        if (strcmp(p->path, path) == 0) {
+            if (p->mtime == sb.st_mtime && p->size == sb.st_size) {
+                db = p;
+                return 0;
+            }
+            /* modified */
+            *prev = p->next;
+            free_sdb_file(p);
+            break;
+        }
+
+    if ((p = parse_sdb_file(path, &sb)) == NULL)
+        return -1;
+
+    p->next = files;
+    files = p;
+    db = p;
     logging(LOG_INFO, "open a database file (%s).", path);
     return 0;
 }
@@ -42,42 +259,92 @@ sdb_open(const char *path)
 char *
 sdb_readitem(const char *item)
 {
-    char aline[4096], key[32];
-    char *ptr;
-    char *value = NULL;
+    struct sdb_item *p;
+    char *value;
 
-    if (!db)
+    if (!db || (p = lookup_item(db, item)) == NULL)
         return NULL;
 
-    rewind(db);
-    while (!feof(db)) {
-        read_logicline(aline, sizeof aline, db);
+    if ((value = strdup(p->value)) == NULL)
+        logging(LOG_SYSERR, NULL);
+    return value;
+}
 
-        /* skip a comment line or a blank line */
-        if (aline[0] == '#' || aline[0] == '\0')
-            continue;
 
-        ptr = split2(key, sizeof key, aline, " \t");
-        if (strcmp(key, item) == 0) {
-            value = strdup(ptr);
-            if (value == NULL)
-                logging(LOG_SYSERR, NULL);
-            break;
-        }
+/*
+ * Free all the parsed files.
+ */
+void
+sdb_free(void)
+{
+    struct sdb_file *p, *next;
+
+    for (p = files; p; p = next) {
+        next = p->next;
+        free_sdb_file(p);
     }
-    return value;
+    files = NULL;
+    db = NULL;
 }
 
 
-#if 0
+#ifdef TEST_MAIN2
+#include <assert.h>
+#include <unistd.h>
+
 int
 test_sdb(void)
 {
-    sdb_open("conf/20c3m.conf");
+    char path[] = "/tmp/sdbXXXXXX";
+    char longkey[100];
+    char *value;
+    FILE *fp;
+    int fd, i;
+
+    for (i = 0; i < sizeof longkey - 1; i++)
+        longkey[i] = 'k';
+    longkey[i] = '\0';
 
-    printf("(%s)\n", sdb_readitem("comment"));
+    assert((fd = mkstemp(path)) >= 0);
+    fp = fdopen(fd, "w");
+    fprintf(fp, "# comment\n"
+            "\n"
+            "history  first \\\n"
+            "   second  \n"
+            "comment\tnone\n"
+            "history  duplicated\n"
+            "%s  long\n", longkey);
+    for (i = 0; i < 1000; i++)
+        fprintf(fp, "%s", i == 0 ? "long " : "x\\\n");
+    fprintf(fp, "x\n");
+    fclose(fp);
+
+    assert(sdb_open(path) == 0);
+    value = sdb_readitem("history");
+    assert(value && strcmp(value, "first second") == 0);
+    free(value);
+    value = sdb_readitem("comment");
+    assert(value && strcmp(value, "none") == 0);
+    free(value);
+    value = sdb_readitem(longkey);
+    assert(value && strcmp(value, "long") == 0);
+    free(value);
+    value = sdb_readitem("long");
+    assert(value && strlen(value) == 1000);
+    free(value);
+    assert(sdb_readitem("nothing") == NULL);
+
+    /* from the cache */
+    sdb_close();
+    assert(sdb_readitem("comment") == NULL);
+    assert(sdb_open(path) == 0 && files->next == NULL);
+    value = sdb_readitem("comment");
+    assert(value && strcmp(value, "none") == 0);
+    free(value);
 
+    unlink(path);
     sdb_free();
+    printf("test_sdb(): DONE\n");
     return 0;
 }
-#endif
+#endif /* TEST_MAIN2 */
@@ -134,6 +134,16 @@ set_writing_mode(const char *str)
 }
 
 
+/*
+ * Existing output files must not be replaced.
+ */
+int
+preserve_mode(void)
+{
+    return writing_mode == MODE_PRESERVE;
+}
+
+
 static int
 setupmode_in_cmor(void)
 {
@@ -251,7 +261,7 @@ setup(const char *mipdir, const char *outdir, const char *userconf)
     }
 
     strlcpy(cmor_current_dataset.outpath,
-            outdir ? outdir : "./",
+            staging_outpath(outdir ? outdir : "./"),
             sizeof cmor_current_dataset.outpath);
 
     status = cmor_dataset_json((char *)userconf);
@@ -2,7 +2,6 @@
  * site.c
  */
 #include <ctype.h>
-#include <math.h>
 #include <stdlib.h>
 
 #include "gtool3.h"
@@ -94,7 +93,7 @@ load_site_locations(const char *path)
     if ((locs = new_site_locations(num)) == NULL)
         goto finish;
 
-    logging(LOG_INFO, "%s: # of locations: %d", path, locs->nlocs);
+    LOGGING(LOG_INFO, "%s: # of locations: %d", path, locs->nlocs);
 
     /*
      * Read each site location line by line.
@@ -132,62 +131,25 @@ finish:
 }
 
 
-static int
-nearest_index(const double *xs, size_t size, double x)
-{
-    size_t i, j = 0;
-    double minval = HUGE_VAL;
-    double d;
-
-    for (i = 0; i < size; i++) {
-        d = fabs(xs[i] - x);
-        if (d < minval) {
-            j = i;
-            minval = d;
-        }
-    }
-    return (int)j;
-}
-
-
-static int
-nearest_index_modulo(const double *xs, size_t size, double x, double modulo)
-{
-    size_t i, j = 0;
-    double minval = HUGE_VAL;
-    double d;
-
-    for (i = 0; i < size; i++) {
-        d = fmod(fabs(x - xs[i]), modulo);
-        d = fmin(d, modulo - d);
-
-        if (d < minval) {
-            j = i;
-            minval = d;
-        }
-    }
-    return (int)j;
-}
-
-
 int
 update_site_indexes(site_locations *sites, const GT3_HEADER *head)
 {
     gtool3_dim_prop prop1;
     gtool3_dim_prop prop2;
-    GT3_Dim *dim1 = NULL;
-    GT3_Dim *dim2 = NULL;
-    double *lons;
-    double *lats;
+    const GT3_Dim *dim1 = NULL;
+    const GT3_Dim *dim2 = NULL;
+    const double *lons;
+    const double *lats;
     int nlons, nlats;
+    int lon_sign, lat_sign;
     int i, ii, jj;
     int rc = -1;
 
     get_dim_prop(&prop1, head, 0);
     get_dim_prop(&prop2, head, 1);
 
-    if ((dim1 = GT3_getDim(prop1.aitm)) == NULL
-        || (dim2 = GT3_getDim(prop2.aitm)) == NULL) {
+    if ((dim1 = get_dim(prop1.aitm)) == NULL
+        || (dim2 = get_dim(prop2.aitm)) == NULL) {
         goto finish;
     }
 
@@ -196,11 +158,14 @@ update_site_indexes(site_locations *sites, const GT3_HEADER *head)
     nlons = prop1.aend - prop1.astr + 1;
     nlats = prop2.aend - prop2.astr + 1;
 
+    lon_sign = monotonicity(lons, nlons);
+    lat_sign = monotonicity(lats, nlats);
     for (i = 0; i < sites->nlocs; i++) {
-        ii = nearest_index_modulo(lons, nlons, sites->lons[i], 360.);
-        jj = nearest_index(lats, nlats, sites->lats[i]);
+        ii = nearest_sorted_modulo(lons, nlons, lon_sign,
+                                   sites->lons[i], 360.);
+        jj = nearest_sorted(lats, nlats, lat_sign, sites->lats[i]);
 
-        logging(LOG_INFO, "site: %4d (%10.3f, %10.3f) -> (%12.4f, %12.4f)",
+        LOGGING(LOG_INFO, "site: %4d (%10.3f, %10.3f) -> (%12.4f, %12.4f)",
                 sites->ids[i], sites->lons[i], sites->lats[i],
                 lons[ii], lats[jj]);
 
@@ -211,7 +176,55 @@ update_site_indexes(site_locations *sites, const GT3_HEADER *head)
     rc = 0;
 
 finish:
-    GT3_freeDim(dim1);
-    GT3_freeDim(dim2);
+    release_dim(dim1);
+    release_dim(dim2);
     return rc;
 }
+
+
+/*
+ * Gather values at the sites from 'nz' levels of 'nxy' grid points.
+ */
+void
+gather_sites(float *dest, const float *src, const site_locations *sites,
+             int nxy, int nz)
+{
+    int i, k;
+
+    for (k = 0; k < nz; k++, dest += sites->nlocs, src += nxy)
+        for (i = 0; i < sites->nlocs; i++)
+            dest[i] = src[sites->indexes[i]];
+}
+
+
+/*
+ * update_site_indexes() for 2-D (curvilinear) lat/lon, such as
+ * produced by grid mappings.
+ *
+ * lons, lats: [0, ..., nlons * nlats - 1]
+ */
+int
+update_site_indexes_2d(site_locations *sites,
+                       const double *lons, const double *lats,
+                       int nlons, int nlats)
+{
+    spindex *idx;
+    int i, n;
+
+    if ((idx = spindex_new(lons, lats, nlons * nlats)) == NULL)
+        return -1;
+
+    for (i = 0; i < sites->nlocs; i++) {
+        n = spindex_nearest(idx, sites->lons[i], sites->lats[i]);
+
+        LOGGING(LOG_INFO, "site: %4d (%10.3f, %10.3f) -> (%12.4f, %12.4f)",
+                sites->ids[i], sites->lons[i], sites->lats[i],
+                lons[n], lats[n]);
+
+        sites->grid_lons[i] = lons[n];
+        sites->grid_lats[i] = lats[n];
+        sites->indexes[i] = n;
+    }
+    spindex_free(idx);
+    return 0;
+}
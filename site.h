@@ -27,5 +27,10 @@ typedef struct site_locations_t site_locations;
 void free_site_locations(site_locations *locs);
 site_locations *load_site_locations(const char *path);
 int update_site_indexes(site_locations *sites, const GT3_HEADER *head);
+int update_site_indexes_2d(site_locations *sites,
+                           const double *lons, const double *lats,
+                           int nlons, int nlats);
+void gather_sites(float *dest, const float *src, const site_locations *sites,
+                  int nxy, int nz);
 
 #endif /* !SITE_H */
@@ -0,0 +1,480 @@
+/*
+ * spindex.c -- nearest grid point search.
+ *
+ * 1-D axes: binary search on a monotonic axis (a linear scan for
+ *           a non-monotonic one).
+ * 2-D lat/lon (grid mappings): a KD-tree of points on the unit sphere.
+ *           The nearest point in the chord distance is also the
+ *           nearest in the great-circle distance.
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "logging.h"
+#include "internal.h"
+
+#define DEG2RAD(x) (M_PI * (x) / 180.)
+
+/* the number of linear scans (for the test). */
+static unsigned num_linear_scans = 0;
+
+struct spindex {
+    int len;
+    double *xyz;                /* xyz[3 * len]: unit vectors */
+    int *perm;                  /* points in the order of the tree */
+    unsigned char *axis;        /* split axis of each node */
+};
+
+
+static int
+linear_nearest(const double *xs, int size, double x)
+{
+    int i, j = 0;
+    double minval = HUGE_VAL;
+    double d;
+
+    num_linear_scans++;
+    for (i = 0; i < size; i++) {
+        d = fabs(xs[i] - x);
+        if (d < minval) {
+            j = i;
+            minval = d;
+        }
+    }
+    return j;
+}
+
+
+/*
+ * 1: strictly increasing, -1: strictly decreasing, 0: otherwise.
+ * This is given to nearest_sorted() for each query, so that it
+ * should be computed once for an axis.
+ */
+int
+monotonicity(const double *xs, int size)
+{
+    int i, sign;
+
+    if (size < 2)
+        return 1;
+
+    sign = xs[1] > xs[0] ? 1 : -1;
+    for (i = 1; i < size; i++)
+        if ((xs[i] - xs[i - 1]) * sign <= 0.)
+            return 0;
+    return sign;
+}
+
+
+/*
+ * the first index of xs[] which is not in front of x.
+ */
+static int
+lower_bound(const double *xs, int size, double x, int sign)
+{
+    int lo = 0, hi = size, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if ((xs[mid] - x) * sign < 0.)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+/*
+ * Return the index of the nearest value to 'x'. 'sign' is given by
+ * monotonicity(xs, size).
+ * The result is the same as a linear scan (the lowest index in a tie).
+ */
+int
+nearest_sorted(const double *xs, int size, int sign, double x)
+{
+    int p;
+
+    if (sign == 0)
+        return linear_nearest(xs, size, x);
+
+    p = lower_bound(xs, size, x, sign);
+    if (p == size)
+        return size - 1;
+    if (p > 0 && fabs(xs[p - 1] - x) <= fabs(xs[p] - x))
+        return p - 1;
+    return p;
+}
+
+
+static double
+modulo_dist(double a, double b, double modulo)
+{
+    double d = fmod(fabs(a - b), modulo);
+
+    return fmin(d, modulo - d);
+}
+
+
+/*
+ * nearest_sorted() for a cyclic axis such as longitude.
+ */
+int
+nearest_sorted_modulo(const double *xs, int size, int sign, double x,
+                      double modulo)
+{
+    int cand[4], i, j, p;
+    double d, minval = HUGE_VAL, x0 = x;
+
+    if (sign == 0 || fabs(xs[size - 1] - xs[0]) >= modulo) {
+        num_linear_scans++;
+        for (j = 0, i = 0; i < size; i++)
+            if ((d = modulo_dist(x, xs[i], modulo)) < minval) {
+                j = i;
+                minval = d;
+            }
+        return j;
+    }
+
+    /* move x into the period starting from xs[0]. */
+    x = xs[0] + sign * fmod(fmod((x - xs[0]) * sign, modulo) + modulo,
+                            modulo);
+
+    p = lower_bound(xs, size, x, sign);
+    cand[0] = 0;
+    cand[1] = p > 0 ? p - 1 : 0;
+    cand[2] = p < size ? p : size - 1;
+    cand[3] = size - 1;
+
+    for (j = size, i = 0; i < 4; i++) {
+        d = modulo_dist(x0, xs[cand[i]], modulo);
+        if (d < minval || (d == minval && cand[i] < j)) {
+            j = cand[i];
+            minval = d;
+        }
+    }
+    return j;
+}
+
+
+static void
+to_xyz(double *v, double lon, double lat)
+{
+    double clat = cos(DEG2RAD(lat));
+
+    v[0] = clat * cos(DEG2RAD(lon));
+    v[1] = clat * sin(DEG2RAD(lon));
+    v[2] = sin(DEG2RAD(lat));
+}
+
+
+static void
+swap_int(int *a, int *b)
+{
+    int t = *a;
+
+    *a = *b;
+    *b = t;
+}
+
+
+/*
+ * Partially sort perm[lo, hi) so that perm[k] is the median
+ * along 'ax' (quickselect with 3-way partitioning, which copes with
+ * many equal values on regular grids).
+ */
+static void
+select_kth(int *perm, const double *xyz, int lo, int hi, int k, int ax)
+{
+    double pivot, v;
+    int lt, gt, i;
+
+    while (hi - lo > 1) {
+        pivot = xyz[3 * perm[lo + (hi - lo) / 2] + ax];
+
+        /* [lo, lt): < pivot, [lt, i): == pivot, [gt, hi): > pivot */
+        lt = i = lo;
+        gt = hi;
+        while (i < gt) {
+            v = xyz[3 * perm[i] + ax];
+            if (v < pivot)
+                swap_int(perm + lt++, perm + i++);
+            else if (v > pivot)
+                swap_int(perm + i, perm + --gt);
+            else
+                i++;
+        }
+
+        if (k < lt)
+            hi = lt;
+        else if (k >= gt)
+            lo = gt;
+        else
+            return;
+    }
+}
+
+
+static void
+build_tree(spindex *idx, int lo, int hi)
+{
+    double vmin[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL };
+    double vmax[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+    const double *v;
+    int i, m, ax, k;
+
+    if (hi - lo < 1)
+        return;
+
+    for (i = lo; i < hi; i++) {
+        v = idx->xyz + 3 * idx->perm[i];
+        for (k = 0; k < 3; k++) {
+            vmin[k] = fmin(vmin[k], v[k]);
+            vmax[k] = fmax(vmax[k], v[k]);
+        }
+    }
+    ax = 0;
+    for (k = 1; k < 3; k++)
+        if (vmax[k] - vmin[k] > vmax[ax] - vmin[ax])
+            ax = k;
+
+    m = lo + (hi - lo) / 2;
+    select_kth(idx->perm, idx->xyz, lo, hi, m, ax);
+    idx->axis[m] = ax;
+
+    build_tree(idx, lo, m);
+    build_tree(idx, m + 1, hi);
+}
+
+
+/*
+ * Create a spatial index of 'len' points (lon[i], lat[i]) in degrees.
+ */
+spindex *
+spindex_new(const double *lon, const double *lat, int len)
+{
+    spindex *idx;
+    int i;
+
+    if ((idx = malloc(sizeof(spindex))) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return NULL;
+    }
+    idx->len = len;
+    idx->xyz = malloc(sizeof(double) * 3 * len);
+    idx->perm = malloc(sizeof(int) * len);
+    idx->axis = malloc(len);
+    if (!idx->xyz || !idx->perm || !idx->axis) {
+        logging(LOG_SYSERR, NULL);
+        spindex_free(idx);
+        return NULL;
+    }
+
+    for (i = 0; i < len; i++) {
+        to_xyz(idx->xyz + 3 * i, lon[i], lat[i]);
+        idx->perm[i] = i;
+    }
+    build_tree(idx, 0, len);
+    return idx;
+}
+
+
+void
+spindex_free(spindex *idx)
+{
+    if (idx) {
+        free(idx->axis);
+        free(idx->perm);
+        free(idx->xyz);
+        free(idx);
+    }
+}
+
+
+static double
+dist2(const double *a, const double *b)
+{
+    double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+
+    return dx * dx + dy * dy + dz * dz;
+}
+
+
+static void
+search_tree(const spindex *idx, int lo, int hi, const double *q,
+            int *best, double *best_d2)
+{
+    int m, p, ax;
+    double d2, diff;
+
+    while (hi - lo > 0) {
+        m = lo + (hi - lo) / 2;
+        p = idx->perm[m];
+        ax = idx->axis[m];
+
+        d2 = dist2(idx->xyz + 3 * p, q);
+        if (d2 < *best_d2 || (d2 == *best_d2 && p < *best)) {
+            *best = p;
+            *best_d2 = d2;
+        }
+
+        diff = q[ax] - idx->xyz[3 * p + ax];
+        if (diff < 0.) {
+            search_tree(idx, lo, m, q, best, best_d2);
+            if (diff * diff > *best_d2)
+                return;
+            lo = m + 1;
+        } else {
+            search_tree(idx, m + 1, hi, q, best, best_d2);
+            if (diff * diff > *best_d2)
+                return;
+            hi = m;
+        }
+    }
+}
+
+
+/*
+ * Return the index of the point nearest to (lon, lat)
+ * in the great-circle distance.
+ */
+int
+spindex_nearest(const spindex *idx, double lon, double lat)
+{
+    double q[3], best_d2 = HUGE_VAL;
+    int best = 0;
+
+    to_xyz(q, lon, lat);
+    search_tree(idx, 0, idx->len, q, &best, &best_d2);
+    return best;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+#include <stdio.h>
+
+static int
+brute_nearest(const double *lon, const double *lat, int len,
+              double qlon, double qlat)
+{
+    double q[3], v[3], d2, best_d2 = HUGE_VAL;
+    int i, best = 0;
+
+    to_xyz(q, qlon, qlat);
+    for (i = 0; i < len; i++) {
+        to_xyz(v, lon[i], lat[i]);
+        if ((d2 = dist2(v, q)) < best_d2) {
+            best = i;
+            best_d2 = d2;
+        }
+    }
+    return best;
+}
+
+
+static int
+linear_nearest_modulo(const double *xs, int size, double x, double modulo)
+{
+    int i, j = 0;
+    double d, minval = HUGE_VAL;
+
+    for (i = 0; i < size; i++)
+        if ((d = modulo_dist(x, xs[i], modulo)) < minval) {
+            j = i;
+            minval = d;
+        }
+    return j;
+}
+
+
+static void
+test1(void)
+{
+    double lons[128], lats[64], rlats[64], x;
+    unsigned scans;
+    int i, j;
+
+    for (i = 0; i < 128; i++)
+        lons[i] = 2.8125 * i;
+    for (i = 0; i < 64; i++) {
+        lats[i] = -87.8638 + 2.7893 * i;
+        rlats[63 - i] = lats[i];
+    }
+
+    assert(monotonicity(lons, 128) == 1);
+    assert(monotonicity(lats, 64) == 1);
+    assert(monotonicity(rlats, 64) == -1);
+
+    for (x = -400.; x <= 400.; x += 0.37) {
+        scans = num_linear_scans;
+        i = nearest_sorted_modulo(lons, 128, 1, x, 360.);
+        j = nearest_sorted_modulo(lons, 10, 1, x, 360.);
+        assert(num_linear_scans == scans);    /* binary search */
+        assert(i == linear_nearest_modulo(lons, 128, x, 360.));
+        assert(j == linear_nearest_modulo(lons, 10, x, 360.));
+    }
+    for (x = -100.; x <= 100.; x += 0.13) {
+        scans = num_linear_scans;
+        i = nearest_sorted(lats, 64, 1, x);
+        j = nearest_sorted(rlats, 64, -1, x);
+        assert(num_linear_scans == scans);    /* binary search */
+        assert(i == linear_nearest(lats, 64, x));
+        assert(j == linear_nearest(rlats, 64, x));
+    }
+    /* ties */
+    assert(nearest_sorted(lons, 128, 1, 2.8125 / 2.) == 0);
+    assert(nearest_sorted(rlats, 64, -1, rlats[10]) == 10);
+
+    /* non-monotonic: a linear scan. */
+    lats[10] = lats[20];
+    assert(monotonicity(lats, 64) == 0);
+    scans = num_linear_scans;
+    assert(nearest_sorted(lats, 64, 0, lats[30]) == 30);
+    assert(num_linear_scans == scans + 1);
+}
+
+
+static void
+test2(void)
+{
+    int nx = 90, ny = 60, len = nx * ny;
+    double *lon, *lat, qlon, qlat;
+    spindex *idx;
+    int i, j, k;
+
+    lon = malloc(sizeof(double) * len);
+    lat = malloc(sizeof(double) * len);
+
+    /* a distorted (curvilinear) grid. */
+    for (j = 0; j < ny; j++)
+        for (i = 0; i < nx; i++) {
+            k = i + nx * j;
+            lon[k] = 4. * i + 10. * sin(0.1 * j);
+            lat[k] = -89. + 3. * j + 2. * cos(0.2 * i);
+        }
+
+    assert((idx = spindex_new(lon, lat, len)) != NULL);
+    srand(1);
+    for (k = 0; k < 2000; k++) {
+        qlon = 720. * rand() / RAND_MAX - 360.;
+        qlat = 180. * rand() / RAND_MAX - 90.;
+        i = spindex_nearest(idx, qlon, qlat);
+        j = brute_nearest(lon, lat, len, qlon, qlat);
+        assert(i == j);
+    }
+    spindex_free(idx);
+    free(lat);
+    free(lon);
+}
+
+
+int
+test_spindex(void)
+{
+    test1();
+    test2();
+    printf("test_spindex(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
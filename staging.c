@@ -0,0 +1,520 @@
+/*
+ * staging.c -- stage output files in local scratch.
+ *
+ * CMOR writes output files into the staging directory. When a file
+ * is closed, it is copied into the final output directory by a
+ * background thread. The copy is made under a temporary name and
+ * renamed, so that the final path appears only after the file is
+ * complete. In preserve mode, an existing final file is not replaced.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmor.h"
+#include "logging.h"
+#include "internal.h"
+#include "myutils.h"
+
+#ifndef PATH_MAX
+#  define PATH_MAX 1024
+#endif
+
+struct staging_job {
+    char *path;
+    struct staging_job *next;
+};
+
+static char *staging_dir = NULL;
+static char *final_dir = NULL;
+
+static pthread_t worker;
+static int worker_running = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct staging_job *head = NULL, *tail = NULL;
+static int no_more_jobs = 0;
+static int nerrors = 0;
+
+/* main variables whose files are staged out. */
+static int var_ids[CMOR_MAX_VARIABLES];
+static int num_vars = 0;
+
+
+int
+set_staging_dir(const char *dir)
+{
+    struct stat sb;
+
+    if (stat(dir, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        logging(LOG_ERR, "%s: not a directory.", dir);
+        return -1;
+    }
+    free(staging_dir);
+    if ((staging_dir = strdup(dir)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+int
+staging_enabled(void)
+{
+    return staging_dir != NULL;
+}
+
+
+/*
+ * Return a directory in which CMOR writes output files.
+ * 'outdir' is the final output directory.
+ */
+const char *
+staging_outpath(const char *outdir)
+{
+    if (!staging_dir)
+        return outdir;
+
+    free(final_dir);
+    if ((final_dir = strdup(outdir)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return outdir;
+    }
+    logging(LOG_INFO, "staging directory: %s (final: %s)",
+            staging_dir, final_dir);
+    return staging_dir;
+}
+
+
+/*
+ * mkdir -p
+ */
+static int
+make_dirs(const char *path)
+{
+    char buf[PATH_MAX + 1];
+    char *p;
+
+    if (strlcpy(buf, path, sizeof buf) >= sizeof buf)
+        return -1;
+
+    for (p = buf + 1; *p != '\0'; p++) {
+        if (*p != '/')
+            continue;
+
+        *p = '\0';
+        if (mkdir(buf, 0777) < 0 && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+    if (mkdir(buf, 0777) < 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+
+/*
+ * Copy the contents of 'src' into 'dest' (also used by prefetch.c).
+ */
+int
+copy_fd(int dest, int src)
+{
+    char buf[1 << 16];
+    ssize_t nread, nwritten, n;
+    int use_read = 0;
+
+    for (;;) {
+        if (!use_read) {
+            n = copy_file_range(src, NULL, dest, NULL, 1 << 30, 0);
+            if (n > 0)
+                continue;
+            if (n == 0)
+                return 0;
+            if (errno != ENOSYS && errno != EXDEV && errno != EINVAL
+                && errno != EOPNOTSUPP)
+                return -1;
+
+            /* fall back to read/write. */
+            use_read = 1;
+        }
+
+        if ((nread = read(src, buf, sizeof buf)) < 0)
+            return -1;
+        if (nread == 0)
+            return 0;
+
+        for (nwritten = 0; nwritten < nread; nwritten += n)
+            if ((n = write(dest, buf + nwritten, nread - nwritten)) < 0)
+                return -1;
+    }
+}
+
+
+/*
+ * Make a new entry of a directory durable.
+ */
+static int
+sync_dir(const char *dir)
+{
+    int fd, rval;
+
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+        return -1;
+    rval = fsync(fd);
+    close(fd);
+    return rval;
+}
+
+
+/*
+ * Copy a file in the staging directory into the final directory.
+ */
+static int
+move_to_final(const char *path)
+{
+    char dest[PATH_MAX + 1], temp[PATH_MAX + 1], dir[PATH_MAX + 1];
+    const char *rel = path;
+    char *p;
+    size_t len = strlen(staging_dir);
+    int src = -1, fd = -1;
+    int rval = -1;
+
+    /*
+     * The output path may be overridden (e.g., "outpath" in the user
+     * input file). Such a file is left where it is.
+     */
+    while (len > 1 && staging_dir[len - 1] == '/')
+        len--;
+    if (strncmp(path, staging_dir, len) != 0 || path[len] != '/') {
+        logging(LOG_WARN, "%s: not in the staging directory, left as it is.",
+                path);
+        return 0;
+    }
+    rel = path + len;
+    while (*rel == '/')
+        rel++;
+
+    if (snprintf(dest, sizeof dest, "%s/%s", final_dir, rel) >= sizeof dest
+        || snprintf(temp, sizeof temp, "%s.part", dest) >= sizeof temp) {
+        logging(LOG_ERR, "%s: too long path.", path);
+        return -1;
+    }
+    strlcpy(dir, dest, sizeof dir);
+    if ((p = strrchr(dir, '/')) != NULL) {
+        *p = '\0';
+        if (make_dirs(dir) < 0) {
+            logging(LOG_SYSERR, dir);
+            return -1;
+        }
+    }
+
+    if (preserve_mode() && access(dest, F_OK) == 0) {
+        logging(LOG_ERR, "%s: already exists (preserve mode).", dest);
+        return -1;
+    }
+
+    if ((src = open(path, O_RDONLY)) < 0 || fsync(src) < 0) {
+        logging(LOG_SYSERR, path);
+        goto finish;
+    }
+    if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0
+        || copy_fd(fd, src) < 0
+        || fsync(fd) < 0) {
+        logging(LOG_SYSERR, temp);
+        goto finish;
+    }
+    if (close(fd) < 0) {
+        fd = -1;
+        logging(LOG_SYSERR, temp);
+        goto finish;
+    }
+    fd = -1;
+
+    /*
+     * link(2) does not replace an existing file, which may be
+     * created after the check above.
+     */
+    if (preserve_mode()) {
+        if (link(temp, dest) < 0) {
+            logging(LOG_SYSERR, dest);
+            unlink(temp);
+            goto finish;
+        }
+        unlink(temp);
+    } else if (rename(temp, dest) < 0) {
+        logging(LOG_SYSERR, dest);
+        goto finish;
+    }
+    if (sync_dir(dir) < 0) {
+        logging(LOG_SYSERR, dir);
+        goto finish;
+    }
+    unlink(path);
+    logging(LOG_INFO, "staged out: %s", dest);
+    rval = 0;
+
+finish:
+    if (fd >= 0) {
+        close(fd);
+        unlink(temp);
+    }
+    if (src >= 0)
+        close(src);
+    return rval;
+}
+
+
+static void *
+staging_worker(void *arg)
+{
+    struct staging_job *job;
+    double t0;
+    int rc;
+
+    trace_thread_name("staging");
+    for (;;) {
+        pthread_mutex_lock(&mutex);
+        while (head == NULL && !no_more_jobs)
+            pthread_cond_wait(&cond, &mutex);
+
+        if ((job = head) != NULL) {
+            head = job->next;
+            if (head == NULL)
+                tail = NULL;
+        }
+        pthread_mutex_unlock(&mutex);
+
+        if (job == NULL)
+            break;
+
+        t0 = stats_clock();
+        rc = move_to_final(job->path);
+        trace_span("stage out", t0);
+        if (rc < 0) {
+            pthread_mutex_lock(&mutex);
+            nerrors++;
+            pthread_mutex_unlock(&mutex);
+        }
+        free(job->path);
+        free(job);
+    }
+    return NULL;
+}
+
+
+/*
+ * Request to copy a closed file into the final directory.
+ */
+int
+stage_output(const char *path)
+{
+    struct staging_job *job;
+
+    if (!staging_dir)
+        return 0;
+
+    if ((job = malloc(sizeof(struct staging_job))) == NULL
+        || (job->path = strdup(path)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        free(job);
+        return -1;
+    }
+    job->next = NULL;
+
+    if (!worker_running) {
+        if (pthread_create(&worker, NULL, staging_worker, NULL) != 0) {
+            logging(LOG_ERR, "failed to start a staging thread.");
+            free(job->path);
+            free(job);
+            return -1;
+        }
+        worker_running = 1;
+    }
+
+    pthread_mutex_lock(&mutex);
+    if (tail)
+        tail->next = job;
+    else
+        head = job;
+    tail = job;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+
+/*
+ * Register a variable whose output file is staged out.
+ */
+void
+register_output(int var_id)
+{
+    int i;
+
+    if (!staging_dir)
+        return;
+
+    for (i = 0; i < num_vars; i++)
+        if (var_ids[i] == var_id)
+            return;
+    if (num_vars < CMOR_MAX_VARIABLES)
+        var_ids[num_vars++] = var_id;
+}
+
+
+/*
+ * Close a registered variable as soon as it is finished, and start
+ * copying its file while the conversion goes on.
+ */
+int
+stage_variable(int var_id)
+{
+    char path[CMOR_MAX_STRING];
+    int i;
+
+    for (i = 0; i < num_vars; i++)
+        if (var_ids[i] == var_id)
+            break;
+    if (i == num_vars)
+        return 0;
+
+    var_ids[i] = var_ids[--num_vars];
+    if (cmor_close_variable(var_id, path, NULL) != 0) {
+        logging(LOG_ERR, "cmor_close_variable() failed.");
+        return -1;
+    }
+    return stage_output(path);
+}
+
+
+/*
+ * Close the variables which are still registered (e.g., after an
+ * error), and start copying their files.
+ * This must be called before cmor_close().
+ */
+int
+stage_outputs(void)
+{
+    int rval = 0;
+
+    while (num_vars > 0)
+        if (stage_variable(var_ids[0]) < 0)
+            rval = -1;
+    return rval;
+}
+
+
+/*
+ * Wait for all the copies. Return -1 if any copy failed.
+ */
+int
+finish_staging(void)
+{
+    if (worker_running) {
+        pthread_mutex_lock(&mutex);
+        no_more_jobs = 1;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+
+        pthread_join(worker, NULL);
+        worker_running = 0;
+    }
+    return nerrors > 0 ? -1 : 0;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+
+static void
+write_file(const char *path, const char *text)
+{
+    FILE *fp;
+
+    assert((fp = fopen(path, "w")) != NULL);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+
+static int
+file_is(const char *path, const char *text)
+{
+    char buf[64];
+    size_t n;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return 0;
+    n = fread(buf, 1, sizeof buf - 1, fp);
+    buf[n] = '\0';
+    fclose(fp);
+    return strcmp(buf, text) == 0;
+}
+
+
+int
+test_staging(void)
+{
+    char stage[] = "/tmp/stageXXXXXX", final[] = "/tmp/finalXXXXXX";
+    char src[PATH_MAX + 1], dest[PATH_MAX + 1], other[PATH_MAX + 1];
+
+    assert(mkdtemp(stage) && mkdtemp(final));
+    assert(set_staging_dir(stage) == 0);
+    assert(strcmp(staging_outpath(final), stage) == 0);
+
+    snprintf(src, sizeof src, "%s/CMIP6", stage);
+    assert(mkdir(src, 0777) == 0);
+    snprintf(src, sizeof src, "%s/CMIP6/a.nc", stage);
+    snprintf(dest, sizeof dest, "%s/CMIP6/a.nc", final);
+
+    /* replace mode */
+    write_file(src, "first");
+    assert(move_to_final(src) == 0);
+    assert(file_is(dest, "first") && access(src, F_OK) < 0);
+    write_file(src, "second");
+    assert(move_to_final(src) == 0);
+    assert(file_is(dest, "second") && access(src, F_OK) < 0);
+
+    /* preserve mode: an existing file is kept. */
+    assert(set_writing_mode("preserve") == 0);
+    write_file(src, "third");
+    assert(move_to_final(src) < 0);
+    assert(file_is(dest, "second") && file_is(src, "third"));
+    unlink(dest);
+    assert(move_to_final(src) == 0);
+    assert(file_is(dest, "third") && access(src, F_OK) < 0);
+    assert(set_writing_mode("replace") == 0);
+
+    /* not in the staging directory: left as it is. */
+    snprintf(other, sizeof other, "%s-x.nc", stage);
+    write_file(other, "other");
+    assert(move_to_final(other) == 0);
+    assert(file_is(other, "other"));
+    unlink(other);
+
+    unlink(dest);
+    snprintf(dest, sizeof dest, "%s/CMIP6", final);
+    rmdir(dest);
+    rmdir(final);
+    snprintf(src, sizeof src, "%s/CMIP6", stage);
+    rmdir(src);
+    rmdir(stage);
+    free(staging_dir);
+    staging_dir = NULL;
+    free(final_dir);
+    final_dir = NULL;
+    printf("test_staging(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
@@ -0,0 +1,360 @@
+/*
+ * stats.c -- per-stage timing and throughput of converted variables.
+ *
+ * Each stage of a conversion (open, header, setup, read, calc, write)
+ * is measured with a monotonic clock, and accumulated for the current
+ * variable, with the peak memory (RSS of the process, and bytes held
+ * by bufpool.c) sampled at the end of each stage. A summary is logged
+ * at the end of a run, and is written as JSON with "--report file"
+ * (with I/O totals by ioacct.c).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "internal.h"
+
+struct stage {
+    double seconds;
+    double bytes;
+    unsigned count;
+    size_t peak_rss;
+};
+
+struct varstats {
+    char name[32];
+    unsigned nfiles;
+    unsigned nsteps;
+    double bytes_in;            /* values read (as float) */
+    double bytes_out;           /* values written (as float) */
+    size_t peak_rss;
+    size_t peak_tracked;        /* bytes held by bufpool.c */
+    struct stage stages[NUM_STAGES];
+};
+
+static const char *stage_names[] = {
+    "open",
+    "header",
+    "setup",
+    "read",
+    "calc",
+    "write"
+};
+
+static struct varstats *records = NULL;
+static int nrecords = 0;
+static int max_records = 0;
+static struct varstats *current = NULL;
+
+static char *report_path = NULL;
+
+
+double
+stats_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+int
+set_stats_report(const char *path)
+{
+    free(report_path);
+    if ((report_path = strdup(path)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Start a record of variable 'name', and return its index.
+ */
+int
+stats_begin_var(const char *name)
+{
+    struct varstats *p;
+
+    if (nrecords == max_records) {
+        int newmax = max_records > 0 ? 2 * max_records : 16;
+
+        if ((p = realloc(records, sizeof(struct varstats) * newmax))
+            == NULL) {
+            logging(LOG_SYSERR, NULL);
+            current = NULL;
+            return -1;
+        }
+        records = p;
+        max_records = newmax;
+    }
+    current = records + nrecords;
+    memset(current, 0, sizeof(struct varstats));
+    snprintf(current->name, sizeof current->name, "%s", name);
+    return nrecords++;
+}
+
+
+/*
+ * Switch the current record (e.g., between variables in batch mode).
+ */
+void
+stats_select(int idx)
+{
+    current = (idx >= 0 && idx < nrecords) ? records + idx : NULL;
+}
+
+
+/*
+ * Add the time since 'start' (by stats_clock()) to a stage.
+ */
+void
+stats_add(int stage, double start, size_t nbytes)
+{
+    struct stage *s;
+    size_t rss, tracked;
+
+    trace_span(stage_names[stage], start);
+    if (!current)
+        return;
+
+    s = current->stages + stage;
+    s->seconds += stats_clock() - start;
+    s->bytes += nbytes;
+    s->count++;
+
+    rss = mem_rss();
+    tracked = bufpool_bytes();
+    if (rss > s->peak_rss)
+        s->peak_rss = rss;
+    if (rss > current->peak_rss)
+        current->peak_rss = rss;
+    if (tracked > current->peak_tracked)
+        current->peak_tracked = tracked;
+
+    if (stage == STAGE_OPEN)
+        current->nfiles++;
+    if (stage == STAGE_READ)
+        current->bytes_in += nbytes;
+    if (stage == STAGE_WRITE)
+        current->bytes_out += nbytes;
+}
+
+
+void
+stats_add_step(void)
+{
+    if (current)
+        current->nsteps++;
+}
+
+
+static double
+total_seconds(const struct varstats *v)
+{
+    double sum = 0.;
+    int i;
+
+    for (i = 0; i < NUM_STAGES; i++)
+        sum += v->stages[i].seconds;
+    return sum;
+}
+
+
+static double
+rate(double amount, double seconds)
+{
+    return seconds > 0. ? amount / seconds : 0.;
+}
+
+
+static void
+log_summary(const struct varstats *v)
+{
+    const struct stage *s;
+    double total = total_seconds(v);
+    int i;
+
+    logging(LOG_INFO,
+            "stats: %s: %u file(s), %u step(s) in %.3f s (%.2f steps/s), "
+            "in %.1f MB, out %.1f MB",
+            v->name, v->nfiles, v->nsteps, total, rate(v->nsteps, total),
+            v->bytes_in / 1048576., v->bytes_out / 1048576.);
+    logging(LOG_INFO, "stats: %s: peak RSS %.1f MB, buffers %.1f MB",
+            v->name, v->peak_rss / 1048576., v->peak_tracked / 1048576.);
+
+    for (i = 0; i < NUM_STAGES; i++) {
+        s = v->stages + i;
+        if (s->count == 0)
+            continue;
+        logging(LOG_INFO,
+                "stats: %s:   %-6s %9.3f s %5.1f%% %10.1f MB/s %9.1f MB",
+                v->name, stage_names[i], s->seconds,
+                total > 0. ? 100. * s->seconds / total : 0.,
+                rate(s->bytes / 1048576., s->seconds),
+                s->peak_rss / 1048576.);
+    }
+}
+
+
+static void
+write_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str; str++)
+        if (*str == '"' || *str == '\\')
+            fprintf(fp, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(fp, "\\u%04x", (unsigned char)*str);
+        else
+            fputc(*str, fp);
+    fputc('"', fp);
+}
+
+
+static int
+write_report(const char *path, int status)
+{
+    const struct varstats *v;
+    const struct stage *s;
+    double total;
+    FILE *fp;
+    int i, n;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+        logging(LOG_SYSERR, path);
+        return -1;
+    }
+    fprintf(fp, "{\n  \"program\": \"mipconv\",\n  \"version\": ");
+    write_json_string(fp, mipconv_version());
+    fprintf(fp, ",\n  \"status\": \"%s\",\n  \"variables\": [",
+            status == 0 ? "success" : "failure");
+
+    for (n = 0; n < nrecords; n++) {
+        v = records + n;
+        total = total_seconds(v);
+
+        fprintf(fp, "%s\n    {\n      \"name\": ", n > 0 ? "," : "");
+        write_json_string(fp, v->name);
+        fprintf(fp,
+                ",\n"
+                "      \"files\": %u,\n"
+                "      \"steps\": %u,\n"
+                "      \"seconds\": %.6f,\n"
+                "      \"steps_per_second\": %.3f,\n"
+                "      \"bytes_in\": %.0f,\n"
+                "      \"bytes_out\": %.0f,\n"
+                "      \"peak_rss\": %lu,\n"
+                "      \"peak_tracked\": %lu,\n"
+                "      \"stages\": {",
+                v->nfiles, v->nsteps, total, rate(v->nsteps, total),
+                v->bytes_in, v->bytes_out,
+                (unsigned long)v->peak_rss, (unsigned long)v->peak_tracked);
+
+        for (i = 0; i < NUM_STAGES; i++) {
+            s = v->stages + i;
+            fprintf(fp,
+                    "%s\n        \"%s\": {\"count\": %u, \"seconds\": %.6f, "
+                    "\"bytes\": %.0f, \"mb_per_second\": %.3f, "
+                    "\"peak_rss\": %lu}",
+                    i > 0 ? "," : "", stage_names[i], s->count, s->seconds,
+                    s->bytes, rate(s->bytes / 1048576., s->seconds),
+                    (unsigned long)s->peak_rss);
+        }
+        fprintf(fp, "\n      }\n    }");
+    }
+    fprintf(fp, "%s],\n  \"io\": ", nrecords > 0 ? "\n  " : "");
+    io_write_json(fp);
+    fprintf(fp, "\n}\n");
+
+    if (fclose(fp) != 0) {
+        logging(LOG_SYSERR, path);
+        return -1;
+    }
+    logging(LOG_INFO, "report: %s", path);
+    return 0;
+}
+
+
+/*
+ * Log the summary of each variable, and write the report if requested.
+ * 'status': 0 if the run has succeeded.
+ */
+int
+stats_report(int status)
+{
+    int i, rval = 0;
+
+    if (LOG_INFO >= logging_threshold)
+        for (i = 0; i < nrecords; i++)
+            log_summary(records + i);
+
+    if (report_path && write_report(report_path, status) < 0)
+        rval = -1;
+
+    free(records);
+    records = current = NULL;
+    nrecords = max_records = 0;
+    return rval;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+#include <unistd.h>
+
+int
+test_stats(void)
+{
+    char path[] = "/tmp/statsXXXXXX";
+    char buf[4096];
+    double t0;
+    size_t len;
+    FILE *fp;
+    int fd, a, b;
+
+    a = stats_begin_var("ta");
+    b = stats_begin_var("ps");
+    assert(a == 0 && b == 1);
+
+    stats_select(a);
+    t0 = stats_clock();
+    stats_add(STAGE_OPEN, t0, 0);
+    stats_add(STAGE_READ, t0, 4000);
+    stats_add(STAGE_WRITE, t0, 2000);
+    stats_add_step();
+    stats_select(b);
+    stats_add(STAGE_READ, t0, 100);
+
+    assert(records[0].nfiles == 1 && records[0].nsteps == 1);
+    assert(records[0].bytes_in == 4000. && records[0].bytes_out == 2000.);
+    assert(records[1].bytes_in == 100. && records[1].nsteps == 0);
+    assert(total_seconds(records + 0) >= 0.);
+
+    assert((fd = mkstemp(path)) >= 0);
+    close(fd);
+    assert(set_stats_report(path) == 0);
+    assert(stats_report(0) == 0);
+    assert(nrecords == 0);
+
+    assert((fp = fopen(path, "r")) != NULL);
+    len = fread(buf, 1, sizeof buf - 1, fp);
+    buf[len] = '\0';
+    fclose(fp);
+    assert(strstr(buf, "\"status\": \"success\""));
+    assert(strstr(buf, "\"name\": \"ta\""));
+    assert(strstr(buf, "\"bytes_in\": 4000,"));
+    assert(strstr(buf, "\"name\": \"ps\""));
+
+    unlink(path);
+    free(report_path);
+    report_path = NULL;
+    printf("test_stats(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
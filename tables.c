@@ -6,7 +6,9 @@
  * the table for grid mapping is not needed.
  */
 #include "cmor.h"
+#include "cmor_supp.h"
 #include "logging.h"
+#include "internal.h"
 
 /*
  * IDs of two tables.
@@ -44,15 +46,21 @@ switch_to_normal_table(void)
 static int
 load_table(const char *path, int *table_id)
 {
+    double t0 = stats_clock();
     int id;
 
-    if (cmor_load_table((char *)path, &id) != 0) {
-        logging(LOG_ERR, "cmor_load_table() failed.");
-        return -1;
+    if (load_table_snapshot(path, &id) < 0) {
+        if (cmor_load_table((char *)path, &id) != 0) {
+            logging(LOG_ERR, "cmor_load_table() failed.");
+            return -1;
+        }
+        save_table_snapshot(path, id);
     }
 
     logging(LOG_INFO, "loaded (%s): table_id = %d", path, id);
+    invalidate_table_index(id);
     *table_id = id;
+    trace_span("load_table", t0);
     return 0;
 }
 
@@ -0,0 +1,681 @@
+/*
+ * tablesnap.c -- snapshot cache of parsed MIP tables.
+ *
+ * cmor_load_table() parses large JSON files (a MIP table, and
+ * coordinate, formula_terms and CV files) with json-c, which is a
+ * large share of the wall time of short conversions. After a table
+ * is loaded, the resulting cmor_tables[] entry (including the CV) is
+ * saved as a binary snapshot, and restored in the following runs.
+ *
+ * XXX: This depends on the internal of CMOR (like cmor_supp.c), and is
+ * experimental (enabled only with -DUSE_TABLE_SNAPSHOT). The key of a
+ * snapshot has the CMOR version and the sizes of the structures, so
+ * a snapshot made by another build of CMOR is never used. It also has
+ * the contents of the CV, coordinate and formula_terms files named in
+ * the current dataset; if any of them is not readable, no snapshot is
+ * saved or loaded.
+ *
+ * File format (native byte order):
+ *   struct snapshot_header;
+ *   cmor_table_t (as is);
+ *   for each axis (naxes + 1): requested, requested_bounds, crequested;
+ *   forcings[nforcings];
+ *   CV tree (a node, its strings, then its children).
+ * Arrays and strings are prefixed by their size in bytes (int64_t,
+ * -1 for NULL).
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmor.h"
+#include "logging.h"
+#include "internal.h"
+#include "myutils.h"
+
+#ifndef PATH_MAX
+#  define PATH_MAX 1024
+#endif
+
+#ifndef USE_TABLE_SNAPSHOT
+int
+set_table_snapshot_dir(const char *dir)
+{
+    logging(LOG_WARN, "table snapshots are not supported in this build.");
+    return 0;
+}
+
+
+int
+load_table_snapshot(const char *path, int *table_id)
+{
+    return -1;
+}
+
+
+int
+save_table_snapshot(const char *path, int table_id)
+{
+    return -1;
+}
+
+#else /* USE_TABLE_SNAPSHOT */
+
+#define SNAPSHOT_MAGIC "MIPCTBSN"
+#define SNAPSHOT_VERSION 1
+#define CV_MAX_DEPTH 32
+
+struct snapshot_header {
+    char magic[8];
+    int32_t version;
+    int32_t reserved;
+    uint64_t key;
+    int64_t size;
+};
+
+struct writer {
+    FILE *fp;
+    int error;
+};
+
+struct reader {
+    const char *ptr, *end;
+    int error;
+};
+
+static char *snapshot_dir = NULL;
+
+
+int
+set_table_snapshot_dir(const char *dir)
+{
+    struct stat sb;
+
+    if (stat(dir, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        logging(LOG_ERR, "%s: not a directory.", dir);
+        return -1;
+    }
+    free(snapshot_dir);
+    if ((snapshot_dir = strdup(dir)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * FNV-1a (64-bit) of a file. Return -1 if not readable.
+ */
+static int
+hash_file(uint64_t *hash, const char *path)
+{
+    char buf[65536];
+    size_t n;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+        return -1;
+    while ((n = fread(buf, 1, sizeof buf, fp)) > 0)
+        *hash = idreg_hash(*hash, buf, n);
+    fclose(fp);
+    return 0;
+}
+
+
+/*
+ * Resolve the path of a table as cmor_load_table() does.
+ */
+static int
+resolve_table_path(char *resolved, size_t size, const char *path)
+{
+    if (access(path, R_OK) == 0)
+        return snprintf(resolved, size, "%s", path) < size ? 0 : -1;
+
+    if (strchr(path, '/') == NULL && cmor_input_path[0] != '\0'
+        && snprintf(resolved, size, "%s/%s", cmor_input_path, path) < size
+        && access(resolved, R_OK) == 0)
+        return 0;
+    return -1;
+}
+
+
+/*
+ * Resolve the path of a file named in the current dataset (e.g.,
+ * "CMIP6_CV.json") as cmor_load_table() does: in the directory of the
+ * table, or else in cmor_input_path.
+ */
+static int
+resolve_companion_path(char *resolved, size_t size,
+                       const char *table_path, const char *name)
+{
+    const char *p;
+
+    if (strchr(name, '/'))
+        return snprintf(resolved, size, "%s", name) < size
+            && access(resolved, R_OK) == 0 ? 0 : -1;
+
+    p = strrchr(table_path, '/');
+    if (snprintf(resolved, size, "%.*s%s",
+                 p ? (int)(p + 1 - table_path) : 0, table_path, name) < size
+        && access(resolved, R_OK) == 0)
+        return 0;
+
+    if (cmor_input_path[0] != '\0'
+        && snprintf(resolved, size, "%s/%s", cmor_input_path, name) < size
+        && access(resolved, R_OK) == 0)
+        return 0;
+    return -1;
+}
+
+
+/*
+ * The key of a table: the CMOR version, the sizes of the structures,
+ * and the contents of the table and of the files cmor_load_table()
+ * reads with it (e.g., CMIP6_CV.json, CMIP6_coordinate.json and
+ * CMIP6_formula_terms.json, as named in the current dataset).
+ */
+static int
+snapshot_key(uint64_t *key, const char *path)
+{
+    char *companions[] = {
+        GLOBAL_CV_FILENAME, FILE_AXIS_ENTRY, FILE_FORMULA_TERM
+    };
+    int sizes[] = {
+        CMOR_VERSION_MAJOR, CMOR_VERSION_MINOR, CMOR_VERSION_PATCH,
+        sizeof(cmor_table_t), sizeof(cmor_axis_def_t),
+        sizeof(cmor_var_def_t), sizeof(cmor_CV_def_t)
+    };
+    char resolved[PATH_MAX + 1], other[PATH_MAX + 1];
+    char name[CMOR_MAX_STRING];
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int i;
+
+    if (resolve_table_path(resolved, sizeof resolved, path) < 0)
+        return -1;
+
+    hash = idreg_hash(hash, sizes, sizeof sizes);
+    hash = idreg_hash(hash, resolved, strlen(resolved) + 1);
+    if (hash_file(&hash, resolved) < 0)
+        return -1;
+
+    for (i = 0; i < sizeof companions / sizeof companions[0]; i++) {
+        if (cmor_get_cur_dataset_attribute(companions[i], name) != 0
+            || name[0] == '\0') {
+            logging(LOG_WARN, "%s: not in the dataset "
+                    "(table snapshot disabled).", companions[i]);
+            return -1;
+        }
+        if (resolve_companion_path(other, sizeof other, resolved, name) < 0
+            || hash_file(&hash, other) < 0) {
+            logging(LOG_WARN, "%s: not readable "
+                    "(table snapshot disabled).", name);
+            return -1;
+        }
+        hash = idreg_hash(hash, other, strlen(other) + 1);
+    }
+
+    *key = hash;
+    return 0;
+}
+
+
+static int
+snapshot_path(char *path, size_t size, uint64_t key)
+{
+    return snprintf(path, size, "%s/table-%016llx.bin",
+                    snapshot_dir, (unsigned long long)key) < size ? 0 : -1;
+}
+
+
+/*
+ * writer
+ */
+static void
+put(struct writer *w, const void *ptr, size_t size)
+{
+    if (!w->error && size > 0 && fwrite(ptr, 1, size, w->fp) != size)
+        w->error = 1;
+}
+
+
+static void
+put_array(struct writer *w, const void *ptr, size_t size)
+{
+    int64_t len = ptr ? (int64_t)size : -1;
+
+    put(w, &len, sizeof len);
+    if (ptr)
+        put(w, ptr, size);
+}
+
+
+static void
+put_string(struct writer *w, const char *str)
+{
+    put_array(w, str, str ? strlen(str) + 1 : 0);
+}
+
+
+static void
+put_cv(struct writer *w, const cmor_CV_def_t *cv, int depth)
+{
+    int i;
+
+    if (depth > CV_MAX_DEPTH) {
+        w->error = 1;
+        return;
+    }
+    put(w, cv, sizeof(cmor_CV_def_t));
+    for (i = 0; i < cv->anElements; i++)
+        put_string(w, cv->aszValue[i]);
+    for (i = 0; i < cv->nbObjects; i++)
+        put_cv(w, cv->oValue + i, depth + 1);
+}
+
+
+/*
+ * reader
+ */
+static const void *
+get(struct reader *r, size_t size)
+{
+    const char *p = r->ptr;
+
+    if (r->error || size > r->end - r->ptr) {
+        r->error = 1;
+        return NULL;
+    }
+    r->ptr += size;
+    return p;
+}
+
+
+/*
+ * Return a copy (to be freed by CMOR) of an array or a string.
+ */
+static void *
+get_array(struct reader *r)
+{
+    const int64_t *len;
+    const void *src;
+    void *dest;
+
+    if ((len = get(r, sizeof(int64_t))) == NULL || *len < 0)
+        return NULL;
+    if ((src = get(r, *len)) == NULL)
+        return NULL;
+    if ((dest = malloc(*len > 0 ? *len : 1)) == NULL) {
+        r->error = 1;
+        return NULL;
+    }
+    memcpy(dest, src, *len);
+    return dest;
+}
+
+
+static void
+get_cv(struct reader *r, cmor_CV_def_t *cv, int table_id, int depth)
+{
+    const cmor_CV_def_t *src;
+    int i;
+
+    if (depth > CV_MAX_DEPTH || (src = get(r, sizeof(cmor_CV_def_t))) == NULL) {
+        r->error = 1;
+        memset(cv, 0, sizeof(cmor_CV_def_t));
+        return;
+    }
+    memcpy(cv, src, sizeof(cmor_CV_def_t));
+    cv->table_id = table_id;
+    cv->aszValue = NULL;
+    cv->oValue = NULL;
+
+    if (cv->anElements > 0) {
+        if ((cv->aszValue = calloc(cv->anElements, sizeof(char *))) == NULL) {
+            r->error = 1;
+            cv->anElements = 0;
+        }
+        for (i = 0; i < cv->anElements; i++)
+            cv->aszValue[i] = get_array(r);
+    }
+    if (cv->nbObjects > 0) {
+        if ((cv->oValue = calloc(cv->nbObjects, sizeof(cmor_CV_def_t)))
+            == NULL) {
+            r->error = 1;
+            cv->nbObjects = 0;
+        }
+        for (i = 0; i < cv->nbObjects; i++)
+            get_cv(r, cv->oValue + i, table_id, depth + 1);
+    }
+}
+
+
+/*
+ * Restore a table from the snapshot if any.
+ * Return 0 on success, -1 if not restored (the table must be loaded
+ * by cmor_load_table()).
+ */
+int
+load_table_snapshot(const char *path, int *table_id)
+{
+    char spath[PATH_MAX + 1];
+    const struct snapshot_header *head;
+    const cmor_table_t *src;
+    cmor_table_t *table;
+    struct reader r;
+    struct stat sb;
+    uint64_t key;
+    void *map;
+    int fd, id, i, nelems;
+
+    if (!snapshot_dir
+        || snapshot_key(&key, path) < 0
+        || snapshot_path(spath, sizeof spath, key) < 0
+        || (fd = open(spath, O_RDONLY)) < 0)
+        return -1;
+
+    if (fstat(fd, &sb) < 0 || sb.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    head = map;
+    r.ptr = (const char *)map + sizeof(struct snapshot_header);
+    r.end = (const char *)map + sb.st_size;
+    r.error = 0;
+    if (memcmp(head->magic, SNAPSHOT_MAGIC, 8) != 0
+        || head->version != SNAPSHOT_VERSION
+        || head->key != key
+        || head->size != sb.st_size
+        || (src = get(&r, sizeof(cmor_table_t))) == NULL) {
+        logging(LOG_WARN, "%s: mismatched table snapshot (ignored).", spath);
+        munmap(map, sb.st_size);
+        return -1;
+    }
+
+    /*
+     * already loaded? (as cmor_load_table() does)
+     */
+    for (i = 0; i <= cmor_ntables; i++)
+        if (strcmp(cmor_tables[i].path, src->path) == 0) {
+            munmap(map, sb.st_size);
+            cmor_set_table(i);
+            *table_id = i;
+            return 0;
+        }
+    if ((id = cmor_ntables + 1) >= CMOR_MAX_TABLES) {
+        munmap(map, sb.st_size);
+        return -1;
+    }
+
+    table = &cmor_tables[id];
+    memcpy(table, src, sizeof(cmor_table_t));
+    table->id = id;
+
+    nelems = sizeof table->axes / sizeof table->axes[0];
+    for (i = 0; i < nelems; i++) {
+        table->axes[i].table_id = id;
+        table->axes[i].requested = NULL;
+        table->axes[i].requested_bounds = NULL;
+        table->axes[i].crequested = NULL;
+    }
+    for (i = 0; i < table->naxes + 1 && i < nelems; i++) {
+        table->axes[i].requested = get_array(&r);
+        table->axes[i].requested_bounds = get_array(&r);
+        table->axes[i].crequested = get_array(&r);
+    }
+    for (i = 0; i < sizeof table->vars / sizeof table->vars[0]; i++)
+        table->vars[i].table_id = id;
+    for (i = 0; i < sizeof table->formula / sizeof table->formula[0]; i++)
+        table->formula[i].table_id = id;
+
+    table->forcings = NULL;
+    if (table->nforcings > 0) {
+        if ((table->forcings = calloc(table->nforcings, sizeof(char *)))
+            == NULL)
+            r.error = 1;
+        for (i = 0; i < table->nforcings && !r.error; i++)
+            table->forcings[i] = get_array(&r);
+    }
+
+    table->CV = NULL;
+    if (src->CV) {
+        if ((table->CV = malloc(sizeof(cmor_CV_def_t))) == NULL)
+            r.error = 1;
+        else
+            get_cv(&r, table->CV, id, 0);
+    }
+    munmap(map, sb.st_size);
+
+    if (r.error) {
+        /*
+         * XXX: The partially restored entry is left unused
+         * (cmor_ntables is not incremented).
+         */
+        logging(LOG_WARN, "%s: broken table snapshot (ignored).", spath);
+        return -1;
+    }
+
+    cmor_ntables = id;
+    cmor_set_table(id);
+    *table_id = id;
+    logging(LOG_INFO, "table restored from snapshot: %s", spath);
+    return 0;
+}
+
+
+/*
+ * Save a table loaded by cmor_load_table(). A failure is not fatal.
+ */
+int
+save_table_snapshot(const char *path, int table_id)
+{
+    char spath[PATH_MAX + 1], temp[PATH_MAX + 1];
+    struct snapshot_header head;
+    const cmor_table_t *table;
+    const cmor_axis_def_t *adef;
+    struct writer w;
+    uint64_t key;
+    int i;
+
+    if (!snapshot_dir
+        || table_id < 0 || table_id >= CMOR_MAX_TABLES
+        || snapshot_key(&key, path) < 0
+        || snapshot_path(spath, sizeof spath, key) < 0
+        || snprintf(temp, sizeof temp, "%s.%d", spath, (int)getpid())
+           >= sizeof temp)
+        return -1;
+
+    if ((w.fp = fopen(temp, "wb")) == NULL) {
+        logging(LOG_SYSERR, temp);
+        return -1;
+    }
+    w.error = 0;
+    table = &cmor_tables[table_id];
+
+    memset(&head, 0, sizeof head);
+    memcpy(head.magic, SNAPSHOT_MAGIC, 8);
+    head.version = SNAPSHOT_VERSION;
+    head.key = key;
+    put(&w, &head, sizeof head);    /* size is set later */
+
+    put(&w, table, sizeof(cmor_table_t));
+    for (i = 0; i < table->naxes + 1; i++) {
+        adef = table->axes + i;
+        put_array(&w, adef->requested,
+                  sizeof(double) * adef->n_requested);
+        put_array(&w, adef->requested_bounds,
+                  sizeof(double) * adef->n_requested_bounds);
+        put_string(&w, adef->crequested);
+    }
+    for (i = 0; i < table->nforcings; i++)
+        put_string(&w, table->forcings ? table->forcings[i] : NULL);
+    if (table->CV)
+        put_cv(&w, table->CV, 0);
+
+    if (!w.error) {
+        head.size = ftell(w.fp);
+        if (fseek(w.fp, 0L, SEEK_SET) < 0)
+            w.error = 1;
+        put(&w, &head, sizeof head);
+    }
+    if (fclose(w.fp) != 0 || w.error || rename(temp, spath) < 0) {
+        logging(LOG_SYSERR, temp);
+        unlink(temp);
+        return -1;
+    }
+    logging(LOG_INFO, "table saved to snapshot: %s", spath);
+    return 0;
+}
+#endif /* USE_TABLE_SNAPSHOT */
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+
+#ifdef USE_TABLE_SNAPSHOT
+static void
+compare_cv(const cmor_CV_def_t *cv1, const cmor_CV_def_t *cv2, int table_id)
+{
+    int i;
+
+    assert(cv2->table_id == table_id);
+    assert(strcmp(cv1->key, cv2->key) == 0);
+    assert(strcmp(cv1->szValue, cv2->szValue) == 0);
+    assert(cv1->type == cv2->type
+           && cv1->nValue == cv2->nValue
+           && cv1->dValue == cv2->dValue);
+    assert(cv1->anElements == cv2->anElements
+           && cv1->nbObjects == cv2->nbObjects);
+    for (i = 0; i < cv1->anElements; i++)
+        assert(strcmp(cv1->aszValue[i], cv2->aszValue[i]) == 0);
+    for (i = 0; i < cv1->nbObjects; i++)
+        compare_cv(cv1->oValue + i, cv2->oValue + i, table_id);
+}
+
+
+static int
+same_array(const void *p1, const void *p2, size_t size)
+{
+    return (p1 == NULL && p2 == NULL)
+        || (p1 && p2 && memcmp(p1, p2, size) == 0);
+}
+
+
+/*
+ * A table restored from the snapshot must be the same as the one
+ * loaded by cmor_load_table() (the current table).
+ */
+static void
+test1(void)
+{
+    char dir[] = "/tmp/tablesnapXXXXXX";
+    char path[CMOR_MAX_STRING], spath[PATH_MAX + 1];
+    const cmor_table_t *t1, *t2;
+    const cmor_axis_def_t *a1, *a2;
+    uint64_t key;
+    int id0 = CMOR_TABLE, id, i;
+
+    assert(mkdtemp(dir) != NULL);
+    assert(set_table_snapshot_dir(dir) == 0);
+
+    t1 = &cmor_tables[id0];
+    strlcpy(path, t1->path, sizeof path);
+    assert(save_table_snapshot(path, id0) == 0);
+
+    /* hide the loaded table, which would be returned as is. */
+    cmor_tables[id0].path[0] = '\0';
+    assert(load_table_snapshot(path, &id) == 0);
+    strlcpy(cmor_tables[id0].path, path, sizeof cmor_tables[id0].path);
+    assert(id != id0 && id == cmor_ntables);
+
+    t2 = &cmor_tables[id];
+    assert(t2->id == id);
+    assert(strcmp(t1->szTable_id, t2->szTable_id) == 0);
+    assert(strcmp(t1->path, t2->path) == 0);
+    assert(t1->nvars == t2->nvars
+           && t1->naxes == t2->naxes
+           && t1->nformula == t2->nformula);
+
+    for (i = 0; i < t1->naxes + 1; i++) {
+        a1 = t1->axes + i;
+        a2 = t2->axes + i;
+        assert(a2->table_id == id);
+        assert(strcmp(a1->id, a2->id) == 0);
+        assert(a1->n_requested == a2->n_requested
+               && a1->n_requested_bounds == a2->n_requested_bounds);
+        assert(same_array(a1->requested, a2->requested,
+                          sizeof(double) * a1->n_requested));
+        assert(same_array(a1->requested_bounds, a2->requested_bounds,
+                          sizeof(double) * a1->n_requested_bounds));
+        assert((a1->crequested == NULL && a2->crequested == NULL)
+               || strcmp(a1->crequested, a2->crequested) == 0);
+    }
+    for (i = 0; i < t1->nvars + 1; i++) {
+        assert(t2->vars[i].table_id == id);
+        assert(strcmp(t1->vars[i].id, t2->vars[i].id) == 0);
+    }
+    for (i = 0; i < t1->nformula + 1; i++)
+        assert(t2->formula[i].table_id == id);
+
+    assert(t1->nforcings == t2->nforcings);
+    for (i = 0; i < t1->nforcings; i++)
+        assert(strcmp(t1->forcings[i], t2->forcings[i]) == 0);
+
+    assert((t1->CV == NULL) == (t2->CV == NULL));
+    if (t1->CV)
+        compare_cv(t1->CV, t2->CV, id);
+
+    /* drop the restored one (not freed). */
+    cmor_ntables--;
+    cmor_set_table(id0);
+
+    assert(snapshot_key(&key, path) == 0
+           && snapshot_path(spath, sizeof spath, key) == 0);
+    unlink(spath);
+
+    /* refused if a file named in the dataset is not readable. */
+    {
+        char saved[CMOR_MAX_STRING];
+
+        assert(cmor_get_cur_dataset_attribute(GLOBAL_CV_FILENAME,
+                                              saved) == 0);
+        assert(cmor_set_cur_dataset_attribute(GLOBAL_CV_FILENAME,
+                                              "no_such_CV.json", 1) == 0);
+        assert(snapshot_key(&key, path) < 0);
+        assert(save_table_snapshot(path, id0) < 0);
+        assert(load_table_snapshot(path, &id) < 0);
+        assert(cmor_set_cur_dataset_attribute(GLOBAL_CV_FILENAME,
+                                              saved, 1) == 0);
+    }
+    rmdir(dir);
+    free(snapshot_dir);
+    snapshot_dir = NULL;
+}
+#endif /* USE_TABLE_SNAPSHOT */
+
+
+int
+test_tablesnap(void)
+{
+#ifdef USE_TABLE_SNAPSHOT
+    test1();
+    printf("test_tablesnap(): DONE\n");
+#else
+    printf("test_tablesnap(): skipped (without USE_TABLE_SNAPSHOT)\n");
+#endif
+    return 0;
+}
+#endif /* TEST_MAIN2 */
@@ -110,7 +110,7 @@ set_calendar(int cal)
         logging(LOG_ERR, "cmor_set_cur_dataset_attribute() failed.");
         return -1;
     }
-    logging(LOG_INFO, "set calendar (%s).", p);
+    LOGGING(LOG_INFO, "set calendar (%s).", p);
     calendar = cal;
     return 0;
 }
@@ -142,6 +142,7 @@ get_timeaxis(const cmor_axis_def_t *timedef)
 {
     const int UNLIMITED = 0;
     char tunit[128];
+    char key[CMOR_MAX_STRING + sizeof tunit + 8];
     int axis;
 
     if (basetime.hour == 0 && basetime.min == 0 && basetime.sec == 0)
@@ -154,12 +155,17 @@ get_timeaxis(const cmor_axis_def_t *timedef)
                  basetime.year, basetime.mon, basetime.day,
                  basetime.hour, basetime.min, basetime.sec);
 
+    snprintf(key, sizeof key, "time %s %s", timedef->id, tunit);
+    if ((axis = idreg_lookup(key)) >= 0)
+        return axis;
+
     if (cmor_axis(&axis, (char *)timedef->id, tunit, UNLIMITED,
                   NULL, 'd', NULL, 0, NULL) != 0) {
         logging(LOG_ERR, "cmor_axis() failed.");
         return -1;
     }
-    logging(LOG_INFO, "units of time: %s", tunit);
+    LOGGING(LOG_INFO, "units of time: %s", tunit);
+    idreg_register(key, axis);
     return axis;
 }
 
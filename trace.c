@@ -0,0 +1,362 @@
+/*
+ * trace.c -- timeline of a run in Chrome trace-event format (--trace).
+ *
+ * Spans are recorded as complete events ("ph": "X") into a buffer of
+ * each thread, and written out when the buffer is full and at the end
+ * of a run.  A buffer has a lock of its own, taken by its thread on
+ * each append (uncontended but for the end of a run), so that
+ * finish_trace() can write out the buffers of other threads that are
+ * still running.  The global mutex is always taken before the lock of
+ * a buffer. The file can be loaded into Perfetto or chrome://tracing.
+ *
+ * Without --trace, each hook costs only a test of 'trace_enabled'.
+ */
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "internal.h"
+
+#define MAX_EVENTS 8192         /* per thread, before written out */
+
+struct event {
+    const char *name;           /* string literal */
+    const char *argname;        /* string literal or NULL */
+    long argval;
+    double start;               /* by stats_clock() */
+    double end;
+};
+
+struct thread_buffer {
+    pthread_mutex_t lock;       /* for events, nevents and thread_name */
+    struct event events[MAX_EVENTS];
+    int nevents;
+    long tid;
+    const char *thread_name;
+    struct thread_buffer *next;
+};
+
+int trace_enabled = 0;
+
+static FILE *output = NULL;
+static char *output_path = NULL;
+static double origin;           /* stats_clock() at the start */
+static int nwritten = 0;
+static int pid;
+
+static struct thread_buffer *buffers = NULL;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct thread_buffer *mybuf = NULL;
+
+
+static void
+write_separator(void)
+{
+    fputs(nwritten++ > 0 ? ",\n" : "\n", output);
+}
+
+
+/*
+ * Write out the events of a buffer (the mutex and the lock of the
+ * buffer must be taken).
+ */
+static void
+flush_buffer(struct thread_buffer *buf)
+{
+    const struct event *ev;
+    int i;
+
+    for (i = 0; i < buf->nevents; i++) {
+        ev = buf->events + i;
+        write_separator();
+        fprintf(output,
+                "{\"name\":\"%s\",\"cat\":\"mipconv\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld",
+                ev->name,
+                1e6 * (ev->start - origin),
+                1e6 * (ev->end - ev->start),
+                pid, buf->tid);
+        if (ev->argname)
+            fprintf(output, ",\"args\":{\"%s\":%ld}",
+                    ev->argname, ev->argval);
+        fputc('}', output);
+    }
+    buf->nevents = 0;
+}
+
+
+static struct thread_buffer *
+get_buffer(void)
+{
+    struct thread_buffer *buf;
+
+    if (mybuf)
+        return mybuf;
+
+    if ((buf = malloc(sizeof(struct thread_buffer))) == NULL)
+        return NULL;
+    pthread_mutex_init(&buf->lock, NULL);
+    buf->nevents = 0;
+    buf->tid = (long)syscall(SYS_gettid);
+    buf->thread_name = NULL;
+
+    pthread_mutex_lock(&mutex);
+    buf->next = buffers;
+    buffers = buf;
+    pthread_mutex_unlock(&mutex);
+
+    mybuf = buf;
+    return buf;
+}
+
+
+static void
+finish_trace_at_exit(void)
+{
+    finish_trace();
+}
+
+
+int
+set_trace_file(const char *path)
+{
+    if ((output_path = strdup(path)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        return -1;
+    }
+    if ((output = fopen(path, "w")) == NULL) {
+        logging(LOG_SYSERR, path);
+        return -1;
+    }
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", output);
+    origin = stats_clock();
+    pid = (int)getpid();
+    trace_enabled = 1;
+
+    /* written even if exit() is called on error. */
+    atexit(finish_trace_at_exit);
+    return 0;
+}
+
+
+/*
+ * Name the calling thread in the timeline.
+ */
+void
+trace_thread_name(const char *name)
+{
+    struct thread_buffer *buf;
+
+    if (trace_enabled && (buf = get_buffer()) != NULL) {
+        pthread_mutex_lock(&buf->lock);
+        buf->thread_name = name;
+        pthread_mutex_unlock(&buf->lock);
+    }
+}
+
+
+/*
+ * Record a span from 'start' (by stats_clock()) to now, with an
+ * integer argument if 'argname' is not NULL.
+ */
+void
+trace_span_arg(const char *name, double start,
+               const char *argname, long argval)
+{
+    struct thread_buffer *buf;
+    struct event *ev;
+    double end;
+
+    if (!trace_enabled || (buf = get_buffer()) == NULL)
+        return;
+
+    end = stats_clock();
+    pthread_mutex_lock(&buf->lock);
+    if (buf->nevents == MAX_EVENTS) {
+        /* retake in the order of finish_trace(). */
+        pthread_mutex_unlock(&buf->lock);
+        pthread_mutex_lock(&mutex);
+        pthread_mutex_lock(&buf->lock);
+        if (buf->nevents == MAX_EVENTS) {
+            if (output)
+                flush_buffer(buf);
+            else
+                buf->nevents = 0;   /* finished */
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+    ev = buf->events + buf->nevents;
+    ev->name = name;
+    ev->argname = argname;
+    ev->argval = argval;
+    ev->start = start;
+    ev->end = end;
+    buf->nevents++;
+    pthread_mutex_unlock(&buf->lock);
+}
+
+
+void
+trace_span(const char *name, double start)
+{
+    trace_span_arg(name, start, NULL, 0);
+}
+
+
+/*
+ * Write out all the events, and close the trace file.
+ *
+ * Buffers are flushed but not freed: at exit(), other threads may
+ * still be running and own theirs.
+ */
+int
+finish_trace(void)
+{
+    struct thread_buffer *buf;
+    int rval = 0;
+
+    if (!output)
+        return 0;
+
+    pthread_mutex_lock(&mutex);
+    for (buf = buffers; buf; buf = buf->next) {
+        pthread_mutex_lock(&buf->lock);
+        flush_buffer(buf);
+        if (buf->thread_name) {
+            write_separator();
+            fprintf(output,
+                    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                    "\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                    pid, buf->tid, buf->thread_name);
+        }
+        pthread_mutex_unlock(&buf->lock);
+    }
+    write_separator();
+    fprintf(output,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"mipconv\"}}\n]}\n", pid);
+
+    if (fclose(output) != 0) {
+        logging(LOG_SYSERR, output_path);
+        rval = -1;
+    } else
+        logging(LOG_INFO, "trace: %s (%d events)", output_path, nwritten);
+    output = NULL;
+    trace_enabled = 0;
+    pthread_mutex_unlock(&mutex);
+
+    free(output_path);
+    output_path = NULL;
+    return rval;
+}
+
+
+#ifdef TEST_MAIN2
+#include <assert.h>
+#include <sched.h>
+
+static volatile int stop_spans;
+
+static void *
+record_spans(void *arg)
+{
+    double t0;
+
+    trace_thread_name("spans");
+    *(volatile int *)arg = 1;
+    while (!stop_spans) {
+        t0 = stats_clock();
+        trace_span_arg("span", t0, "arg", 123456789L);
+    }
+    return NULL;
+}
+
+
+/*
+ * Finish a trace while another thread is appending to its buffer:
+ * every event written out must be whole.
+ */
+static void
+test_concurrent(void)
+{
+    char path[] = "/tmp/traceXXXXXX";
+    char line[512];
+    pthread_t thread;
+    volatile int started = 0;
+    FILE *fp;
+    int fd, nspans = 0;
+
+    assert((fd = mkstemp(path)) >= 0);
+    close(fd);
+    assert(set_trace_file(path) == 0);
+
+    stop_spans = 0;
+    assert(pthread_create(&thread, NULL, record_spans,
+                          (void *)&started) == 0);
+    while (!started)
+        sched_yield();
+    usleep(10000);
+    assert(finish_trace() == 0);
+    stop_spans = 1;
+    pthread_join(thread, NULL);
+
+    assert((fp = fopen(path, "r")) != NULL);
+    while (fgets(line, sizeof line, fp)) {
+        if (strncmp(line, "{\"name\":\"span\",", 15) != 0)
+            continue;
+        assert(strstr(line, ",\"args\":{\"arg\":123456789}}"));
+        nspans++;
+    }
+    fclose(fp);
+    assert(nspans > 0);
+    unlink(path);
+}
+
+
+int
+test_trace(void)
+{
+    char path[] = "/tmp/traceXXXXXX";
+    char buf[4096];
+    double t0;
+    size_t len;
+    FILE *fp;
+    int fd, i;
+
+    trace_span("none", stats_clock());
+    assert(buffers == NULL);
+
+    assert((fd = mkstemp(path)) >= 0);
+    close(fd);
+    assert(set_trace_file(path) == 0);
+
+    trace_thread_name("main");
+    t0 = stats_clock();
+    for (i = 0; i < MAX_EVENTS + 10; i++)
+        trace_span("read", t0);
+    trace_span_arg("step", t0, "chunk", 42);
+    assert(mybuf->nevents == 11);
+    assert(finish_trace() == 0);
+    assert(!trace_enabled && buffers == mybuf && mybuf->nevents == 0);
+
+    assert((fp = fopen(path, "r")) != NULL);
+    len = fread(buf, 1, sizeof buf - 1, fp);
+    buf[len] = '\0';
+    fclose(fp);
+    assert(strncmp(buf, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 39)
+           == 0);
+    assert(strstr(buf, "\"name\":\"read\",\"cat\":\"mipconv\",\"ph\":\"X\""));
+
+    unlink(path);
+
+    test_concurrent();
+    printf("test_trace(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
@@ -89,6 +89,117 @@ get_lonlat(double *lon, double *lat, Polar z)
 }
 
 
+/*
+ * Complex numbers in Cartesian form.
+ */
+struct Cmplx_t {
+    double re, im;
+};
+typedef struct Cmplx_t Cmplx;
+
+
+static Cmplx
+to_cartesian(Polar a)
+{
+    Cmplx z;
+
+    z.re = a.r * cos(a.th);
+    z.im = a.r * sin(a.th);
+    return z;
+}
+
+
+static Cmplx
+csub(Cmplx a, Cmplx b)
+{
+    Cmplx z;
+
+    z.re = a.re - b.re;
+    z.im = a.im - b.im;
+    return z;
+}
+
+
+static Cmplx
+cmul(Cmplx a, Cmplx b)
+{
+    Cmplx z;
+
+    z.re = a.re * b.re - a.im * b.im;
+    z.im = a.re * b.im + a.im * b.re;
+    return z;
+}
+
+
+/*
+ * Coefficients of the backward transformation.
+ */
+struct Mobius_t {
+    Cmplx ca, cb, bca, acb;
+    double lon_b, lat_b;        /* f^{-1}(inf) */
+};
+typedef struct Mobius_t Mobius;
+
+
+static void
+setup_mobius(Mobius *m, Polar a, Polar b, Polar c)
+{
+    Cmplx ac, bc, cc;
+
+    ac = to_cartesian(a);
+    bc = to_cartesian(b);
+    cc = to_cartesian(c);
+    m->ca = csub(cc, ac);
+    m->cb = csub(cc, bc);
+    m->bca = cmul(bc, m->ca);
+    m->acb = cmul(ac, m->cb);
+    get_lonlat(&m->lon_b, &m->lat_b, b);
+}
+
+
+/*
+ * Backward transformation of a row in Cartesian form:
+ *   z = (b w (c - a) - a (c - b)) / (w (c - a) - (c - b))
+ * where w = (alpha p[i], beta q[i]).
+ *
+ * Only the result is converted into angles, and the loop has
+ * no branch so that it can be vectorized.
+ */
+static void
+backward_row(double *lon, double *lat, int len,
+             const double *p, double alpha, const double *q, double beta,
+             const Mobius *m)
+{
+    int i;
+
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (i = 0; i < len; i++) {
+        double wr, wi, ur, ui, vr, vi, d, zr, zi;
+
+        wr = alpha * p[i];
+        wi = beta * q[i];
+        ur = wr * m->bca.re - wi * m->bca.im - m->acb.re;
+        ui = wr * m->bca.im + wi * m->bca.re - m->acb.im;
+        vr = wr * m->ca.re - wi * m->ca.im - m->cb.re;
+        vi = wr * m->ca.im + wi * m->ca.re - m->cb.im;
+
+        d = vr * vr + vi * vi;
+        zr = (ur * vr + ui * vi) / d;
+        zi = (ui * vr - ur * vi) / d;
+
+        lon[i] = divmod2(RAD2DEG(atan2(zi, zr)), 360.);
+        lat[i] = 90. - RAD2DEG(2. * atan(hypot(zr, zi)));
+    }
+}
+
+
+#ifdef TEST_MAIN2
+/*
+ * Complex arithmetic in polar form.
+ * It is used as a reference in tests.
+ */
 static Polar
 psub(Polar a, Polar b)
 {
@@ -180,6 +291,7 @@ backward_f(Polar *z, const Polar *w, size_t size,
         z[i] = pdiv(u, v);
     }
 }
+#endif /* TEST_MAIN2 */
 
 
 /*
@@ -194,15 +306,16 @@ backward_transform(double *lon, double *lat,
                    const double *x, const double *y,
                    int xlen, int ylen)
 {
-    Polar a, b, c;
-    Polar *w = NULL, *z = NULL;
-    double xdeg, rlon, rlat;
+    Polar a, b, c, w;
+    Mobius m;
+    double *r = NULL, *rs = NULL;
+    double xdeg, rlat, sign, ydeg;
     int i, j, ij, rval = -1;
-    int joint_index = 0;
+    int joint_index = ylen;     /* all south unless found */
     const double EPS = 1e-7;
 
-    if ((w = malloc(sizeof(Polar) * xlen)) == NULL
-        || (z = malloc(sizeof(Polar) * xlen)) == NULL) {
+    if ((r = malloc(sizeof(double) * xlen)) == NULL
+        || (rs = malloc(sizeof(double) * xlen)) == NULL) {
         logging(LOG_SYSERR, NULL);
         goto finish;
     }
@@ -226,39 +339,56 @@ backward_transform(double *lon, double *lat,
 
     /*
      * north (bipolar grid)
+     *
+     * (xdeg, ydeg) -> (rlon, rlat):
+     *   rlat = 90 - xdeg,  rlon = -90 + ydeg   (xdeg <= 180)
+     *   rlat = xdeg - 270, rlon =  90 - ydeg   (otherwise)
+     * where ydeg = y - pole_latitude.
+     *
+     * Then, w = r(rlat) exp(i rlon) = r (sin(ydeg), -sign cos(ydeg)),
+     * where sign = 1 (xdeg <= 180) or -1, is separable.
      */
+    for (i = 0; i < xlen; i++) {
+        xdeg = divmod2(x[i], 360.);
+        if (xdeg <= 180.) {
+            rlat = 90. - xdeg;
+            sign = 1.;
+        } else {
+            rlat = xdeg - 270.;
+            sign = -1.;
+        }
+        w = get_polar(0., rlat);
+        r[i] = w.r;
+        rs[i] = -sign * w.r;
+    }
+
     a = get_polar(a_longitude, a_latitude);
     b = get_polar(b_longitude, b_latitude);
     c = get_polar(c_longitude, c_latitude);
+    setup_mobius(&m, a, b, c);
+
+#ifdef _OPENMP
+#pragma omp parallel for private(i, ydeg) schedule(static)
+#endif
     for (j = joint_index; j < ylen; j++) {
-        for (i = 0; i < xlen; i++) {
-            /*
-             * (xdeg, ydeg) -> (rlon, rlat)
-             */
-            xdeg = divmod2(x[i], 360.);
-            if (xdeg <= 180.) {
-                rlat = 90. - xdeg;
-                rlon = -90. + (y[j] - pole_latitude);
-            } else {
-                rlat = xdeg - 270.;
-                rlon = 90. - (y[j] - pole_latitude);
-            }
-            w[i] = get_polar(rlon, rlat);
-        }
-        backward_f(z, w, xlen, a, b, c);
+        double *lonp = lon + xlen * j;
+        double *latp = lat + xlen * j;
 
-        for (i = 0; i < xlen; i++) {
-            ij = i + xlen * j;
+        ydeg = DEG2RAD(y[j] - pole_latitude);
+        backward_row(lonp, latp, xlen, r, sin(ydeg), rs, cos(ydeg), &m);
 
-            get_lonlat(lon + ij, lat + ij, z[i]);
-            lon[ij] = divmod2(lon[ij], 360.);
-        }
+        /* f^{-1}(inf) = b */
+        for (i = 0; i < xlen; i++)
+            if (r[i] == R_INF) {
+                lonp[i] = divmod2(m.lon_b, 360.);
+                latp[i] = m.lat_b;
+            }
     }
     rval = 0;
 
 finish:
-    free(z);
-    free(w);
+    free(rs);
+    free(r);
     return rval;
 }
 
@@ -270,6 +400,20 @@ set_pole_position(double plat)
 }
 
 
+/*
+ * true lat/lon of cell centers (for site locations).
+ */
+int
+get_tripolar_lonlat(double *lon, double *lat,
+                    const double *xx, int x_len,
+                    const double *yy, int y_len,
+                    double plat)
+{
+    set_pole_position(plat);
+    return backward_transform(lon, lat, xx, yy, x_len, y_len);
+}
+
+
 /*
  * setup grid mapping: tripolar.
  */
@@ -281,14 +425,8 @@ setup_tripolar(int *grid_id,
 {
     int id;
     int axes_ids[2];
-    double *lon = NULL, *lat = NULL;
-    double *lon_vertices = NULL;
-    double *lat_vertices = NULL;
-    double *lon_bnds = NULL;
-    double *lat_bnds = NULL;
+    cached_grid grid;
     int rval = -1;
-    int len, lenv;
-    int i, j, n, vp0, vp1, vp2, vp3;
     const char *xname = "x_deg";
     const char *yname = "y_deg";
 
@@ -312,55 +450,15 @@ setup_tripolar(int *grid_id,
     /*
      * lat(yy, xx) and lat(yy, xx).
      */
-    len = x_len * y_len;
-    lenv = (x_len + 1) * (y_len + 1);
-    if ((lon = malloc(sizeof(double) * len)) == NULL
-        || (lat = malloc(sizeof(double) * len)) == NULL
-        || (lon_bnds = malloc(sizeof(double) * lenv)) == NULL
-        || (lat_bnds = malloc(sizeof(double) * lenv)) == NULL
-        || (lon_vertices = malloc(sizeof(double) * 4 * len)) == NULL
-        || (lat_vertices = malloc(sizeof(double) * 4 * len)) == NULL) {
-        logging(LOG_SYSERR, NULL);
+    if (build_grid(&grid, xx, x_bnds, x_len, yy, y_bnds, y_len,
+                   backward_transform) < 0)
         goto finish;
-    }
-
-    /*
-     * coordinates transformation (from fake to true).
-     */
-    if (backward_transform(lon, lat, xx, yy, x_len, y_len) < 0
-        || backward_transform(lon_bnds, lat_bnds,
-                              x_bnds, y_bnds,
-                              x_len + 1, y_len + 1) < 0)
-        goto finish;
-
-    /*
-     * make vertices.
-     */
-    for (j = 0; j < y_len; j++)
-        for (i = 0; i < x_len; i++) {
-            n = i + x_len * j;
-
-            vp0 = n + j;
-            vp1 = vp0 + 1;
-            vp2 = vp1 + x_len + 1;
-            vp3 = vp0 + x_len + 1;
-
-            lon_vertices[4 * n + 0] = lon_bnds[vp0];
-            lon_vertices[4 * n + 1] = lon_bnds[vp1];
-            lon_vertices[4 * n + 2] = lon_bnds[vp2];
-            lon_vertices[4 * n + 3] = lon_bnds[vp3];
-
-            lat_vertices[4 * n + 0] = lat_bnds[vp0];
-            lat_vertices[4 * n + 1] = lat_bnds[vp1];
-            lat_vertices[4 * n + 2] = lat_bnds[vp2];
-            lat_vertices[4 * n + 3] = lat_bnds[vp3];
-        }
 
     if (cmor_grid(&id, 2, axes_ids, 'd',
-                  lat, lon,
+                  grid.lat, grid.lon,
                   4,
-                  lat_vertices,
-                  lon_vertices) != 0) {
+                  grid.lat_vertices,
+                  grid.lon_vertices) != 0) {
         logging(LOG_ERR, "cmor_grid() failed.");
         goto finish;
     }
@@ -370,12 +468,7 @@ setup_tripolar(int *grid_id,
     rval = 0;
 
 finish:
-    free(lat_vertices);
-    free(lon_vertices);
-    free(lat_bnds);
-    free(lon_bnds);
-    free(lat);
-    free(lon);
+    free_grid(&grid);
     return rval;
 }
 
@@ -552,16 +645,128 @@ test_transpose()
 }
 
 
+/*
+ * backward transformation in polar form (reference).
+ */
+static int
+backward_transform_ref(double *lon, double *lat,
+                   const double *x, const double *y,
+                   int xlen, int ylen)
+{
+    Polar a, b, c;
+    Polar *w = NULL, *z = NULL;
+    double xdeg, rlon, rlat;
+    int i, j, ij, rval = -1;
+    int joint_index = 0;
+    const double JOINT_EPS = 1e-7;
+
+    if ((w = malloc(sizeof(Polar) * xlen)) == NULL
+        || (z = malloc(sizeof(Polar) * xlen)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+
+    for (j = 0; j < ylen; j++)
+        if (y[j] >= pole_latitude - JOINT_EPS) {
+            joint_index = j;
+            break;
+        }
+
+    /*
+     * south (lat/lon grid)
+     */
+    for (j = 0; j < joint_index; j++) {
+        for (i = 0; i < xlen; i++) {
+            ij = i + xlen * j;
+            lon[ij] = divmod2(a_longitude + x[i], 360.);
+            lat[ij] = y[j];
+        }
+    }
+
+    /*
+     * north (bipolar grid)
+     */
+    a = get_polar(a_longitude, a_latitude);
+    b = get_polar(b_longitude, b_latitude);
+    c = get_polar(c_longitude, c_latitude);
+    for (j = joint_index; j < ylen; j++) {
+        for (i = 0; i < xlen; i++) {
+            /*
+             * (xdeg, ydeg) -> (rlon, rlat)
+             */
+            xdeg = divmod2(x[i], 360.);
+            if (xdeg <= 180.) {
+                rlat = 90. - xdeg;
+                rlon = -90. + (y[j] - pole_latitude);
+            } else {
+                rlat = xdeg - 270.;
+                rlon = 90. - (y[j] - pole_latitude);
+            }
+            w[i] = get_polar(rlon, rlat);
+        }
+        backward_f(z, w, xlen, a, b, c);
+
+        for (i = 0; i < xlen; i++) {
+            ij = i + xlen * j;
+
+            get_lonlat(lon + ij, lat + ij, z[i]);
+            lon[ij] = divmod2(lon[ij], 360.);
+        }
+    }
+    rval = 0;
+
+finish:
+    free(z);
+    free(w);
+    return rval;
+}
+
+
+
+/*
+ * Compare backward_transform() with the reference (within 1e-12 degrees).
+ */
+static void
+test_backward(void)
+{
+    const double eps = 1e-12;
+    double x[361], y[181];
+    double lon[361 * 181], lat[361 * 181];
+    double lon2[361 * 181], lat2[361 * 181];
+    double dlon;
+    int i;
+
+    for (i = 0; i < 361; i++)
+        x[i] = -0.5 + i;
+    for (i = 0; i < 181; i++)
+        y[i] = -90. + i + (i > 150 ? pole_latitude - 60. : 0.);
+
+    assert(backward_transform(lon, lat, x, y, 361, 181) == 0);
+    assert(backward_transform_ref(lon2, lat2, x, y, 361, 181) == 0);
+    for (i = 0; i < 361 * 181; i++) {
+        assert(fabs(lat[i] - lat2[i]) < eps);
+
+        /* longitude at the poles is arbitrary. */
+        if (fabs(lat2[i]) > 90. - eps)
+            continue;
+        dlon = divmod2(lon[i] - lon2[i] + 180., 360.) - 180.;
+        assert(fabs(dlon) < eps);
+    }
+}
+
+
 int
 test_tripolar(void)
 {
     set_pole_position(63.3337);
     test_bipolar();
     test_transpose();
+    test_backward();
 
     set_pole_position(63.0);
     test_bipolar();
     test_transpose();
+    test_backward();
     printf("test_tripolar(): DONE\n");
     return 0;
 }
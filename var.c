@@ -2,8 +2,10 @@
  * var.c
  */
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "logging.h"
 #include "gtool3.h"
@@ -37,7 +39,7 @@ void
 free_var(myvar_t *var)
 {
     if (var) {
-        free(var->data);
+        bufpool_put(var->data);
         free(var->title);
         free(var->unit);
         init_var(var);
@@ -57,10 +59,13 @@ resize_var(myvar_t *var, const int *dimlen, int ndim)
         var->dimlen[i] = dimlen[i];
         nelems *= dimlen[i];
     }
-    if ((temp = malloc(sizeof(float) * nelems)) == NULL) {
-        logging(LOG_SYSERR, "resize_var(): ");
+    if ((temp = bufpool_get(sizeof(float) * nelems)) == NULL) {
+        /* the cause (malloc or --mem-limit) is reported by bufpool_get(). */
+        logging(LOG_ERR, "resize_var(): cannot allocate %d x %d x %d.",
+                dimlen[0], dimlen[1], dimlen[2]);
         return -1;
     }
+    bufpool_put(var->data);
     var->data = temp;
     var->nelems = nelems;
     var->typecode = 'f';
@@ -68,17 +73,35 @@ resize_var(myvar_t *var, const int *dimlen, int ndim)
 }
 
 
+/*
+ * Bytes per value in a data record (4 for packed formats, which is
+ * an estimate).
+ */
+static size_t
+value_bytes(const GT3_File *fp)
+{
+    return fp->fmt == GT3_FMT_UR8 || fp->fmt == GT3_FMT_MR8 ? 8 : 4;
+}
+
+
+/*
+ * Read 'nz' z-levels from the 'zstart'-th level into 'dest'.
+ * If 'zseq' is specified, the levels are taken from it successively.
+ */
 int
-read_var(myvar_t *var, GT3_Varbuf *vbuf, struct sequence *zseq)
+read_var_slab(const myvar_t *var, float *dest, GT3_Varbuf *vbuf,
+              struct sequence *zseq, int zstart, int nz)
 {
     static int print_warning = 1;
-    int nxy, nz, n, z, i;
+    int nxy, n, z, i, rc;
     float *vptr;
+    size_t nbytes;
+    double t0;
 
     nxy = var->dimlen[0] * var->dimlen[1];
-    nz = var->dimlen[2];
+    nbytes = value_bytes(vbuf->fp) * nxy;
 
-    for (vptr = var->data, n = 0; n < nz; n++, vptr += nxy) {
+    for (vptr = dest, n = zstart; n < zstart + nz; n++, vptr += nxy) {
         if (zseq) {
             if (nextSeq(zseq) != 1)
                 logging(LOG_WARN, "Invalid slicing.");
@@ -87,7 +110,11 @@ read_var(myvar_t *var, GT3_Varbuf *vbuf, struct sequence *zseq)
         } else
             z = n;
 
-        if (GT3_readVarZ(vbuf, z) < 0) {
+        t0 = stats_clock();
+        rc = GT3_readVarZ(vbuf, z);
+        io_account(IO_DATA, IO_READ, vbuf->fp->path,
+                   rc < 0 ? 0 : nbytes, t0);
+        if (rc < 0) {
             if (GT3_getLastError() == GT3_ERR_INDEX) {
                 /*
                  * We allow to specify z-layers which are not actually
@@ -115,3 +142,309 @@ read_var(myvar_t *var, GT3_Varbuf *vbuf, struct sequence *zseq)
     }
     return 0;
 }
+
+
+int
+read_var(myvar_t *var, GT3_Varbuf *vbuf, struct sequence *zseq)
+{
+    return read_var_slab(var, var->data, vbuf, zseq, 0, var->dimlen[2]);
+}
+
+
+/*
+ * Sparse read of grid points (for site locations).
+ *
+ * Only UR4 and UR8 are supported, which store big-endian values
+ * in a Fortran unformatted record after the header record:
+ *
+ *   [4] header [4] [4] values(nx * ny * nz) [4]
+ *
+ * XXX: This depends on the internal of GT3_File (the offset of the
+ * current chunk). The record markers are checked before each sparse
+ * read, so that any other layout (e.g., 8-byte markers) is read by
+ * read_var() instead.
+ */
+#define DATA_OFFSET (4 + GT3_HEADER_SIZE + 4 + 4)
+
+/* points closer than this (in bytes) are read in a single run. */
+#define RUN_GAP 4096
+
+
+static int
+read_marker(uint32_t *marker, int fd, off_t off)
+{
+    unsigned char p[4];
+
+    if (pread(fd, p, 4, off) != 4)
+        return -1;
+    *marker = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+        | (uint32_t)p[2] << 8 | p[3];
+    return 0;
+}
+
+
+/*
+ * Return 1 if the current chunk can be read by read_var_points().
+ */
+int
+sparse_readable(const GT3_Varbuf *vbuf)
+{
+    const GT3_File *fp = vbuf->fp;
+    double nbytes;
+    uint32_t m1, m2, m3;
+    int fd;
+
+    if (fp->fmt != GT3_FMT_UR4 && fp->fmt != GT3_FMT_UR8)
+        return 0;
+
+    /* a record larger than 2 GB is split by the Fortran marker. */
+    nbytes = (fp->fmt == GT3_FMT_UR4 ? 4. : 8.)
+        * fp->dimlen[0] * fp->dimlen[1] * fp->dimlen[2];
+    if (nbytes >= 2147483648.)
+        return 0;
+
+    fd = fileno(fp->fp);
+    return read_marker(&m1, fd, fp->off) == 0
+        && read_marker(&m2, fd, fp->off + 4 + GT3_HEADER_SIZE) == 0
+        && read_marker(&m3, fd, fp->off + DATA_OFFSET - 4) == 0
+        && m1 == GT3_HEADER_SIZE && m2 == GT3_HEADER_SIZE
+        && m3 == (uint32_t)nbytes;
+}
+
+
+static float
+decode_value(const unsigned char *p, int esize)
+{
+    uint32_t u4;
+    uint64_t u8;
+    float f;
+    double d;
+    int i;
+
+    if (esize == 4) {
+        for (u4 = 0, i = 0; i < 4; i++)
+            u4 = (u4 << 8) | p[i];
+        memcpy(&f, &u4, 4);
+        return f;
+    }
+    for (u8 = 0, i = 0; i < 8; i++)
+        u8 = (u8 << 8) | p[i];
+    memcpy(&d, &u8, 8);
+    return (float)d;
+}
+
+
+static int
+cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*
+ * Read values at 'npoints' points (indexes in a z-level) for all the
+ * z-levels of the current chunk, without reading the whole array.
+ * Nearby points are merged into runs, each of which is read by pread(2).
+ *
+ * dest: [0, ..., npoints * var->dimlen[2] - 1]
+ */
+int
+read_var_points(const myvar_t *var, float *dest, GT3_Varbuf *vbuf,
+                struct sequence *zseq,
+                const int *indexes, int npoints, double miss)
+{
+    static int print_warning = 1;
+    GT3_File *fp = vbuf->fp;
+    int *sorted = NULL, *rhead = NULL, *rtail = NULL;
+    size_t *rpos = NULL, *pos = NULL;
+    unsigned char *buf = NULL;
+    size_t esize, total;
+    off_t base, off;
+    double t0;
+    int fd, nruns, nxy, nz, z, n, i, r;
+    int rval = -1;
+
+    assert(sparse_readable(vbuf));
+    if (npoints == 0)
+        return 0;
+
+    esize = fp->fmt == GT3_FMT_UR4 ? 4 : 8;
+    nxy = fp->dimlen[0] * fp->dimlen[1];
+    nz = var->dimlen[2];
+
+    if ((sorted = malloc(sizeof(int) * npoints)) == NULL
+        || (rhead = malloc(sizeof(int) * npoints)) == NULL
+        || (rtail = malloc(sizeof(int) * npoints)) == NULL
+        || (rpos = malloc(sizeof(size_t) * npoints)) == NULL
+        || (pos = malloc(sizeof(size_t) * npoints)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+
+    /*
+     * sort the points and merge neighbors into runs.
+     * rpos[r]: position of the r-th run in buf.
+     */
+    memcpy(sorted, indexes, sizeof(int) * npoints);
+    qsort(sorted, npoints, sizeof(int), cmp_int);
+
+    rhead[0] = rtail[0] = sorted[0];
+    for (nruns = 1, i = 1; i < npoints; i++) {
+        if ((sorted[i] - rtail[nruns - 1]) * esize <= RUN_GAP)
+            rtail[nruns - 1] = sorted[i];
+        else {
+            rhead[nruns] = rtail[nruns] = sorted[i];
+            nruns++;
+        }
+    }
+    for (total = 0, r = 0; r < nruns; r++) {
+        rpos[r] = total;
+        total += (rtail[r] - rhead[r] + 1) * esize;
+    }
+
+    /*
+     * pos[i]: position of the i-th point in buf.
+     */
+    for (i = 0; i < npoints; i++) {
+        int lo = 0, hi = nruns - 1, mid;
+
+        while (lo < hi) {
+            mid = (lo + hi + 1) / 2;
+            if (rhead[mid] <= indexes[i])
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        pos[i] = rpos[lo] + (indexes[i] - rhead[lo]) * esize;
+    }
+
+    if ((buf = malloc(total)) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
+
+    fd = fileno(fp->fp);
+    base = fp->off + DATA_OFFSET;
+    for (n = 0; n < nz; n++, dest += npoints) {
+        if (zseq) {
+            if (nextSeq(zseq) != 1)
+                logging(LOG_WARN, "Invalid slicing.");
+
+            z = zseq->curr - 1;
+        } else
+            z = n;
+
+        if (z < 0 || z >= fp->dimlen[2]) {
+            if (print_warning) {
+                logging(LOG_WARN, "out of range: z=%d. "
+                        "Filled with missing value.", z + 1);
+                print_warning = 0;
+            }
+            for (i = 0; i < npoints; i++)
+                dest[i] = (float)miss;
+            continue;
+        }
+
+        for (r = 0; r < nruns; r++) {
+            size_t len = (rtail[r] - rhead[r] + 1) * esize;
+
+            off = base + ((off_t)z * nxy + rhead[r]) * esize;
+            t0 = stats_clock();
+            if (pread(fd, buf + rpos[r], len, off) != len) {
+                logging(LOG_SYSERR, fp->path);
+                goto finish;
+            }
+            io_account(IO_DATA, IO_READ, fp->path, len, t0);
+        }
+        for (i = 0; i < npoints; i++)
+            dest[i] = decode_value(buf + pos[i], esize);
+    }
+    rval = 0;
+
+finish:
+    free(buf);
+    free(pos);
+    free(rpos);
+    free(rtail);
+    free(rhead);
+    free(sorted);
+    return rval;
+}
+
+
+#ifdef TEST_MAIN2
+#include <stdio.h>
+
+/*
+ * read_var_points() must give the same values as read_var().
+ */
+static void
+test1(const char *fmt)
+{
+    char path[] = "/tmp/varXXXXXX";
+    int shape[] = { 37, 11, 3 };
+    int indexes[] = { 0, 5, 4, 36, 37, 200, 406, 120, 121 };
+    int npoints = sizeof indexes / sizeof indexes[0];
+    float data[37 * 11 * 3], dest[9 * 3];
+    GT3_HEADER head;
+    GT3_File *gp;
+    GT3_Varbuf *vbuf;
+    myvar_t *var;
+    FILE *fp;
+    int fd, i, z, nxy = 37 * 11;
+
+    for (i = 0; i < 37 * 11 * 3; i++)
+        data[i] = 0.25f * i - 100.f;
+
+    assert((fd = mkstemp(path)) >= 0);
+    assert((fp = fdopen(fd, "wb")) != NULL);
+    GT3_initHeader(&head);
+    GT3_setHeaderString(&head, "ITEM", "TEST");
+    GT3_setHeaderDouble(&head, "MISS", -999.);
+    assert(GT3_write(data, GT3_TFLOAT, shape[0], shape[1], shape[2],
+                     &head, fmt, fp) == 0);
+    fclose(fp);
+
+    assert((gp = GT3_open(path)) != NULL);
+    assert((vbuf = GT3_getVarbuf(gp)) != NULL);
+    assert((var = new_var()) != NULL);
+    assert(resize_var(var, shape, 3) == 0);
+    assert(read_var(var, vbuf, NULL) == 0);
+
+    if (strcmp(fmt, "UR4") == 0 || strcmp(fmt, "UR8") == 0) {
+        assert(sparse_readable(vbuf));
+        assert(read_var_points(var, dest, vbuf, NULL,
+                               indexes, npoints, -999.) == 0);
+        for (z = 0; z < shape[2]; z++)
+            for (i = 0; i < npoints; i++)
+                assert(dest[z * npoints + i]
+                       == var->data[z * nxy + indexes[i]]);
+
+        /* an unexpected layout, as if with 8-byte markers. */
+        gp->off += 4;
+        assert(!sparse_readable(vbuf));
+        gp->off -= 4;
+    } else
+        assert(!sparse_readable(vbuf));
+
+    GT3_freeVarbuf(vbuf);
+    GT3_close(gp);
+    free_var(var);
+    free(var);
+    unlink(path);
+}
+
+
+int
+test_var(void)
+{
+    test1("UR4");
+    test1("UR8");
+    test1("URY16");
+    test1("MR4");
+    printf("test_var(): DONE\n");
+    return 0;
+}
+#endif /* TEST_MAIN2 */
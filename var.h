@@ -34,5 +34,11 @@ myvar_t *new_var(void);
 void free_var(myvar_t *var);
 int resize_var(myvar_t *var, const int *dimlen, int ndim);
 int read_var(myvar_t *var, GT3_Varbuf *vbuf, struct sequence *zseq);
+int read_var_slab(const myvar_t *var, float *dest, GT3_Varbuf *vbuf,
+                  struct sequence *zseq, int zstart, int nz);
+int sparse_readable(const GT3_Varbuf *vbuf);
+int read_var_points(const myvar_t *var, float *dest, GT3_Varbuf *vbuf,
+                    struct sequence *zseq,
+                    const int *indexes, int npoints, double miss);
 
 #endif /* !VAR_H */
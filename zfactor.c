@@ -33,7 +33,7 @@ std_sigma(int sigid, const char *aitm, int astr, int aend)
     if (cmor_zfactor(&ptop_id, sigid, "ptop", "Pa",
                      0, NULL, 'd', &ptop, NULL) != 0)
         goto finish;
-    logging(LOG_INFO, "zfactor:  ptop: id = %d", ptop_id);
+    LOGGING(LOG_INFO, "zfactor:  ptop: id = %d", ptop_id);
     assert(ptop_id >= 0);
     rval = 0;
 
@@ -53,15 +53,15 @@ std2_sigma(int sigid, const char *aitm, int astr, int aend)
 {
     int rval = -1;
     char name[17];
-    GT3_Dim *dim = NULL, *bnd = NULL;
+    const GT3_Dim *dim = NULL, *bnd = NULL;
     double p0;
     double *a_bnd = NULL;
     int dimlen = aend - astr + 1;
     int i, p0_id, a_id, b_id;
 
     snprintf(name, sizeof name, "%s.M", aitm);
-    if ((dim = GT3_getDim(aitm)) == NULL
-        || (bnd = GT3_getDim(name)) == NULL) {
+    if ((dim = get_dim(aitm)) == NULL
+        || (bnd = get_dim(name)) == NULL) {
         GT3_printErrorMessages(stderr);
         rval = -1;
         goto finish;
@@ -89,13 +89,13 @@ std2_sigma(int sigid, const char *aitm, int astr, int aend)
     /* b */
     if (cmor_zfactor(&b_id, sigid, "b", "",
                      1, &sigid, 'd',
-                     dim->values + astr - 1,
-                     bnd->values + astr - 1) != 0)
+                     (double *)dim->values + astr - 1,
+                     (double *)bnd->values + astr - 1) != 0)
         goto finish;
 
-    logging(LOG_INFO, "zfactor: p0: id = %d", p0_id);
-    logging(LOG_INFO, "zfactor: a:  id = %d", a_id);
-    logging(LOG_INFO, "zfactor: b:  id = %d", b_id);
+    LOGGING(LOG_INFO, "zfactor: p0: id = %d", p0_id);
+    LOGGING(LOG_INFO, "zfactor: a:  id = %d", a_id);
+    LOGGING(LOG_INFO, "zfactor: b:  id = %d", b_id);
 
     assert(p0_id >= 0);
     assert(a_id >= 0);
@@ -103,26 +103,26 @@ std2_sigma(int sigid, const char *aitm, int astr, int aend)
     rval = 0;
 finish:
     free(a_bnd);
-    GT3_freeDim(bnd);
-    GT3_freeDim(dim);
+    release_dim(bnd);
+    release_dim(dim);
     return rval;
 }
 
 
-static GT3_Dim *
+static const GT3_Dim *
 load_dim(const char *fmt, const char *aitm, int len_required)
 {
-    GT3_Dim *dim;
+    const GT3_Dim *dim;
     char name[17];
 
     snprintf(name, sizeof name, fmt, aitm);
-    if ((dim = GT3_getDim(name)) == NULL)
+    if ((dim = get_dim(name)) == NULL)
         GT3_printErrorMessages(stderr);
 
     if (dim && dim->len - dim->cyclic < len_required) {
         logging(LOG_ERR, "%s: unexpected dim length.", name);
 
-        GT3_freeDim(dim);
+        release_dim(dim);
         dim = NULL;
     }
     return dim;
@@ -138,8 +138,9 @@ static int
 hyb_sigma(int sigid, const char *aitm, int astr, int aend)
 {
     int rval = -1;
-    GT3_Dim *a_bnd = NULL, *b_bnd = NULL;
-    GT3_Dim *a = NULL, *b = NULL;
+    const GT3_Dim *a_bnd = NULL, *b_bnd = NULL;
+    const GT3_Dim *a = NULL, *b = NULL;
+    double *a_values = NULL, *a_bounds = NULL;
     double p0;
     int dimlen = aend - astr + 1;
     int i, p0_id, a_id, b_id;
@@ -160,47 +161,54 @@ hyb_sigma(int sigid, const char *aitm, int astr, int aend)
     if (cmor_zfactor(&p0_id, sigid, "p0", "Pa",
                      0, NULL, 'd', &p0, NULL) != 0)
         goto finish;
-    logging(LOG_INFO, "zfactor: p0: id = %d", p0_id);
+    LOGGING(LOG_INFO, "zfactor: p0: id = %d", p0_id);
 
     /*
-     * "hPa -> Pa" and "/ p0".
+     * "hPa -> Pa" and "/ p0" (into copies; the dims are shared).
      */
+    if ((a_values = malloc(sizeof(double) * dimlen)) == NULL
+        || (a_bounds = malloc(sizeof(double) * (dimlen + 1))) == NULL) {
+        logging(LOG_SYSERR, NULL);
+        goto finish;
+    }
     if (a_bnd) {
-        for (i = 0; i < a_bnd->len; i++)
-            a_bnd->values[i] *= 100. / p0;
+        for (i = 0; i < dimlen + 1; i++)
+            a_bounds[i] = a_bnd->values[i + astr - 1] * (100. / p0);
     }
-    for (i = 0; i < a->len; i++)
-        a->values[i] *= 100. / p0;
+    for (i = 0; i < dimlen; i++)
+        a_values[i] = a->values[i + astr - 1] * (100. / p0);
 
     /* a */
     term_name = a_bnd ? "a" : "a_half";
-    bounds = a_bnd ? a_bnd->values + astr - 1 : NULL;
+    bounds = a_bnd ? a_bounds : NULL;
     if (cmor_zfactor(&a_id, sigid, term_name, "",
                      1, &sigid, 'd',
-                     a->values + astr - 1,
+                     a_values,
                      bounds) != 0)
         goto finish;
-    logging(LOG_INFO, "zfactor: a:  id = %d", a_id);
+    LOGGING(LOG_INFO, "zfactor: a:  id = %d", a_id);
 
     /* b */
     term_name = b_bnd ? "b" : "b_half";
-    bounds = b_bnd ? b_bnd->values + astr - 1 : NULL;
+    bounds = b_bnd ? (double *)b_bnd->values + astr - 1 : NULL;
     if (cmor_zfactor(&b_id, sigid, term_name, "",
                      1, &sigid, 'd',
-                     b->values + astr -1,
+                     (double *)b->values + astr -1,
                      bounds) != 0)
         goto finish;
-    logging(LOG_INFO, "zfactor: b:  id = %d", b_id);
+    LOGGING(LOG_INFO, "zfactor: b:  id = %d", b_id);
 
     assert(p0_id >= 0);
     assert(a_id >= 0);
     assert(b_id >= 0);
     rval = 0;
 finish:
-    GT3_freeDim(b);
-    GT3_freeDim(a);
-    GT3_freeDim(b_bnd);
-    GT3_freeDim(a_bnd);
+    free(a_bounds);
+    free(a_values);
+    release_dim(b);
+    release_dim(a);
+    release_dim(b_bnd);
+    release_dim(a_bnd);
     return rval;
 }
 
@@ -216,7 +224,8 @@ finish:
 static int
 ocean_sigma(int z_id, const char *aitm, int astr, int aend)
 {
-    GT3_Dim *dim = NULL, *bnd = NULL;
+    const GT3_Dim *dim = NULL, *bnd = NULL;
+    double *zlev = NULL, *zlev_bnd = NULL;
     double *sigma = NULL, *sigma_bnd = NULL;
     double depth_c = ocean_sigma_bottom;
     char bndname[17];
@@ -226,26 +235,29 @@ ocean_sigma(int z_id, const char *aitm, int astr, int aend)
     int i;
 
     snprintf(bndname, sizeof bndname, "%s.M", aitm);
-    if ((dim = GT3_getDim(aitm)) == NULL
-        || (bnd = GT3_getDim(bndname)) == NULL) {
+    if ((dim = get_dim(aitm)) == NULL
+        || (bnd = get_dim(bndname)) == NULL) {
         GT3_printErrorMessages(stderr);
         goto finish;
     }
 
     len = aend - astr + 1;
     if ((sigma = malloc(sizeof(double) * len)) == NULL
-        || (sigma_bnd = malloc(sizeof(double) * (len + 1))) == NULL) {
+        || (sigma_bnd = malloc(sizeof(double) * (len + 1))) == NULL
+        || (zlev = malloc(sizeof(double) * len)) == NULL
+        || (zlev_bnd = malloc(sizeof(double) * (len + 1))) == NULL) {
         logging(LOG_SYSERR, NULL);
         goto finish;
     }
 
     /*
      * From depth (positive downward) to lev (positive upward).
+     * (into copies; the dims are shared)
      */
-    for (i = 0; i < dim->len; i++)
-        dim->values[i] *= -1.;
-    for (i = 0; i < bnd->len; i++)
-        bnd->values[i] *= -1.;
+    for (i = 0; i < len; i++)
+        zlev[i] = -dim->values[i + astr - 1];
+    for (i = 0; i < len + 1; i++)
+        zlev_bnd[i] = -bnd->values[i + astr - 1];
 
     /*
      * Calculates sigma from depth and depth_c(ZBOT).
@@ -253,47 +265,48 @@ ocean_sigma(int z_id, const char *aitm, int astr, int aend)
      * XXX Only 'nsigma' elements are meaingful.
      */
     for (i = 0; i < len; i++)
-        sigma[i] = dim->values[i + astr - 1] / depth_c;
+        sigma[i] = zlev[i] / depth_c;
     for (i = 0; i < len + 1; i++)
-        sigma_bnd[i] = bnd->values[i + astr - 1] / depth_c;
+        sigma_bnd[i] = zlev_bnd[i] / depth_c;
 
     for (nsigma = 0; nsigma < len && sigma[nsigma] >= -1.; nsigma++)
         ;
-    logging(LOG_INFO, "# of sigma-level in ocean_sigma_z: %d", nsigma);
+    LOGGING(LOG_INFO, "# of sigma-level in ocean_sigma_z: %d", nsigma);
 
     /* depth_c */
     if (cmor_zfactor(&depth_c_id, z_id, "depth_c", "", /* "m" */
                      0, NULL, 'd', &depth_c, NULL) != 0)
         goto finish;
-    logging(LOG_INFO, "zfactor: depth_c: id = %d", depth_c_id);
+    LOGGING(LOG_INFO, "zfactor: depth_c: id = %d", depth_c_id);
 
     /* nsigma */
     if (cmor_zfactor(&nsigma_id, z_id, "nsigma", "",
                      0, NULL, 'i', &nsigma, NULL) != 0)
         goto finish;
-    logging(LOG_INFO, "zfactor: nsigma:  id = %d", nsigma_id);
+    LOGGING(LOG_INFO, "zfactor: nsigma:  id = %d", nsigma_id);
 
     /* sigma */
     if (cmor_zfactor(&sigma_id, z_id, "sigma", "",
                      1, &z_id, 'd',
                      sigma, sigma_bnd) != 0)
         goto finish;
-    logging(LOG_INFO, "zfactor: sigma:   id = %d", sigma_id);
+    LOGGING(LOG_INFO, "zfactor: sigma:   id = %d", sigma_id);
 
     /* zlev */
     if (cmor_zfactor(&zlev_id, z_id, "zlev", "", /* dim->unit, */
                      1, &z_id, 'd',
-                     dim->values + astr - 1,
-                     bnd->values + astr - 1) != 0)
+                     zlev, zlev_bnd) != 0)
         goto finish;
-    logging(LOG_INFO, "zfactor: zlev:    id = %d", zlev_id);
+    LOGGING(LOG_INFO, "zfactor: zlev:    id = %d", zlev_id);
 
     rval = 0;
 finish:
+    free(zlev_bnd);
+    free(zlev);
     free(sigma_bnd);
     free(sigma);
-    GT3_freeDim(dim);
-    GT3_freeDim(bnd);
+    release_dim(dim);
+    release_dim(bnd);
 
     return rval;
 }
@@ -335,7 +348,7 @@ search_formula_term(const char *name, const int *axis_ids, int naxes,
 
             if (adef && adef->axis == 'T'
                 && vdef->dimensions[j] == time_def_id) {
-                logging(LOG_INFO, "search_formula_term: %s", candidates[i]);
+                LOGGING(LOG_INFO, "search_formula_term: %s", candidates[i]);
                 return i;
             }
         }
@@ -345,6 +358,39 @@ search_formula_term(const char *name, const int *axis_ids, int naxes,
 }
 
 
+/*
+ * Call cmor_zfactor() for a time-dependent zfactor (e.g., ps, eta).
+ *
+ * CMOR links zfactors to a variable by (z-axis, name). A z-axis is
+ * shared by the variables in a session, so that the zfactor must be
+ * defined once for it, and reused by the following variables.
+ */
+static int
+define_zfactor(int z_id, const char *name, const char *unit,
+               int naxes, const int *axes_ids, char type)
+{
+    char key[128];
+    int id, i, n;
+
+    n = snprintf(key, sizeof key, "zfactor %d %s", z_id, name);
+    for (i = 0; i < naxes && n < sizeof key; i++)
+        n += snprintf(key + n, sizeof key - n, " %d", axes_ids[i]);
+    if (n >= sizeof key)
+        key[0] = '\0';
+    else if ((id = idreg_lookup(key)) >= 0)
+        return id;
+
+    if (cmor_zfactor(&id, z_id, (char *)name, (char *)unit,
+                     naxes, (int *)axes_ids, type, NULL, NULL) != 0)
+        return -1;
+
+    LOGGING(LOG_INFO, "zfactor: %s: id = %d", name, id);
+    if (key[0] != '\0')
+        idreg_register(key, id);
+    return id;
+}
+
+
 /*
  * set all the zfactors for specified 'var_id'.
  *
@@ -376,6 +422,8 @@ setup_zfactors(int *zfac_ids, int var_id,
     } zfactors[16];
     gtool3_dim_prop dim;
     int astr, aend, step;
+    char key[32];
+    int defined;
 
     /*
      * collect axis-ids except for Z-axis.
@@ -408,6 +456,12 @@ setup_zfactors(int *zfac_ids, int var_id,
         zfactors[i].type = 'd';
     }
 
+    /*
+     * The formula terms of a reused z-axis are already defined.
+     */
+    snprintf(key, sizeof key, "formula terms %d", z_id);
+    defined = idreg_lookup(key) >= 0;
+
     /*
      * XXX: The unit of zfactors is hard-coded.
      */
@@ -428,7 +482,7 @@ setup_zfactors(int *zfac_ids, int var_id,
             int num = sizeof names / sizeof names[0];
             int idx;
 
-            if (std_sigma(z_id, dim.aitm, astr, aend) < 0)
+            if (!defined && std_sigma(z_id, dim.aitm, astr, aend) < 0)
                 return -1;
 
             /* search the formula term (zfactor) */
@@ -446,7 +500,7 @@ setup_zfactors(int *zfac_ids, int var_id,
             int num = sizeof names / sizeof names[0];
             int idx;
 
-            if (hyb_sigma(z_id, dim.aitm, astr, aend) < 0)
+            if (!defined && hyb_sigma(z_id, dim.aitm, astr, aend) < 0)
                 return -1;
 
             /* search the formula term (zfactor) */
@@ -464,7 +518,7 @@ setup_zfactors(int *zfac_ids, int var_id,
             int num = sizeof names / sizeof names[0];
             int idx;
 
-            if (ocean_sigma(z_id, dim.aitm, astr, aend) < 0)
+            if (!defined && ocean_sigma(z_id, dim.aitm, astr, aend) < 0)
                 return -1;
 
             /* search the formula term (zfactor) */
@@ -483,21 +537,19 @@ setup_zfactors(int *zfac_ids, int var_id,
         }
     }
 
+    if (!defined)
+        idreg_register(key, z_id);
+
     /*
      * call cmor_zfactor() for each zfactor.
      */
     for (i = 0; zfactors[i].name != NULL; i++) {
-        int temp_id;
-
-        if (cmor_zfactor(&temp_id, z_id,
-                         zfactors[i].name, zfactors[i].unit,
-                         zfactors[i].naxes, zfactors[i].axes_ids,
-                         zfactors[i].type,
-                         NULL, NULL) != 0)
+        if ((zfac_ids[i] = define_zfactor(z_id,
+                                          zfactors[i].name, zfactors[i].unit,
+                                          zfactors[i].naxes,
+                                          zfactors[i].axes_ids,
+                                          zfactors[i].type)) < 0)
             return -1;
-
-        logging(LOG_INFO, "zfactor: %s: id = %d", zfactors[i].name, temp_id);
-        zfac_ids[i] = temp_id;
     }
     return i;
 }
@@ -546,10 +598,55 @@ test_ocean(void)
 
 
 
+/*
+ * Two variables on a shared z-axis (":cl ... :cli ..." in a session)
+ * must share the zfactor "ps", which CMOR links by (z-axis, name).
+ */
+void
+test_shared_zaxis(void)
+{
+    double lon[] = { 90., 270. }, lon_bnds[] = { 0., 180., 360. };
+    double lat[] = { -45., 45. }, lat_bnds[] = { -90., 0., 90. };
+    cmor_var_def_t *vdef;
+    GT3_HEADER head;
+    float miss = 1e20f;
+    char positive = '\0';
+    int ids[7], nid, zfac1[16], zfac2[16];
+    int var1, var2, nvars;
+
+    assert(cmor_axis(&ids[0], "time", "days since 2000-01-01", 1,
+                     NULL, 'd', NULL, 0, NULL) == 0);
+    vdef = lookup_vardef("cl");
+    assert(vdef);
+    assert(get_axis_ids(ids + 1, &nid, "CSIG20", 1, 20, NULL, vdef, NULL)
+           == 0 && nid == 1);
+    assert(cmor_axis(&ids[2], "latitude", "degrees_north", 2,
+                     lat, 'd', lat_bnds, 1, NULL) == 0);
+    assert(cmor_axis(&ids[3], "longitude", "degrees_east", 2,
+                     lon, 'd', lon_bnds, 1, NULL) == 0);
+
+    GT3_initHeader(&head);
+    GT3_setHeaderString(&head, "AITM3", "CSIG20");
+    GT3_setHeaderInt(&head, "ASTR3", 1);
+    GT3_setHeaderInt(&head, "AEND3", 20);
+
+    assert(cmor_variable(&var1, "cl", "%", 4, ids, 'f', &miss,
+                         NULL, &positive, "cl", NULL, NULL) == 0);
+    assert(setup_zfactors(zfac1, var1, ids, 4, &head, NULL) == 1);
+
+    assert(cmor_variable(&var2, "cli", "kg kg-1", 4, ids, 'f', &miss,
+                         NULL, &positive, "cli", NULL, NULL) == 0);
+    nvars = cmor_nvars;
+    assert(setup_zfactors(zfac2, var2, ids, 4, &head, NULL) == 1);
+    assert(zfac2[0] == zfac1[0] && cmor_nvars == nvars);
+}
+
+
 int
 test_zfactor(void)
 {
     test_csig();
+    test_shared_zaxis();
     /* test_ocean(); */
     printf("test_zfactor(): DONE\n");
     return 0;